@@ -0,0 +1,24 @@
+#include "bench.h"
+
+uint64_t BENCH_ALLOCS;
+
+void*
+__wrap_malloc(size_t size)
+{
+   ++BENCH_ALLOCS;
+   return __real_malloc(size);
+}
+
+void*
+__wrap_calloc(size_t nmemb, size_t size)
+{
+   ++BENCH_ALLOCS;
+   return __real_calloc(nmemb, size);
+}
+
+void*
+__wrap_realloc(void *ptr, size_t size)
+{
+   ++BENCH_ALLOCS;
+   return __real_realloc(ptr, size);
+}
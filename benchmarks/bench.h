@@ -0,0 +1,109 @@
+#ifndef __wlc_bench_h__
+#define __wlc_bench_h__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#undef NDEBUG
+#include <assert.h>
+
+/**
+ * Tiny timing harness for benchmarks.
+ * Results are printed to stdout as single JSON document:
+ * {"benchmark":"<name>","results":[{"name":..,"live":..,"ops":..,"ns_per_op":..,"allocs":..,"allocs_per_op":..}, ...]}
+ *
+ * Allocations are counted by wrapping malloc, calloc and realloc at link time (see bench.c and benchmarks/CMakeLists.txt).
+ */
+
+// Allocation count, defined with the allocator wraps in bench.c
+extern uint64_t BENCH_ALLOCS;
+static bool BENCH_FIRST_RESULT = true;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void *ptr, size_t size);
+void* __wrap_malloc(size_t size);
+void* __wrap_calloc(size_t nmemb, size_t size);
+void* __wrap_realloc(void *ptr, size_t size);
+
+struct bench {
+   const char *name;
+   size_t live, ops;
+   uint64_t start, allocs;
+};
+
+static inline uint64_t
+bench_now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void
+bench_begin_suite(const char *name)
+{
+   printf("{\"benchmark\":\"%s\",\"results\":[", name);
+   BENCH_FIRST_RESULT = true;
+}
+
+static inline void
+bench_end_suite(void)
+{
+   printf("\n]}\n");
+   fflush(stdout);
+}
+
+static inline void
+bench_start(struct bench *bench, const char *name, size_t live)
+{
+   assert(bench && name);
+   memset(bench, 0, sizeof(struct bench));
+   bench->name = name;
+   bench->live = live;
+   bench->allocs = BENCH_ALLOCS;
+   bench->start = bench_now();
+}
+
+static inline void
+bench_stop(struct bench *bench, size_t ops)
+{
+   assert(bench && ops > 0);
+   const uint64_t elapsed = bench_now() - bench->start;
+   const uint64_t allocs = BENCH_ALLOCS - bench->allocs;
+
+   printf("%s\n   {\"name\":\"%s\",\"live\":%zu,\"ops\":%zu,\"ns_per_op\":%.2f,\"allocs\":%llu,\"allocs_per_op\":%.4f}",
+         (BENCH_FIRST_RESULT ? "" : ","), bench->name, bench->live, ops,
+         (double)elapsed / ops, (unsigned long long)allocs, (double)allocs / ops);
+
+   BENCH_FIRST_RESULT = false;
+}
+
+/** Deterministic xorshift, so runs are comparable. */
+static inline uint32_t
+bench_random(uint32_t *state)
+{
+   assert(state && *state);
+   uint32_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   return (*state = x);
+}
+
+/** Parse optional max live object count from first argument. */
+static inline size_t
+bench_max_live(int argc, char *argv[], size_t fallback)
+{
+   if (argc < 2)
+      return fallback;
+
+   const long long v = strtoll(argv[1], NULL, 10);
+   return (v > 0 ? (size_t)v : fallback);
+}
+
+#endif /* __wlc_bench_h__ */
@@ -0,0 +1,520 @@
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "client.h"
+#include "bench.h"
+
+/**
+ * End-to-end benchmark, each scenario runs headless wlc in its own process with single client process
+ * driving all the synthetic client connections. Client measures commit to frame callback latency,
+ * compositor measures frames, CPU time and peak RSS while the client is committing.
+ *
+ * Usage: compositor-bench [seconds per scenario] [scenario...]
+ */
+
+static const struct scenario {
+   const char *name;
+   uint32_t clients;
+   uint32_t width, height; // 0 for output size
+   uint32_t depth; // surfaces in subsurface chain, 1 for no subsurfaces
+   uint32_t rate; // commits per second, 0 for as fast as frame callbacks allow
+   bool opaque;
+} scenarios[] = {
+   { "video", 1, 0, 0, 1, 60, true },
+   { "tooltips", 64, 96, 32, 1, 10, false },
+   { "subsurface-tree", 4, 256, 256, 16, 60, true },
+   { "windows-opaque", 8, 640, 480, 1, 60, true },
+   { "windows-alpha", 8, 640, 480, 1, 60, false },
+   { "unthrottled", 4, 640, 480, 1, 0, true },
+};
+
+struct client_results {
+   uint64_t frames, seconds_ns;
+   uint32_t p50, p90, p99, max; // microseconds
+};
+
+static const struct scenario *scenario;
+static double duration = 5.0;
+static int results_pipe[2];
+
+struct bench_surface {
+   struct wl_surface *surface;
+   struct wl_subsurface *subsurface;
+   struct wl_buffer *buffers[2];
+   void *data[2];
+   bool busy[2];
+};
+
+struct bench_client {
+   struct client_test test;
+   struct wl_registry *registry;
+   struct wl_subcompositor *subcompositor;
+   struct wl_shell_surface *ssurface;
+   struct bench_surface *surfaces;
+   struct wl_callback *frame;
+   uint32_t width, height, format;
+   uint64_t committed, next_commit;
+   uint8_t counter;
+};
+
+static struct {
+   uint32_t *us;
+   size_t count, allocated;
+   uint64_t frames;
+   bool measuring;
+} latencies;
+
+static void
+latencies_push(uint32_t us)
+{
+   if (latencies.count >= latencies.allocated) {
+      latencies.allocated = (latencies.allocated ? latencies.allocated * 2 : 1024);
+      assert((latencies.us = realloc(latencies.us, latencies.allocated * sizeof(uint32_t))));
+   }
+
+   latencies.us[latencies.count++] = us;
+}
+
+static int
+compare_u32(const void *a, const void *b)
+{
+   const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+   return (x > y) - (x < y);
+}
+
+static uint32_t
+latencies_percentile(double q)
+{
+   if (!latencies.count)
+      return 0;
+
+   const size_t i = q * latencies.count;
+   return latencies.us[(i < latencies.count ? i : latencies.count - 1)];
+}
+
+static void
+buffer_release(void *data, struct wl_buffer *buffer)
+{
+   (void)buffer;
+   *(bool*)data = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+   .release = buffer_release
+};
+
+static void
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+   (void)time;
+   struct bench_client *client;
+   assert((client = data) && client->frame == callback);
+   wl_callback_destroy(callback);
+   client->frame = NULL;
+
+   if (!latencies.measuring)
+      return;
+
+   latencies_push((bench_now() - client->committed) / 1000);
+   ++latencies.frames;
+}
+
+static const struct wl_callback_listener frame_listener = {
+   .done = frame_done
+};
+
+static void
+subcompositor_global(void *data, struct wl_registry *registry, uint32_t name, const char *interface, uint32_t version)
+{
+   (void)version;
+   struct bench_client *client;
+   assert((client = data));
+
+   if (chck_cstreq(interface, "wl_subcompositor"))
+      assert((client->subcompositor = wl_registry_bind(registry, name, &wl_subcompositor_interface, 1)));
+}
+
+static const struct wl_registry_listener subcompositor_registry_listener = {
+   .global = subcompositor_global,
+   .global_remove = handle_global_remove,
+};
+
+static void
+create_buffer(struct bench_client *client, struct bench_surface *surface, uint32_t index)
+{
+   int fd;
+   const size_t stride = client->width * 4;
+   const size_t size = stride * client->height;
+   assert((fd = os_create_anonymous_file(size)) >= 0);
+   assert((surface->data[index] = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED);
+
+   struct wl_shm_pool *pool;
+   assert((pool = wl_shm_create_pool(client->test.shm, fd, size)));
+   assert((surface->buffers[index] = wl_shm_pool_create_buffer(pool, 0, client->width, client->height, stride, client->format)));
+   wl_buffer_add_listener(surface->buffers[index], &buffer_listener, &surface->busy[index]);
+   wl_shm_pool_destroy(pool);
+   close(fd);
+}
+
+static bool
+client_commit(struct bench_client *client, uint64_t now)
+{
+   assert(client);
+
+   // don't draw into buffers compositor still holds
+   uint32_t next[scenario->depth];
+   for (uint32_t d = 0; d < scenario->depth; ++d) {
+      const struct bench_surface *s = &client->surfaces[d];
+      next[d] = (s->busy[0] ? 1 : 0);
+
+      if (s->busy[next[d]])
+         return false;
+   }
+
+   // video-like full updates, alpha stays partial in alpha scenarios as all bytes are equal
+   const uint8_t value = 0x40 + (++client->counter & 0x3f);
+   const size_t size = (size_t)client->width * client->height * 4;
+
+   // children first, sync subsurfaces apply on parent commit
+   for (uint32_t d = scenario->depth; d > 0; --d) {
+      struct bench_surface *s = &client->surfaces[d - 1];
+      memset(s->data[next[d - 1]], value, size);
+      wl_surface_attach(s->surface, s->buffers[next[d - 1]], 0, 0);
+      wl_surface_damage(s->surface, 0, 0, client->width, client->height);
+      s->busy[next[d - 1]] = true;
+
+      if (d == 1) {
+         assert((client->frame = wl_surface_frame(s->surface)));
+         wl_callback_add_listener(client->frame, &frame_listener, client);
+      }
+
+      wl_surface_commit(s->surface);
+   }
+
+   client->committed = now;
+   return true;
+}
+
+static void
+client_tick(struct bench_client *client, uint64_t now)
+{
+   assert(client);
+
+   if (client->frame || (scenario->rate && now < client->next_commit))
+      return;
+
+   if (!client_commit(client, now))
+      return;
+
+   if (scenario->rate) {
+      const uint64_t period = 1000000000 / scenario->rate;
+      client->next_commit = (client->next_commit + period > now ? client->next_commit + period : now + period);
+   }
+}
+
+static void
+client_create(struct bench_client *client)
+{
+   assert(client);
+   memset(client, 0, sizeof(struct bench_client));
+   client_test_create(&client->test, scenario->name, scenario->width, scenario->height);
+
+   assert((client->registry = wl_display_get_registry(client->test.display)));
+   wl_registry_add_listener(client->registry, &subcompositor_registry_listener, client);
+   wl_display_roundtrip(client->test.display);
+   assert(client->subcompositor);
+
+   client->width = scenario->width;
+   client->height = scenario->height;
+   client->format = (scenario->opaque ? WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888);
+
+   if (!client->width || !client->height) {
+      struct output *o;
+      assert((o = chck_iter_pool_get(&client->test.outputs, 0)));
+
+      struct mode *m;
+      chck_iter_pool_for_each(&o->modes, m) {
+         if (!(m->flags & WL_OUTPUT_MODE_CURRENT))
+            continue;
+
+         client->width = m->width;
+         client->height = m->height;
+      }
+
+      assert(client->width > 0 && client->height > 0);
+   }
+
+   assert((client->surfaces = calloc(scenario->depth, sizeof(struct bench_surface))));
+   for (uint32_t d = 0; d < scenario->depth; ++d) {
+      struct bench_surface *s = &client->surfaces[d];
+      assert((s->surface = wl_compositor_create_surface(client->test.compositor)));
+      create_buffer(client, s, 0);
+      create_buffer(client, s, 1);
+
+      if (scenario->opaque) {
+         struct wl_region *region;
+         assert((region = wl_compositor_create_region(client->test.compositor)));
+         wl_region_add(region, 0, 0, client->width, client->height);
+         wl_surface_set_opaque_region(s->surface, region);
+         wl_region_destroy(region);
+      }
+
+      if (d > 0) {
+         assert((s->subsurface = wl_subcompositor_get_subsurface(client->subcompositor, s->surface, client->surfaces[d - 1].surface)));
+         wl_subsurface_set_position(s->subsurface, 16, 16);
+      }
+   }
+
+   assert((client->ssurface = wl_shell_get_shell_surface(client->test.shell, client->surfaces[0].surface)));
+   wl_shell_surface_add_listener(client->ssurface, &shell_surface_listener, &client->test);
+   wl_shell_surface_set_toplevel(client->ssurface);
+   assert(client_commit(client, bench_now()));
+}
+
+static int
+client_main(void)
+{
+   struct bench_client *clients;
+   assert((clients = calloc(scenario->clients, sizeof(struct bench_client))));
+
+   for (uint32_t i = 0; i < scenario->clients; ++i)
+      client_create(&clients[i]);
+
+   // wait until every client has its first frame on screen
+   for (bool pending = true; pending;) {
+      pending = false;
+      for (uint32_t i = 0; i < scenario->clients; ++i) {
+         if (!clients[i].frame)
+            continue;
+
+         assert(wl_display_dispatch(clients[i].test.display) != -1);
+         pending = true;
+      }
+   }
+
+   struct pollfd *fds;
+   assert((fds = calloc(scenario->clients, sizeof(struct pollfd))));
+
+   // start of measurement window
+   kill(getppid(), SIGUSR1);
+   latencies.measuring = true;
+
+   const uint64_t start = bench_now();
+   const uint64_t end = start + duration * 1e9;
+   for (uint64_t now = start; now < end; now = bench_now()) {
+      for (uint32_t i = 0; i < scenario->clients; ++i) {
+         client_tick(&clients[i], now);
+         wl_display_dispatch_pending(clients[i].test.display);
+         wl_display_flush(clients[i].test.display);
+         fds[i] = (struct pollfd){ .fd = wl_display_get_fd(clients[i].test.display), .events = POLLIN };
+      }
+
+      if (poll(fds, scenario->clients, 1) <= 0)
+         continue;
+
+      for (uint32_t i = 0; i < scenario->clients; ++i) {
+         if (fds[i].revents & POLLIN)
+            assert(wl_display_dispatch(clients[i].test.display) != -1);
+      }
+   }
+
+   latencies.measuring = false;
+   kill(getppid(), SIGUSR1);
+   const uint64_t elapsed = bench_now() - start;
+
+   qsort(latencies.us, latencies.count, sizeof(uint32_t), compare_u32);
+   const struct client_results results = {
+      .frames = latencies.frames,
+      .seconds_ns = elapsed,
+      .p50 = latencies_percentile(0.50),
+      .p90 = latencies_percentile(0.90),
+      .p99 = latencies_percentile(0.99),
+      .max = latencies_percentile(1.0),
+   };
+
+   assert(write(results_pipe[1], &results, sizeof(results)) == sizeof(results));
+   return client_test_end(&clients[0].test);
+}
+
+static struct compositor_test compositor;
+
+static struct {
+   volatile sig_atomic_t phase; // 1 while client is measuring
+   uint64_t frames, start, last;
+   double cpu_start, cpu_last; // microseconds
+   long max_rss; // kilobytes
+} measure;
+
+static void
+measure_signal(int signal)
+{
+   (void)signal;
+   ++measure.phase;
+}
+
+static void
+output_render_post(wlc_handle output)
+{
+   (void)output;
+
+   if (measure.phase != 1)
+      return;
+
+   // process wide, so render thread is accounted as well
+   struct rusage ru;
+   getrusage(RUSAGE_SELF, &ru);
+   const double cpu = ru.ru_utime.tv_sec * 1e6 + ru.ru_utime.tv_usec + ru.ru_stime.tv_sec * 1e6 + ru.ru_stime.tv_usec;
+   const uint64_t now = bench_now();
+
+   if (!measure.frames++) {
+      measure.start = now;
+      measure.cpu_start = cpu;
+   }
+
+   measure.last = now;
+   measure.cpu_last = cpu;
+   measure.max_rss = ru.ru_maxrss;
+}
+
+static bool
+view_created(wlc_handle view)
+{
+   static uint32_t index;
+   const wlc_handle output = wlc_view_get_output(view);
+   const struct wlc_size *r = wlc_output_get_resolution(output);
+   const uint32_t w = (scenario->width ? scenario->width : r->w);
+   const uint32_t h = (scenario->height ? scenario->height : r->h);
+
+   // scatter views over the output, so they partially overlap
+   const struct wlc_geometry g = {
+      .origin = { (r->w > w ? (index * 97) % (r->w - w) : 0), (r->h > h ? (index * 61) % (r->h - h) : 0) },
+      .size = { w, h },
+   };
+
+   ++index;
+   wlc_view_set_geometry(view, 0, &g);
+   wlc_view_set_mask(view, wlc_output_get_mask(output));
+   wlc_view_bring_to_front(view);
+   return true;
+}
+
+static void
+compositor_ready(void)
+{
+   fflush(stdout);
+   compositor_test_fork_client(&compositor, client_main);
+}
+
+static void
+log_stderr(enum wlc_log_type type, const char *str)
+{
+   (void)type;
+   fprintf(stderr, "%s\n", str);
+}
+
+static void
+print_result(const struct client_results *results)
+{
+   assert(results);
+   const uint64_t frames = (measure.frames > 1 ? measure.frames - 1 : 0);
+   const double seconds = (measure.last - measure.start) / 1e9;
+   const double client_seconds = results->seconds_ns / 1e9;
+
+   printf("%s\n   {\"name\":\"%s\",\"clients\":%u,\"width\":%u,\"height\":%u,\"depth\":%u,\"rate\":%u,\"opaque\":%s,"
+          "\"client_frames\":%llu,\"client_fps\":%.2f,\"latency_us\":{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u},"
+          "\"frames\":%llu,\"fps\":%.2f,\"cpu_us_per_frame\":%.2f,\"max_rss_kb\":%ld}",
+         (BENCH_FIRST_RESULT ? "" : ","), scenario->name, scenario->clients, scenario->width, scenario->height, scenario->depth, scenario->rate, (scenario->opaque ? "true" : "false"),
+         (unsigned long long)results->frames, (client_seconds > 0 ? results->frames / client_seconds : 0),
+         results->p50, results->p90, results->p99, results->max,
+         (unsigned long long)frames, (seconds > 0 ? frames / seconds : 0),
+         (frames ? (measure.cpu_last - measure.cpu_start) / frames : 0), measure.max_rss);
+
+   fflush(stdout);
+}
+
+static int
+compositor_main(void)
+{
+   assert(!pipe(results_pipe));
+
+   memset(&compositor, 0, sizeof(compositor));
+   compositor.name = scenario->name;
+   wlc_log_set_handler(log_stderr);
+   setup_signals(compositor_sigterm);
+
+   {
+      struct sigaction action = {
+         .sa_handler = measure_signal,
+      };
+
+      sigaction(SIGUSR1, &action, NULL);
+   }
+
+   setenv("WLC_BACKEND", "headless", false);
+   setenv("WLC_HEADLESS_RESOLUTION", "1920x1080", false);
+
+   wlc_set_view_created_cb(view_created);
+   wlc_set_output_render_post_cb(output_render_post);
+   wlc_set_compositor_ready_cb(compositor_ready);
+
+   assert(wlc_init());
+   wlc_run();
+
+   struct client_results results;
+   assert(read(results_pipe[0], &results, sizeof(results)) == sizeof(results));
+   print_result(&results);
+   return compositor_test_end(&compositor);
+}
+
+static bool
+scenario_selected(const struct scenario *s, int argc, char *argv[])
+{
+   if (argc < 3)
+      return true;
+
+   for (int i = 2; i < argc; ++i) {
+      if (chck_cstreq(argv[i], s->name))
+         return true;
+   }
+
+   return false;
+}
+
+int
+main(int argc, char *argv[])
+{
+   if (argc > 1 && strtod(argv[1], NULL) > 0)
+      duration = strtod(argv[1], NULL);
+
+   int status = EXIT_SUCCESS;
+   bench_begin_suite("compositor");
+
+   for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i) {
+      if (!scenario_selected(&scenarios[i], argc, argv))
+         continue;
+
+      scenario = &scenarios[i];
+      fflush(stdout);
+
+      pid_t pid;
+      assert((pid = fork()) >= 0);
+
+      if (pid == 0)
+         _exit(compositor_main());
+
+      int wstatus;
+      assert(waitpid(pid, &wstatus, 0) == pid);
+
+      if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_SUCCESS) {
+         BENCH_FIRST_RESULT = false;
+      } else {
+         fprintf(stderr, "Scenario %s failed\n", scenario->name);
+         status = EXIT_FAILURE;
+      }
+   }
+
+   bench_end_suite();
+   return status;
+}
@@ -0,0 +1,150 @@
+#include <unistd.h>
+#include <sys/socket.h>
+#include <wayland-server.h>
+#include <wlc/wlc.h>
+#include "resources/resources.h"
+#include "bench.h"
+
+// Roughly the size of small handle types, eg. wlc_region
+struct container {
+   wlc_handle self;
+   uint8_t payload[56];
+};
+
+static const size_t LOOKUPS = 1 << 20;
+static const size_t CHURN = 1 << 18;
+
+static void
+bench_handles(size_t live)
+{
+   assert(wlc_resources_init());
+
+   struct wlc_source source;
+   assert(wlc_source(&source, "bench", NULL, NULL, 32, sizeof(struct container)));
+
+   wlc_handle *handles;
+   assert((handles = calloc(live, sizeof(wlc_handle))));
+
+   struct bench bench;
+   bench_start(&bench, "wlc_handle_create", live);
+   for (size_t i = 0; i < live; ++i) {
+      struct container *c;
+      assert((c = wlc_handle_create(&source)));
+      handles[i] = c->self = convert_to_wlc_handle(c);
+   }
+   bench_stop(&bench, live);
+
+   uint32_t seed = 0x9e3779b9;
+   bench_start(&bench, "convert_from_wlc_handle", live);
+   for (size_t i = 0; i < LOOKUPS; ++i) {
+      const wlc_handle h = handles[bench_random(&seed) % live];
+      assert(((struct container*)convert_from_wlc_handle(h, "bench"))->self == h);
+   }
+   bench_stop(&bench, LOOKUPS);
+
+   // release + create pairs at random positions
+   bench_start(&bench, "wlc_handle_churn", live);
+   for (size_t i = 0; i < CHURN; ++i) {
+      const size_t index = bench_random(&seed) % live;
+      wlc_handle_release(handles[index]);
+
+      struct container *c;
+      assert((c = wlc_handle_create(&source)));
+      handles[index] = c->self = convert_to_wlc_handle(c);
+   }
+   bench_stop(&bench, CHURN);
+
+   bench_start(&bench, "wlc_source_release", live);
+   wlc_source_release(&source);
+   bench_stop(&bench, live);
+
+   assert(!convert_from_wlc_handle(handles[0], "bench"));
+   free(handles);
+   wlc_resources_terminate();
+}
+
+static void
+bench_resources(size_t live)
+{
+   struct wl_display *display;
+   assert((display = wl_display_create()));
+
+   int fds[2];
+   assert(!socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+
+   struct wl_client *client;
+   assert((client = wl_client_create(display, fds[0])));
+
+   assert(wlc_resources_init());
+
+   struct wlc_source source;
+   assert(wlc_source(&source, "bench-resource", NULL, NULL, 32, sizeof(struct wlc_resource)));
+
+   struct wl_resource **wl_resources;
+   wlc_resource *resources;
+   assert((wl_resources = calloc(live, sizeof(struct wl_resource*))));
+   assert((resources = calloc(live, sizeof(wlc_resource))));
+
+   // wayland resources are created up front, only the wlc side is measured
+   for (size_t i = 0; i < live; ++i)
+      assert((wl_resources[i] = wl_resource_create(client, &wl_callback_interface, 1, 0)));
+
+   struct bench bench;
+   bench_start(&bench, "wlc_resource_create_from", live);
+   for (size_t i = 0; i < live; ++i)
+      assert((resources[i] = wlc_resource_create_from(&source, wl_resources[i])));
+   bench_stop(&bench, live);
+
+   uint32_t seed = 0x9e3779b9;
+   bench_start(&bench, "convert_from_wlc_resource", live);
+   for (size_t i = 0; i < LOOKUPS; ++i)
+      assert(convert_from_wlc_resource(resources[bench_random(&seed) % live], "bench-resource"));
+   bench_stop(&bench, LOOKUPS);
+
+   bench_start(&bench, "wl_resource_for_client", live);
+   for (size_t i = 0; i < LOOKUPS; ++i)
+      assert(wl_resource_for_client(&source, client));
+   bench_stop(&bench, LOOKUPS);
+
+   // release + create pairs, includes destroying and creating the wayland resource
+   bench_start(&bench, "wlc_resource_churn", live);
+   for (size_t i = 0; i < CHURN; ++i) {
+      const size_t index = bench_random(&seed) % live;
+      wlc_resource_release(resources[index]);
+
+      struct wl_resource *r;
+      assert((r = wl_resource_create(client, &wl_callback_interface, 1, 0)));
+      assert((resources[index] = wlc_resource_create_from(&source, r)));
+   }
+   bench_stop(&bench, CHURN);
+
+   // releases the wayland resources as well, so client has nothing left pointing to us
+   bench_start(&bench, "wlc_source_release_resources", live);
+   wlc_source_release(&source);
+   bench_stop(&bench, live);
+
+   free(resources);
+   free(wl_resources);
+   wlc_resources_terminate();
+
+   wl_client_destroy(client);
+   close(fds[1]);
+   wl_display_destroy(display);
+}
+
+int
+main(int argc, char *argv[])
+{
+   const size_t max_live = bench_max_live(argc, argv, 1000000);
+
+   bench_begin_suite("resources");
+
+   for (size_t live = 100; live <= max_live; live *= 10)
+      bench_handles(live);
+
+   for (size_t live = 100; live <= max_live; live *= 10)
+      bench_resources(live);
+
+   bench_end_suite();
+   return EXIT_SUCCESS;
+}
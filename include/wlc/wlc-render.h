@@ -18,9 +18,11 @@ extern "C" {
  * This is not documented as it's currently relying on the implementation details of wlc.
  */
 
-/** Allowed pixel formats. */
+/** Allowed pixel formats, named by byte order in memory. */
 enum wlc_pixel_format {
    WLC_RGBA8888,
+   WLC_BGRA8888, // WL_SHM_FORMAT_ARGB8888 on little endian
+   WLC_XRGB8888, // same byte order as WLC_BGRA8888, alpha is undefined when reading and ignored when writing
 };
 
 /**
@@ -36,12 +38,28 @@ WLC_NONULL void wlc_pixels_write(enum wlc_pixel_format format, const struct wlc_
  */
 WLC_NONULL void wlc_pixels_read(enum wlc_pixel_format format, const struct wlc_geometry *geometry, struct wlc_geometry *out_geometry, void *out_data);
 
+/**
+ * Queue an asynchronous read of pixel data from output's framebuffer, taken at the end of a frame.
+ * Unlike wlc_pixels_read() this may be called at any time and does not stall rendering,
+ * the data is passed to done from the event loop usually one or two frames later.
+ * Geometry is in framebuffer pixels and gets clamped like in wlc_pixels_read(), rows are stored the same way.
+ *
+ * If damage_only is set, the read waits for a frame that repaints part of the geometry,
+ * and damage is the extents of the repainted part. Otherwise a frame is forced, and damage is the whole geometry.
+ * Time is the CLOCK_MONOTONIC presentation time of the frame in nanoseconds.
+ * Data is NULL if the read was cancelled, for example when the output was destroyed.
+ * Returns false if the read could not be queued.
+ */
+WLC_NONULLV(3,5) bool wlc_output_read_pixels_async(wlc_handle output, enum wlc_pixel_format format, const struct wlc_geometry *geometry, bool damage_only,
+      void (*done)(wlc_handle output, const struct wlc_geometry *geometry, const struct wlc_geometry *damage, uint64_t time, const void *data, void *arg), void *arg);
+
 /** Renders surface. */
 WLC_NONULL void wlc_surface_render(wlc_resource surface, const struct wlc_geometry *geometry);
 
 /**
  * Schedules output for rendering next frame. If output was already scheduled this is no-op,
  * if output is currently rendering, it will render immediately after.
+ * The whole output is damaged, so anything drawn from render hooks gets repainted.
  */
 void wlc_output_schedule_render(wlc_handle output);
 
@@ -56,12 +74,20 @@ void wlc_surface_flush_frame_callbacks(wlc_resource surface);
 /** Enabled renderers */
 enum wlc_renderer {
     WLC_RENDERER_GLES2,
+    WLC_RENDERER_PIXMAN,
     WLC_NO_RENDERER
 };
 
 /** Returns currently active renderer on the given output */
 enum wlc_renderer wlc_output_get_renderer(wlc_handle output);
 
+/**
+ * Sets the renderer to try first on outputs created after this call, can be set before wlc_init.
+ * WLC_NO_RENDERER picks automatically. Pixman only works on backends with offscreen outputs (headless).
+ * Overrides WLC_RENDERER env variable.
+ */
+void wlc_set_renderer(enum wlc_renderer renderer);
+
 enum wlc_surface_format {
     SURFACE_RGB,
     SURFACE_RGBA,
@@ -75,6 +101,7 @@ enum wlc_surface_format {
  * Fills out_textures[] with the textures of a surface. Returns false if surface is invalid.
  * Array must have at least 3 elements and should be refreshed at each frame.
  * Note that these are not only OpenGL textures but rather render-specific.
+ * Small shm surfaces may share an atlas texture in the GLES2 renderer, those have no textures of their own.
  * For more info what they are check the renderer's source code */
 bool wlc_surface_get_textures(wlc_resource surface, uint32_t out_textures[3], enum wlc_surface_format *out_format);
 
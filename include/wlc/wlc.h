@@ -29,6 +29,7 @@ enum wlc_backend_type {
    WLC_BACKEND_NONE,
    WLC_BACKEND_DRM,
    WLC_BACKEND_X11,
+   WLC_BACKEND_HEADLESS,
 };
 
 /** mask in wlc_event_loop_add_fd(); */
@@ -129,6 +130,40 @@ struct wlc_modifiers {
    uint32_t leds, mods;
 };
 
+/** Phases of output repaint in struct wlc_frame_stats. */
+enum wlc_frame_phase {
+   WLC_FRAME_PHASE_COMMIT, // view state commit
+   WLC_FRAME_PHASE_VISIBILITY, // visibility and damage
+   WLC_FRAME_PHASE_PAINT, // painting of all views
+   WLC_FRAME_PHASE_HOOKS, // output and view render hooks
+   WLC_FRAME_PHASE_FLUSH, // flushing what the hooks drew
+   WLC_FRAME_PHASE_SWAP,
+   WLC_FRAME_PHASE_CALLBACKS, // frame callbacks and presentation feedback
+   WLC_FRAME_PHASE_LAST,
+};
+
+#define WLC_HISTOGRAM_BUCKETS 24
+
+/**
+ * Histogram of durations in microseconds.
+ * Bucket 0 counts durations under 1 us, bucket n durations from 2^(n-1) up to 2^n us, last bucket everything longer.
+ */
+struct wlc_histogram {
+   uint64_t buckets[WLC_HISTOGRAM_BUCKETS];
+   uint64_t count, sum, max;
+};
+
+/** wlc_output_get_frame_stats(); Phases are only recorded for frames that were presented. */
+struct wlc_frame_stats {
+   struct wlc_histogram phase[WLC_FRAME_PHASE_LAST];
+   struct wlc_histogram view; // paint of a single view, not recorded when painting on render threads
+   struct wlc_histogram repaint; // start of repaint to swap
+   struct wlc_histogram interval; // flip to flip
+   uint64_t frames; // presented frames
+   uint64_t skipped; // repaints that presented nothing, no damage or output not ready
+   uint64_t missed; // flips that landed after the vblank they were scheduled for
+};
+
 /** -- Callbacks API */
 
 /** Output was created. Return false if you want to destroy the output. (e.g. failed to allocate data related to view) */
@@ -306,6 +341,22 @@ uint32_t wlc_output_get_mask(wlc_handle output);
 /** Set visibility bitmask. */
 void wlc_output_set_mask(wlc_handle output, uint32_t mask);
 
+/** Get render deadline margin in microseconds. */
+uint32_t wlc_output_get_render_margin(wlc_handle output);
+
+/**
+ * Set render deadline margin in microseconds. (2000 default)
+ * Composition starts this long plus the measured render time before the predicted vblank.
+ * Increase if the output misses flips, decrease for lower latency.
+ */
+void wlc_output_set_render_margin(wlc_handle output, uint32_t margin);
+
+/** Get frame statistics since output creation or last reset. */
+const struct wlc_frame_stats* wlc_output_get_frame_stats(wlc_handle output);
+
+/** Reset frame statistics. */
+void wlc_output_reset_frame_stats(wlc_handle output);
+
 /** Get views in stack order. Returned array is a direct reference, careful when moving and destroying handles. */
 const wlc_handle* wlc_output_get_views(wlc_handle output, size_t *out_memb);
 
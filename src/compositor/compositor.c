@@ -50,6 +50,11 @@ restack_subsurface_relative_to(wlc_resource surface, wlc_resource sibling, int32
 
    chck_iter_pool_remove(&parent->subsurface_list, surface_idx);
    chck_iter_pool_insert(&parent->subsurface_list, target_idx + offset, &surface);
+
+   // Restacking may uncover the subsurface of a hidden view as well, so always repaint
+   struct wlc_output *output = convert_from_wlc_handle(parent->output, "output");
+   wlc_output_invalidate_scene(output);
+   wlc_output_schedule_repaint(output);
 }
 
 static void
@@ -184,7 +189,7 @@ wl_cb_surface_create(struct wl_client *client, struct wl_resource *resource, uin
       return;
 
    wlc_resource r;
-   if (!(r = wlc_resource_create(&compositor->surfaces, client, &wl_surface_interface, wl_resource_get_version(resource), 3, id)))
+   if (!(r = wlc_resource_create(&compositor->surfaces, client, &wl_surface_interface, wl_resource_get_version(resource), 4, id)))
       return;
 
    wlc_resource_implement(r, wlc_surface_implementation(), compositor);
@@ -216,7 +221,7 @@ static void
 wl_compositor_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id)
 {
    struct wl_resource *r;
-   if (!(r = wl_resource_create_checked(client, &wl_compositor_interface, version, 3, id)))
+   if (!(r = wl_resource_create_checked(client, &wl_compositor_interface, version, 4, id)))
       return;
 
    wl_resource_set_implementation(r, &wl_compositor_implementation, data, NULL);
@@ -250,7 +255,7 @@ deactivate_tty(struct wlc_compositor *compositor)
 
    // check that all outputs are surfaceless
    struct wlc_output *o;
-   chck_pool_for_each(&compositor->outputs.pool, o) {
+   wlc_slab_for_each(&compositor->outputs.pool, o) {
       if (o->bsurface.display)
          return;
    }
@@ -284,14 +289,14 @@ activate_event(struct wl_listener *listener, void *data)
    if (!ev->active) {
       compositor->state.tty = DEACTIVATING;
       compositor->state.vt = ev->vt;
-      chck_pool_for_each_call(&compositor->outputs.pool, wlc_output_set_backend_surface, NULL);
+      wlc_slab_for_each_call(&compositor->outputs.pool, wlc_output_set_backend_surface, NULL);
       deactivate_tty(compositor);
    } else {
       compositor->state.tty = ACTIVATING;
       compositor->state.vt = 0;
       activate_tty(compositor);
       wlc_backend_update_outputs(&compositor->backend, &compositor->outputs.pool);
-      chck_pool_for_each_call(&compositor->outputs.pool, wlc_output_set_sleep_ptr, false);
+      wlc_slab_for_each_call(&compositor->outputs.pool, wlc_output_set_sleep_ptr, false);
    }
 }
 
@@ -391,13 +396,13 @@ surface_event(struct wl_listener *listener, void *data)
       case WLC_SURFACE_EVENT_DESTROYED:
       {
          struct wlc_view *v;
-         chck_pool_for_each(&compositor->views.pool, v) {
+         wlc_slab_for_each(&compositor->views.pool, v) {
             if (v->parent == ev->surface->view)
                wlc_view_set_parent_ptr(v, NULL);
          }
 
          struct wlc_surface *s;
-         chck_pool_for_each(&compositor->surfaces.pool, s) {
+         wlc_slab_for_each(&compositor->surfaces.pool, s) {
             if (s->parent == convert_to_wlc_resource(ev->surface))
                wlc_surface_set_parent(s, NULL);
          }
@@ -412,7 +417,7 @@ static struct wlc_output*
 get_surfaceless_output(struct wlc_compositor *compositor)
 {
    struct wlc_output *o;
-   chck_pool_for_each(&compositor->outputs.pool, o) {
+   wlc_slab_for_each(&compositor->outputs.pool, o) {
       if (!o->bsurface.display)
          return o;
    }
@@ -479,7 +484,7 @@ remove_output(struct wlc_compositor *compositor, struct wlc_output *output)
    assert(compositor && output);
 
    struct wlc_output *o, *alive = NULL;
-   chck_pool_for_each(&compositor->outputs.pool, o) {
+   wlc_slab_for_each(&compositor->outputs.pool, o) {
       if (!o->bsurface.display || o == output)
          continue;
 
@@ -582,7 +587,7 @@ wlc_get_outputs(size_t *out_memb)
    {
       size_t i = 0;
       struct wlc_output *o;
-      chck_pool_for_each(&_g_compositor->outputs.pool, o)
+      wlc_slab_for_each(&_g_compositor->outputs.pool, o)
          _g_compositor->tmp.outputs[i++] = convert_to_wlc_handle(o);
    }
 
@@ -663,7 +668,7 @@ wlc_compositor_terminate(struct wlc_compositor *compositor)
       WLC_INTERFACE_EMIT(compositor.terminate);
 
       if (compositor->outputs.pool.items.count > 0) {
-         chck_pool_for_each_call(&compositor->outputs.pool, wlc_output_terminate);
+         wlc_slab_for_each_call(&compositor->outputs.pool, wlc_output_terminate);
          return;
       }
    }
@@ -678,7 +683,7 @@ wlc_compositor_is_good(struct wlc_compositor *compositor)
    assert(compositor);
 
    struct wlc_output *o;
-   chck_pool_for_each(&compositor->outputs.pool, o) {
+   wlc_slab_for_each(&compositor->outputs.pool, o) {
       if (o->context.context)
          return true;
    }
@@ -721,6 +726,8 @@ wlc_compositor_release(struct wlc_compositor *compositor)
    wlc_source_release(&compositor->surfaces);
    wlc_source_release(&compositor->subsurfaces);
    wlc_source_release(&compositor->regions);
+   wlc_presentation_release(&compositor->presentation);
+   wlc_screencopy_release(&compositor->screencopy);
 
    memset(compositor, 0, sizeof(struct wlc_compositor));
    _g_compositor = NULL;
@@ -759,7 +766,7 @@ wlc_compositor(struct wlc_compositor *compositor)
        !wlc_source(&compositor->regions, "region", NULL, wlc_region_release, 32, sizeof(struct wlc_region)))
       goto fail;
 
-   if (!(compositor->wl.compositor = wl_global_create(wlc_display(), &wl_compositor_interface, 3, compositor, wl_compositor_bind)))
+   if (!(compositor->wl.compositor = wl_global_create(wlc_display(), &wl_compositor_interface, 4, compositor, wl_compositor_bind)))
       goto compositor_interface_fail;
 
    if (!(compositor->wl.subcompositor = wl_global_create(wlc_display(), &wl_subcompositor_interface, 1, compositor, wl_subcompositor_bind)))
@@ -769,6 +776,8 @@ wlc_compositor(struct wlc_compositor *compositor)
        !wlc_shell(&compositor->shell) ||
        !wlc_xdg_shell(&compositor->xdg_shell) ||
        !wlc_custom_shell(&compositor->custom_shell) ||
+       !wlc_presentation(&compositor->presentation) ||
+       !wlc_screencopy(&compositor->screencopy) ||
        !wlc_backend(&compositor->backend))
       goto fail;
 
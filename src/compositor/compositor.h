@@ -9,6 +9,8 @@
 #include "shell/shell.h"
 #include "shell/xdg-shell.h"
 #include "shell/custom-shell.h"
+#include "presentation.h"
+#include "screencopy.h"
 #include "xwayland/xwm.h"
 #include "resources/resources.h"
 #include "platform/backend/backend.h"
@@ -22,6 +24,8 @@ struct wlc_compositor {
    struct wlc_shell shell;
    struct wlc_xdg_shell xdg_shell;
    struct wlc_custom_shell custom_shell;
+   struct wlc_presentation presentation;
+   struct wlc_screencopy screencopy;
    struct wlc_xwm xwm;
    struct wlc_source outputs, views, surfaces, subsurfaces, regions;
 
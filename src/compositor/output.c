@@ -1,6 +1,7 @@
 #include "output.h"
 #include <stdlib.h>
 #include <limits.h>
+#include <math.h>
 #include <wayland-server.h>
 #include <chck/string/string.h>
 #include <chck/math/math.h>
@@ -10,10 +11,56 @@
 #include "macros.h"
 #include "output.h"
 #include "view.h"
+#include "presentation.h"
+#include "platform/render/thread.h"
 #include "resources/types/surface.h"
 
 static struct wlc_output *rendering_output;
 
+// Size of the hit-test grid cells in virtual resolution
+#define HIT_GRID_CELL 128
+
+// Repaint regions and views with more rectangles than this are painted by their bounding boxes instead
+#define VIEW_SCISSOR_RECTS 8
+
+// Every hit-test grid build gets a serial of its own, so cached hit-tests can tell them apart
+static uint32_t hit_serial;
+
+// Same for retained scene builds and committed queues, so surfaces can tell which their scene index and queued mark belong to
+static uint32_t scene_serial;
+
+// View painted to the output last frame
+struct scene_view {
+   wlc_handle view;
+   struct wlc_geometry extents;
+};
+
+// View visible on the output
+struct visible_view {
+   wlc_handle view;
+   pixman_region32_t region; // part of the view not occluded by opaque views above it
+   struct wlc_geometry bounds, visible, extents; // extents include the subsurfaces
+   size_t first, count; // surfaces of the view in the retained scene, the view's own surface first
+};
+
+// Surface of a visible view, in the retained scene
+struct scene_surface {
+   wlc_resource surface;
+   struct wlc_geometry geometry;
+};
+
+// Pixel read requested through wlc_output_read_pixels_async
+struct pixels_read {
+   struct wlc_readback readback;
+   struct wlc_geometry geometry, damage; // framebuffer pixels
+   void (*done)(wlc_handle output, const struct wlc_geometry *geometry, const struct wlc_geometry *damage, uint64_t time, const void *data, void *arg);
+   void *arg;
+   uint64_t time; // presentation time of the frame read
+   enum wlc_pixel_format format;
+   uint32_t age; // frames since the read was issued
+   bool issued, damage_only;
+};
+
 // FIXME: this is a hack
 static EGLNativeDisplayType INVALID_DISPLAY = (EGLNativeDisplayType)~0;
 
@@ -106,7 +153,7 @@ static void
 output_push_to_resources(struct wlc_output *output)
 {
    wlc_resource *r;
-   chck_pool_for_each(&output->resources.pool, r)
+   wlc_slab_for_each(&output->resources.pool, r)
       output_push_to_resource(output, *r);
 }
 
@@ -133,51 +180,713 @@ view_visible(struct wlc_view *view, struct wlc_surface *surface, uint32_t mask)
    return (surface->commit.attached && (view->mask & mask));
 }
 
+static void
+stack_remove(struct wlc_output *output, struct wlc_view *view)
+{
+   assert(output && view && view->stack.output == convert_to_wlc_handle(output));
+
+   struct wlc_view *v;
+   if ((v = convert_from_wlc_handle(view->stack.below, "view"))) {
+      v->stack.above = view->stack.above;
+   } else {
+      output->stack.bottom = view->stack.above;
+   }
+
+   if ((v = convert_from_wlc_handle(view->stack.above, "view"))) {
+      v->stack.below = view->stack.below;
+   } else {
+      output->stack.top = view->stack.below;
+   }
+
+   memset(&view->stack, 0, sizeof(view->stack));
+   output->stack.views_dirty = true;
+}
+
+static void
+stack_insert(struct wlc_output *output, struct wlc_view *view, struct wlc_view *below, struct wlc_view *above)
+{
+   assert(output && view && !view->stack.output);
+
+   const wlc_handle handle = convert_to_wlc_handle(view);
+   view->stack.output = convert_to_wlc_handle(output);
+   view->stack.below = convert_to_wlc_handle(below);
+   view->stack.above = convert_to_wlc_handle(above);
+
+   if (below) {
+      below->stack.above = handle;
+   } else {
+      output->stack.bottom = handle;
+   }
+
+   if (above) {
+      above->stack.below = handle;
+   } else {
+      output->stack.top = handle;
+   }
+
+   output->stack.views_dirty = true;
+}
+
+static struct chck_iter_pool*
+stacked_views(struct wlc_output *output)
+{
+   assert(output);
+
+   if (!output->stack.views_dirty)
+      return &output->views;
+
+   chck_iter_pool_flush(&output->views);
+
+   struct wlc_view *v;
+   for (wlc_handle h = output->stack.bottom; (v = convert_from_wlc_handle(h, "view")); h = v->stack.above) {
+      if (!chck_iter_pool_push_back(&output->views, &h))
+         return &output->views;
+   }
+
+   output->stack.views_dirty = false;
+   return &output->views;
+}
+
+static struct chck_iter_pool*
+mutable_views(struct wlc_output *output)
+{
+   assert(output);
+
+   if (!output->stack.mutable_dirty)
+      return &output->mutable;
+
+   // Drop views unlinked since, keeping the order of the rest
+   size_t count = 0;
+   const wlc_handle self = convert_to_wlc_handle(output);
+
+   wlc_handle *h;
+   chck_iter_pool_for_each(&output->mutable, h) {
+      struct wlc_view *v;
+      if ((v = convert_from_wlc_handle(*h, "view")) && v->stack.output == self)
+         *(wlc_handle*)chck_iter_pool_get(&output->mutable, count++) = *h;
+   }
+
+   while (output->mutable.items.count > count)
+      chck_iter_pool_remove(&output->mutable, output->mutable.items.count - 1);
+
+   output->stack.mutable_dirty = false;
+   return &output->mutable;
+}
+
+static void
+finish_frame_tasks(struct wlc_output *output)
+{
+   assert(output);
+
+   if (output->task.bsurface.display) {
+      wlc_output_set_backend_surface(output, (output->task.bsurface.display == INVALID_DISPLAY ? NULL : &output->task.bsurface));
+      memset(&output->task.bsurface, 0, sizeof(output->task.bsurface));
+   }
+
+   if (output->task.sleep) {
+      wlc_output_set_sleep_ptr(output, true);
+      output->task.sleep = false;
+   }
+
+   if (output->task.terminate) {
+      wlc_output_terminate(output);
+      output->task.terminate = false;
+   }
+}
+
+static uint64_t
+timespec_to_ns(const struct timespec *ts)
+{
+   assert(ts);
+   return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static uint64_t
+get_time_ns(void)
+{
+   struct timespec ts;
+   wlc_get_time(&ts);
+   return timespec_to_ns(&ts);
+}
+
+static void
+histogram_add(struct wlc_histogram *histogram, uint64_t ns)
+{
+   assert(histogram);
+
+   const uint64_t us = ns / 1000;
+   uint32_t bucket = 0;
+   for (uint64_t v = us; v && bucket + 1 < WLC_HISTOGRAM_BUCKETS; v >>= 1)
+      ++bucket;
+
+   histogram->buckets[bucket]++;
+   histogram->count++;
+   histogram->sum += us;
+   histogram->max = (us > histogram->max ? us : histogram->max);
+}
+
+static uint64_t
+phase_mark(struct wlc_output *output, enum wlc_frame_phase phase, uint64_t since)
+{
+   assert(output && phase < WLC_FRAME_PHASE_LAST);
+   const uint64_t now = get_time_ns();
+   output->stats.phase[phase] += now - since;
+   return now;
+}
+
+static void
+record_frame(struct wlc_output *output)
+{
+   assert(output);
+
+   output->stats.frame.frames++;
+   histogram_add(&output->stats.frame.repaint, output->stats.repaint);
+
+   for (uint32_t i = 0; i < WLC_FRAME_PHASE_LAST; ++i)
+      histogram_add(&output->stats.frame.phase[i], output->stats.phase[i]);
+
+   memset(output->stats.phase, 0, sizeof(output->stats.phase));
+   output->stats.repaint = 0;
+}
+
+static uint64_t
+refresh_period(struct wlc_output *output)
+{
+   assert(output);
+
+   struct wlc_output_mode *mode;
+   if (output->active.mode == UINT_MAX || !(mode = chck_iter_pool_get(&output->information.modes, output->active.mode)) || mode->refresh <= 0)
+      return 1000000000000 / 60000; // assume 60 Hz
+
+   return 1000000000000 / mode->refresh;
+}
+
+static uint32_t
+frame_delay(struct wlc_output *output)
+{
+   assert(output);
+
+   const uint64_t now = get_time_ns();
+
+   if (!output->state.frame_time || output->state.frame_time > now) {
+      output->schedule.target = 0;
+      return 1;
+   }
+
+   // Predict the first vblank after both now and the vblank previous frame was aimed at,
+   // so frames that were skipped due to no damage are paced as well.
+   const uint64_t refresh = refresh_period(output);
+   const uint64_t base = (output->schedule.target > now ? output->schedule.target : now);
+   const uint64_t vblank = output->state.frame_time + ((base - output->state.frame_time) / refresh + 1) * refresh;
+   output->schedule.target = vblank;
+
+   // Start as late as we can while still making the deadline
+   const uint64_t budget = output->schedule.cost + (uint64_t)output->schedule.margin * 1000;
+   if (vblank <= now + budget)
+      return 1;
+
+   // Event loop timers have millisecond precision, rounding down errs on the early side
+   return chck_maxu32((vblank - now - budget) / 1000000, 1);
+}
+
+static void
+schedule_next_frame(struct wlc_output *output)
+{
+   assert(output);
+
+   if (output->state.activity && !output->task.terminate) {
+      const uint32_t delay = frame_delay(output);
+      wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Next frame in %u ms (cost %" PRIu64 " us, margin %u us)", delay, output->schedule.cost / 1000, output->schedule.margin);
+      wl_event_source_timer_update(output->timer.idle, delay);
+      output->state.scheduled = true;
+      output->state.activity = false;
+   } else {
+      output->state.scheduled = false;
+   }
+
+   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Finished frame");
+   finish_frame_tasks(output);
+}
+
+static void
+geometry_union(struct wlc_geometry *a, const struct wlc_geometry *b)
+{
+   assert(a && b);
+
+   if (wlc_size_equals(&b->size, &wlc_size_zero))
+      return;
+
+   if (wlc_size_equals(&a->size, &wlc_size_zero)) {
+      *a = *b;
+      return;
+   }
+
+   const int32_t x1 = chck_min32(a->origin.x, b->origin.x), y1 = chck_min32(a->origin.y, b->origin.y);
+   const int32_t x2 = chck_max32(a->origin.x + a->size.w, b->origin.x + b->size.w);
+   const int32_t y2 = chck_max32(a->origin.y + a->size.h, b->origin.y + b->size.h);
+   *a = (struct wlc_geometry){ .origin = { x1, y1 }, .size = { x2 - x1, y2 - y1 } };
+}
+
+static void
+subsurfaces_for_each(struct wlc_output *output, struct wlc_surface *surface, struct wlc_coordinate_scale parent_scale, struct wlc_point offset, void (*fn)(struct wlc_output*, struct wlc_surface*, const struct wlc_geometry*, void*), void *data)
+{
+   if (!surface)
+       return;
+
+   /* do not visit view's main surface, it's handled by the view */
+   if (surface->parent) {
+      const struct wlc_geometry g = {
+         .origin = {
+            .x = offset.x + parent_scale.w * (surface->commit.subsurface_position.x + surface->commit.offset.x),
+            .y = offset.y + parent_scale.h * (surface->commit.subsurface_position.y + surface->commit.offset.y)
+         },
+         .size = {
+            .w = surface->size.w * parent_scale.w,
+            .h = surface->size.h * parent_scale.h
+         },
+      };
+      fn(output, surface, &g, data);
+   }
+
+   wlc_resource *sub;
+   chck_iter_pool_for_each(&surface->subsurface_list, sub) {
+       subsurfaces_for_each(output, convert_from_wlc_resource(*sub, "surface"), surface->coordinate_transform,
+             (struct wlc_point) {
+             offset.x + (surface->parent ? 0 : surface->commit.subsurface_position.x / parent_scale.w),
+             offset.y + (surface->parent ? 0 : surface->commit.subsurface_position.y / parent_scale.h)
+             }, fn, data);
+   }
+}
+
+static struct wlc_geometry
+box_geometry(const pixman_box32_t *b)
+{
+   assert(b);
+   return (struct wlc_geometry){ .origin = { b->x1, b->y1 }, .size = { b->x2 - b->x1, b->y2 - b->y1 } };
+}
+
+static struct wlc_geometry
+region_extents(pixman_region32_t *region)
+{
+   assert(region);
+   return box_geometry(pixman_region32_extents(region));
+}
+
+static bool
+geometry_overlaps_box(const struct wlc_geometry *g, const pixman_box32_t *b)
+{
+   assert(g && b);
+   return (g->origin.x < b->x2 && b->x1 < g->origin.x + (int32_t)g->size.w &&
+           g->origin.y < b->y2 && b->y1 < g->origin.y + (int32_t)g->size.h);
+}
+
 static bool
-blit(bool *g, const struct wlc_size *r, const struct wlc_point *a, const struct wlc_point *b, bool should_blit)
+has_render_hooks(void)
 {
-   assert(g && r && a && b);
+   const struct wlc_interface *i = wlc_interface();
+   return (i->output.render.pre || i->output.render.post || i->view.render.pre || i->view.render.post);
+}
 
-   bool visible = false;
-   const size_t gsz = r->w * r->h;
-   assert(b->x - a->x >= 0);
-   assert(a->x >= 0 && b->x <= (int32_t)r->w && a->y >= 0 && b->y <= (int32_t)r->h);
-   for (int32_t y = a->y; y < b->y; ++y) {
-      const size_t off = a->x + y * r->w, memb = (b->x - a->x);
-      assert(off + memb <= gsz);
+static void
+limit_repaint_region(pixman_region32_t *region)
+{
+   assert(region);
 
-      if (!visible && memchr(g + off, false, memb)) {
-         visible = true;
+   // Every rectangle is another pass over the views, and hooks draw under a single scissor.
+   // Repaint the extents then, so nothing outside the cleared area gets drawn over.
+   if (pixman_region32_n_rects(region) <= (has_render_hooks() ? 1 : VIEW_SCISSOR_RECTS))
+      return;
 
-         if (!should_blit)
-            break;
+   pixman_box32_t e = *pixman_region32_extents(region);
+   pixman_region32_reset(region, &e);
+}
+
+static void
+view_paint_region(pixman_region32_t *out, pixman_region32_t *visible, pixman_region32_t *repaint)
+{
+   assert(out && visible && repaint);
+
+   pixman_region32_intersect(out, visible, repaint);
+
+   if (pixman_region32_n_rects(out) <= VIEW_SCISSOR_RECTS)
+      return;
+
+   // Past a few rectangles the occluded pixels are cheaper to draw,
+   // but only within the repaint rectangles, the rest of the output is not cleared
+   pixman_region32_t part;
+   pixman_region32_init(&part);
+   pixman_region32_clear(out);
+
+   int nrects;
+   const pixman_box32_t *r = pixman_region32_rectangles(repaint, &nrects);
+   for (int i = 0; i < nrects; ++i) {
+      pixman_region32_intersect_rect(&part, visible, r[i].x1, r[i].y1, r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
+
+      if (!pixman_region32_not_empty(&part))
+         continue;
+
+      const pixman_box32_t *e = pixman_region32_extents(&part);
+      pixman_region32_union_rect(out, out, e->x1, e->y1, e->x2 - e->x1, e->y2 - e->y1);
+   }
+
+   pixman_region32_fini(&part);
+}
+
+static void
+scissor_box(struct wlc_output *output, const pixman_box32_t *box)
+{
+   assert(output && box);
+   const struct wlc_geometry scissor = box_geometry(box);
+   wlc_render_scissor(&output->render, &output->context, &scissor);
+}
+
+static void
+scissor_region(struct wlc_output *output, pixman_region32_t *region)
+{
+   assert(output && region);
+   const struct wlc_geometry scissor = region_extents(region);
+   wlc_render_scissor(&output->render, &output->context, &scissor);
+}
+
+static void
+clear_region(struct wlc_output *output, pixman_region32_t *region)
+{
+   assert(output && region);
+
+   // Clear exactly what gets repainted, pixels between disjoint damage are still valid
+   int nrects;
+   const pixman_box32_t *r = pixman_region32_rectangles(region, &nrects);
+   for (int i = 0; i < nrects; ++i) {
+      scissor_box(output, &r[i]);
+      wlc_render_clear(&output->render, &output->context);
+   }
+
+   scissor_region(output, region);
+}
+
+static void
+emit_render_hook(struct wlc_output *output, void (*hook)(wlc_handle), wlc_handle handle)
+{
+   assert(output);
+
+   if (!hook)
+      return;
+
+   // Hooks may draw with GL directly, they draw on top of what is queued so far,
+   // and the renderer can't trust its cached state afterwards
+   wlc_render_submit(&output->render, &output->context);
+   hook(handle);
+   wlc_render_invalidate(&output->render, &output->context);
+}
+
+static void
+render_view(struct wlc_output *output, struct visible_view *v, pixman_region32_t *repaint)
+{
+   assert(output && v && repaint);
+
+   struct wlc_view *view;
+   if (!(view = convert_from_wlc_handle(v->view, "view")))
+      return;
+
+   uint64_t t = get_time_ns();
+   emit_render_hook(output, wlc_interface()->view.render.pre, convert_to_wlc_handle(view));
+   t = phase_mark(output, WLC_FRAME_PHASE_HOOKS, t);
+   wlc_render_flush_fakefb(&output->render, &output->context);
+   t = phase_mark(output, WLC_FRAME_PHASE_FLUSH, t);
+
+   // Only the surfaces are clipped to the visible region, hooks may draw outside the view
+   pixman_region32_t clip;
+   pixman_region32_init(&clip);
+   view_paint_region(&clip, &v->region, repaint);
+
+   if (pixman_region32_not_empty(&clip)) {
+      // Paint each visible rectangle on its own, so partly covered views don't repaint the covered corners
+      int nrects;
+      const pixman_box32_t *r = pixman_region32_rectangles(&clip, &nrects);
+      const struct scene_surface *s = chck_iter_pool_get(&output->scene.surfaces, v->first);
+      for (int i = 0; i < nrects; ++i) {
+         scissor_box(output, &r[i]);
+         wlc_render_view_paint(&output->render, &output->context, view);
+
+         // First surface is the view's own, painted above
+         for (size_t j = 1; j < v->count; ++j) {
+            struct wlc_surface *surface;
+            if (geometry_overlaps_box(&s[j].geometry, &r[i]) && (surface = convert_from_wlc_resource(s[j].surface, "surface")))
+               wlc_render_surface_paint(&output->render, &output->context, surface, &s[j].geometry);
+         }
+      }
+
+      scissor_region(output, repaint);
+   }
+
+   pixman_region32_fini(&clip);
+
+   const uint64_t start = t;
+   t = phase_mark(output, WLC_FRAME_PHASE_PAINT, t);
+   histogram_add(&output->stats.frame.view, t - start);
+
+   emit_render_hook(output, wlc_interface()->view.render.post, convert_to_wlc_handle(view));
+   t = phase_mark(output, WLC_FRAME_PHASE_HOOKS, t);
+   wlc_render_flush_fakefb(&output->render, &output->context);
+   phase_mark(output, WLC_FRAME_PHASE_FLUSH, t);
+}
+
+static void
+snapshot_surface(struct wlc_output *output, struct wlc_surface *surface, const struct wlc_geometry *geometry, const struct wlc_geometry *visible, const pixman_box32_t *rects, int nrects)
+{
+   assert(output && surface && geometry && visible && rects);
+
+   // Surface is copied once, items for the other rectangles share the owner's data
+   struct wlc_render_item item;
+   bool snapshotted = false;
+   for (int i = 0; i < nrects; ++i) {
+      if (!geometry_overlaps_box(visible, &rects[i]))
+         continue;
+
+      if (!snapshotted && !(snapshotted = wlc_render_item_snapshot(&output->render, surface, geometry, visible, &item)))
+         return;
+
+      item.scissor = box_geometry(&rects[i]);
+
+      if (!chck_iter_pool_push_back(&output->paint.items, &item)) {
+         wlc_render_item_release(&item);
+         return;
+      }
+
+      item.owned = false;
+   }
+}
+
+static void
+snapshot_view(struct wlc_output *output, struct visible_view *v, pixman_region32_t *repaint)
+{
+   assert(output && v && repaint);
+
+   // Same as render_view, without the view render hooks.
+   // Rectangles don't overlap, so surfaces keep their stacking order within each of them.
+   pixman_region32_t clip;
+   pixman_region32_init(&clip);
+   view_paint_region(&clip, &v->region, repaint);
+
+   if (pixman_region32_not_empty(&clip)) {
+      int nrects;
+      const pixman_box32_t *r = pixman_region32_rectangles(&clip, &nrects);
+      const struct scene_surface *s = chck_iter_pool_get(&output->scene.surfaces, v->first);
+      for (size_t j = 0; j < v->count; ++j) {
+         struct wlc_surface *surface;
+         if (!(surface = convert_from_wlc_resource(s[j].surface, "surface")))
+            continue;
+
+         // View's own surface is painted to its visible area within the bounds
+         snapshot_surface(output, surface, (j == 0 ? &v->bounds : &s[j].geometry), &s[j].geometry, r, nrects);
+      }
+   }
+
+   pixman_region32_fini(&clip);
+}
+
+static void
+take_frame_callbacks(struct wlc_output *output, struct wlc_surface *surface)
+{
+   assert(output && surface);
+
+   wlc_resource *r;
+   chck_iter_pool_for_each(&surface->commit.frame_cbs, r)
+      chck_iter_pool_push_back(&output->callbacks, r);
+   chck_iter_pool_flush(&surface->commit.frame_cbs);
+}
+
+static void
+take_feedbacks(struct wlc_output *output, struct wlc_surface *surface)
+{
+   assert(output && surface);
+
+   wlc_resource *r;
+   chck_iter_pool_for_each(&surface->commit.feedbacks, r)
+      chck_iter_pool_push_back(&output->feedbacks, r);
+   chck_iter_pool_flush(&surface->commit.feedbacks);
+}
+
+static void
+present_feedbacks(struct wlc_output *output, uint64_t time, uint32_t flags)
+{
+   assert(output);
+
+   wlc_resource *r;
+   const uint32_t refresh = refresh_period(output);
+   chck_iter_pool_for_each(&output->feedbacks, r)
+      wlc_presentation_feedback_presented(*r, output, time, refresh, output->state.seq, flags);
+   chck_iter_pool_flush(&output->feedbacks);
+}
+
+static bool
+surface_tree_has_callbacks(struct wlc_surface *surface)
+{
+   if (!surface)
+      return false;
+
+   if (surface->commit.frame_cbs.items.count > 0)
+      return true;
+
+   wlc_resource *sub;
+   chck_iter_pool_for_each(&surface->subsurface_list, sub) {
+      if (surface_tree_has_callbacks(convert_from_wlc_resource(*sub, "surface")))
+         return true;
+   }
+
+   return false;
+}
+
+static void
+send_frame_callbacks(struct chck_iter_pool *callbacks, uint32_t frame_time)
+{
+   assert(callbacks);
+
+   wlc_resource *r;
+   chck_iter_pool_for_each(callbacks, r) {
+      struct wl_resource *resource;
+      if ((resource = wl_resource_from_wlc_resource(*r, "callback")))
+         wl_callback_send_done(resource, frame_time);
+      wlc_resource_release_ptr(r);
+   }
+   chck_iter_pool_flush(callbacks);
+}
+
+static void
+flush_hidden_surface_tree(struct wlc_surface *surface, uint32_t frame_time)
+{
+   if (!surface)
+      return;
+
+   send_frame_callbacks(&surface->commit.frame_cbs, frame_time);
+
+   // Hidden content is never presented
+   chck_iter_pool_for_each_call(&surface->commit.feedbacks, wlc_presentation_feedback_discarded_ptr);
+   chck_iter_pool_flush(&surface->commit.feedbacks);
+
+   wlc_resource *sub;
+   chck_iter_pool_for_each(&surface->subsurface_list, sub)
+      flush_hidden_surface_tree(convert_from_wlc_resource(*sub, "surface"), frame_time);
+}
+
+static void
+damage_surface(struct wlc_output *output, struct wlc_surface *surface, const struct wlc_geometry *geometry)
+{
+   assert(output && surface && geometry);
+
+   if (!wlc_geometry_equals(&surface->painted, geometry)) {
+      wlc_output_damage(output, &surface->painted);
+      wlc_output_damage(output, geometry);
+      surface->painted = *geometry;
+   } else if (pixman_region32_not_empty(&surface->commit.damage)) {
+      // commit damage is in surface coordinates, scale it to the painted geometry
+      assert(surface->size.w > 0 && surface->size.h > 0);
+      const float sw = (float)geometry->size.w / surface->size.w, sh = (float)geometry->size.h / surface->size.h;
+
+      int nrects;
+      const pixman_box32_t *r = pixman_region32_rectangles(&surface->commit.damage, &nrects);
+      for (int i = 0; i < nrects; ++i) {
+         const int32_t x1 = floor(r[i].x1 * sw), y1 = floor(r[i].y1 * sh);
+         const int32_t x2 = ceil(r[i].x2 * sw), y2 = ceil(r[i].y2 * sh);
+         pixman_region32_union_rect(&output->damage.current, &output->damage.current, geometry->origin.x + x1, geometry->origin.y + y1, x2 - x1, y2 - y1);
       }
+   }
+
+   pixman_region32_clear(&surface->commit.damage);
+   take_frame_callbacks(output, surface);
+   take_feedbacks(output, surface);
+}
 
-      if (should_blit)
-         memset(g + off, true, memb);
+static bool
+push_scene_surface(struct wlc_output *output, struct wlc_surface *surface, const struct wlc_geometry *geometry)
+{
+   assert(output && surface && geometry);
+
+   const struct scene_surface entry = { .surface = convert_to_wlc_resource(surface), .geometry = *geometry };
+   if (chck_iter_pool_push_back(&output->scene.surfaces, &entry)) {
+      surface->scene.index = output->scene.surfaces.items.count - 1;
+      surface->scene.serial = output->scene.serial;
+      return true;
    }
 
-   return visible;
+   // Paint what we have, and try again next frame
+   output->scene.dirty = true;
+   return false;
+}
+
+static void
+flatten_subsurface(struct wlc_output *output, struct wlc_surface *surface, const struct wlc_geometry *geometry, void *data)
+{
+   push_scene_surface(output, surface, geometry);
+   geometry_union(data, geometry);
+}
+
+static void
+truncate_scene(struct wlc_output *output, size_t count)
+{
+   assert(output);
+
+   while (output->scene.surfaces.items.count > count)
+      chck_iter_pool_remove(&output->scene.surfaces, output->scene.surfaces.items.count - 1);
+}
+
+static struct scene_surface*
+scene_surface_for(struct wlc_output *output, struct wlc_surface *surface)
+{
+   assert(output && surface);
+
+   // Index is stale if the surface was pushed to an older scene, or truncated away and its slot reused
+   struct scene_surface *s;
+   if (surface->scene.serial != output->scene.serial || !(s = chck_iter_pool_get(&output->scene.surfaces, surface->scene.index)))
+      return NULL;
+
+   return (s->surface == convert_to_wlc_resource(surface) ? s : NULL);
+}
+
+static void
+flush_visible(struct wlc_output *output)
+{
+   assert(output);
+
+   struct visible_view *v;
+   chck_iter_pool_for_each(&output->visible, v)
+      pixman_region32_fini(&v->region);
+   chck_iter_pool_flush(&output->visible);
 }
 
 static bool
-get_visible_views(struct wlc_output *output, struct chck_iter_pool *visible)
+get_visible_views(struct wlc_output *output)
 {
-   assert(output && output->blit);
+   assert(output);
+
+   flush_visible(output);
+   chck_iter_pool_flush(&output->scene.surfaces);
+   output->scene.serial = ++scene_serial;
+   output->scene.dirty = false;
+
+   // View state is committed below
+   output->hit.dirty = true;
+
+   // Walk views front to back, accumulating the opaque regions that occlude the views below
+   pixman_region32_t occluded, opaque;
+   pixman_region32_init(&occluded);
+   pixman_region32_init(&opaque);
 
-   const size_t gsz = output->virtual.w * output->virtual.h;
-   memset(output->blit, false, gsz);
+   struct chck_iter_pool *views = stacked_views(output);
 
    wlc_handle *h;
-   chck_iter_pool_for_each_reverse(&output->views, h) {
+   chck_iter_pool_for_each_reverse(views, h) {
       struct wlc_view *v;
       struct wlc_surface *s;
       if (!(v = convert_from_wlc_handle(*h, "view")) ||
           !(s = convert_from_wlc_resource(v->surface, "surface")))
          continue;
 
+      const uint64_t t = get_time_ns();
       wlc_view_commit_state(v, &v->pending, &v->commit);
+      phase_mark(output, WLC_FRAME_PHASE_COMMIT, t);
       const bool vis = view_visible(v, s, output->active.mask);
+      v->state.hidden = (s->commit.attached && !vis);
 
       // This place sucks for this, but otherwise we would need API level interaction.
       // This is also very ugly, we can't unmap since it would destroy the wayland surface.
@@ -195,118 +904,418 @@ get_visible_views(struct wlc_output *output, struct chck_iter_pool *visible)
       if (!vis)
          continue;
 
-      struct wlc_geometry o;
-      struct wlc_point a, b;
-      const bool should_blit = wlc_view_get_opaque(v, &o);
-      a.x = chck_clamp32(o.origin.x, 0, output->virtual.w);
-      a.y = chck_clamp32(o.origin.y, 0, output->virtual.h);
-      b.x = chck_clamp32((o.origin.x + o.size.w), 1, output->virtual.w);
-      b.y = chck_clamp32((o.origin.y + o.size.h), 1, output->virtual.h);
+      struct visible_view entry = { .view = *h, .first = output->scene.surfaces.items.count };
+      wlc_view_get_bounds(v, &entry.bounds, &entry.visible);
+
+      if (!push_scene_surface(output, s, &entry.visible))
+         continue;
+
+      entry.extents = entry.bounds;
+      subsurfaces_for_each(output, s, (struct wlc_coordinate_scale){1, 1}, entry.bounds.origin, flatten_subsurface, &entry.extents);
+      entry.count = output->scene.surfaces.items.count - entry.first;
+
+      const struct wlc_geometry b = entry.extents;
+      pixman_region32_init_rect(&entry.region, b.origin.x, b.origin.y, b.size.w, b.size.h);
+      pixman_region32_intersect_rect(&entry.region, &entry.region, 0, 0, output->virtual.w, output->virtual.h);
+      pixman_region32_subtract(&entry.region, &entry.region, &occluded);
 
-      if (!blit(output->blit, &output->virtual, &a, &b, should_blit)) {
-         wlc_dlog(WLC_DBG_RENDER_LOOP, "%" PRIuWLC " is not visible (%d,%d+%d,%d %d,%d+%ux%u)", *h, a.x, a.y, b.x, b.y, o.origin.x, o.origin.y, o.size.w, o.size.h);
+      if (!pixman_region32_not_empty(&entry.region)) {
+         wlc_dlog(WLC_DBG_RENDER_LOOP, "%" PRIuWLC " is not visible (%d,%d+%ux%u)", *h, b.origin.x, b.origin.y, b.size.w, b.size.h);
+         pixman_region32_fini(&entry.region);
+         truncate_scene(output, entry.first);
+         v->state.hidden = true;
          continue;
       }
 
-      wlc_dlog(WLC_DBG_RENDER_LOOP, "%" PRIuWLC " is visible (%d,%d+%d,%d %d,%d+%ux%u)", *h, a.x, a.y, b.x, b.y, o.origin.x, o.origin.y, o.size.w, o.size.h);
-      chck_iter_pool_push_front(visible, &v);
+      if (!chck_iter_pool_push_front(&output->visible, &entry)) {
+         pixman_region32_fini(&entry.region);
+         truncate_scene(output, entry.first);
+         output->scene.dirty = true;
+         continue;
+      }
+
+      wlc_dlog(WLC_DBG_RENDER_LOOP, "%" PRIuWLC " is visible (%d,%d+%ux%u, %d rects)", *h, b.origin.x, b.origin.y, b.size.w, b.size.h, pixman_region32_n_rects(&entry.region));
+
+      wlc_view_get_opaque_region(v, &opaque);
+      pixman_region32_union(&occluded, &occluded, &opaque);
+   }
+
+   chck_iter_pool_for_each(views, h) {
+      struct wlc_view *v;
+      if ((v = convert_from_wlc_handle(*h, "view")) && v->state.hidden && surface_tree_has_callbacks(convert_from_wlc_resource(v->surface, "surface")))
+         wlc_output_schedule_hidden_frame(output);
    }
 
-   return memchr(output->blit, false, gsz);
+   const bool background_visible = (pixman_region32_contains_rectangle(&occluded, &(pixman_box32_t){ 0, 0, output->virtual.w, output->virtual.h }) != PIXMAN_REGION_IN);
+   pixman_region32_fini(&opaque);
+   pixman_region32_fini(&occluded);
+   return background_visible;
+}
+
+static struct scene_view*
+scene_view_for_handle(struct chck_iter_pool *scene, wlc_handle view, size_t *out_index)
+{
+   assert(scene && out_index);
+
+   struct scene_view *s;
+   chck_iter_pool_for_each(scene, s) {
+      if (s->view != view)
+         continue;
+
+      *out_index = _I - 1;
+      return s;
+   }
+
+   return NULL;
 }
 
 static void
-finish_frame_tasks(struct wlc_output *output)
+damage_view(struct wlc_output *output, struct visible_view *v)
+{
+   assert(output && v);
+
+   const struct scene_surface *s = chck_iter_pool_get(&output->scene.surfaces, v->first);
+   for (size_t i = 0; i < v->count; ++i) {
+      struct wlc_surface *surface;
+      if ((surface = convert_from_wlc_resource(s[i].surface, "surface")))
+         damage_surface(output, surface, &s[i].geometry);
+   }
+}
+
+static void
+damage_committed(struct wlc_output *output)
 {
    assert(output);
 
-   if (output->task.bsurface.display) {
-      wlc_output_set_backend_surface(output, (output->task.bsurface.display == INVALID_DISPLAY ? NULL : &output->task.bsurface));
-      memset(&output->task.bsurface, 0, sizeof(output->task.bsurface));
+   // Scene is unchanged, only surfaces with new content have damage.
+   // Surfaces not in the scene belong to hidden views, their callbacks are kept going by the hidden frames.
+   wlc_resource *r;
+   chck_iter_pool_for_each(&output->scene.committed, r) {
+      struct wlc_surface *surface;
+      struct scene_surface *s;
+      if ((surface = convert_from_wlc_resource(*r, "surface")) && (s = scene_surface_for(output, surface)))
+         damage_surface(output, surface, &s->geometry);
    }
+}
 
-   if (output->task.sleep) {
-      wlc_output_set_sleep_ptr(output, true);
-      output->task.sleep = false;
+static void
+diff_scene(struct wlc_output *output)
+{
+   assert(output);
+
+   // Diff the visible views against what we painted last frame,
+   // to damage views that got moved, restacked, mapped or unmapped.
+   chck_iter_pool_flush(&output->damage.stage);
+
+   size_t last = 0;
+   struct visible_view *v;
+   chck_iter_pool_for_each(&output->visible, v) {
+      damage_view(output, v);
+
+      struct scene_view entry = { .view = v->view, .extents = v->extents };
+
+      size_t index;
+      struct scene_view *old = scene_view_for_handle(&output->damage.scene, entry.view, &index);
+
+      if (!old || index < last || !wlc_geometry_equals(&old->extents, &entry.extents)) {
+         if (old)
+            wlc_output_damage(output, &old->extents);
+
+         wlc_output_damage(output, &entry.extents);
+      }
+
+      if (old && index + 1 > last)
+         last = index + 1;
+
+      chck_iter_pool_push_back(&output->damage.stage, &entry);
    }
 
-   if (output->task.terminate) {
-      wlc_output_terminate(output);
-      output->task.terminate = false;
+   {
+      struct scene_view *s;
+      chck_iter_pool_for_each(&output->damage.scene, s) {
+         size_t index;
+         if (!scene_view_for_handle(&output->damage.stage, s->view, &index))
+            wlc_output_damage(output, &s->extents);
+      }
    }
+
+   struct chck_iter_pool tmp = output->damage.scene;
+   output->damage.scene = output->damage.stage;
+   output->damage.stage = tmp;
 }
 
 static void
-render_subsurface(struct wlc_output *output, struct wlc_surface *surface, struct wlc_point offset, struct wlc_coordinate_scale parent_scale)
+accumulate_damage(struct wlc_output *output, bool rebuilt)
 {
-   const struct wlc_geometry g = {
-      .origin = {
-         .x = offset.x + parent_scale.w * (surface->commit.subsurface_position.x + surface->commit.offset.x),
-         .y = offset.y + parent_scale.h * (surface->commit.subsurface_position.y + surface->commit.offset.y)
-      },
-      .size = {
-         .w = surface->size.w * parent_scale.w,
-         .h = surface->size.h * parent_scale.h
-      },
-   };
-   wlc_render_surface_paint(&output->render, &output->context, surface, &g);
+   assert(output);
+
+   // A rebuilt scene collects damage of every visible surface anyway
+   if (rebuilt) {
+      diff_scene(output);
+   } else {
+      damage_committed(output);
+   }
+
+   chck_iter_pool_flush(&output->scene.committed);
+   output->scene.queue = ++scene_serial;
+
+   struct wlc_render_event ev = { .output = output, .type = WLC_RENDER_EVENT_DAMAGE };
+   wl_signal_emit(&wlc_system_signals()->render, &ev);
+
+   pixman_region32_intersect_rect(&output->damage.current, &output->damage.current, 0, 0, output->virtual.w, output->virtual.h);
 }
 
 static void
-subsurfaces_render(struct wlc_output *output, struct wlc_surface *surface, struct wlc_coordinate_scale parent_scale, struct chck_iter_pool *callbacks, struct wlc_point offset)
+repaint_region(struct wlc_output *output, pixman_region32_t *frame, pixman_region32_t *out_region)
 {
-   if (!surface)
-       return;
+   assert(output && frame && out_region);
 
-   /* do not render view's main surface twice */
-   if (surface->parent)
-       render_subsurface(output, surface, offset, parent_scale);
+   // Back buffer contains the frame from "age" frames ago, so we have to repaint
+   // damage of this frame and all the frames presented after that one.
+   const uint32_t age = (wlc_options()->damage_tracking ? wlc_context_buffer_age(&output->context) : 0);
+   pixman_region32_copy(out_region, frame);
 
-   wlc_resource *sub;
-   chck_iter_pool_for_each(&surface->subsurface_list, sub) {
-       subsurfaces_render(output, convert_from_wlc_resource(*sub, "surface"), surface->coordinate_transform,
-             callbacks,
-             (struct wlc_point) {
-             offset.x + (surface->parent ? 0 : surface->commit.subsurface_position.x / parent_scale.w),
-             offset.y + (surface->parent ? 0 : surface->commit.subsurface_position.y / parent_scale.h)
-             });
+   if (age == 0 || age > WLC_OUTPUT_DAMAGE_HISTORY + 1) {
+      pixman_region32_union_rect(out_region, out_region, 0, 0, output->virtual.w, output->virtual.h);
+   } else {
+      for (uint32_t i = 0; i < age - 1; ++i) {
+         const uint32_t h = (output->damage.index + WLC_OUTPUT_DAMAGE_HISTORY - i) % WLC_OUTPUT_DAMAGE_HISTORY;
+         pixman_region32_union(out_region, out_region, &output->damage.history[h]);
+      }
    }
 
-   wlc_resource *r;
-   chck_iter_pool_for_each(&surface->commit.frame_cbs, r)
-      chck_iter_pool_push_back(callbacks, r);
-   chck_iter_pool_flush(&surface->commit.frame_cbs);
+   pixman_region32_intersect_rect(out_region, out_region, 0, 0, output->virtual.w, output->virtual.h);
+   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Buffer age %u", age);
 }
 
 static void
-render_view(struct wlc_output *output, struct wlc_view *view, struct chck_iter_pool *callbacks)
+present(struct wlc_output *output, pixman_region32_t *frame)
 {
-   assert(output && callbacks);
+   assert(output && frame);
+
+   size_t memb = 0;
+   const EGLint *rects = NULL;
+
+   if (wlc_options()->damage_tracking) {
+      chck_iter_pool_flush(&output->damage.rects);
+
+      // damage rects are in framebuffer pixels with lower left origin
+      const float sw = (float)output->mode.w / output->virtual.w, sh = (float)output->mode.h / output->virtual.h;
+
+      int nrects;
+      const pixman_box32_t *r = pixman_region32_rectangles(frame, &nrects);
+      for (int i = 0; i < nrects; ++i) {
+         const int32_t x1 = floor(r[i].x1 * sw), y1 = floor(r[i].y1 * sh);
+         const int32_t x2 = ceil(r[i].x2 * sw), y2 = ceil(r[i].y2 * sh);
+         const EGLint rect[4] = { x1, output->mode.h - y2, x2 - x1, y2 - y1 };
+         chck_iter_pool_push_back(&output->damage.rects, rect);
+      }
+
+      rects = chck_iter_pool_to_c_array(&output->damage.rects, &memb);
+   }
+
+   output->state.pending = true;
+   const uint64_t start = get_time_ns();
+   wlc_context_swap(&output->context, &output->bsurface, rects, (EGLint)memb);
+
+   // Rolling composite + swap cost, rises immediately and decays slowly to stay on the safe side
+   const uint64_t refresh = refresh_period(output), now = phase_mark(output, WLC_FRAME_PHASE_SWAP, start);
+   output->stats.repaint = now - output->schedule.start;
+   const uint64_t cost = (now - output->schedule.start < refresh ? now - output->schedule.start : refresh);
+   output->schedule.cost = (cost > output->schedule.cost ? cost : (output->schedule.cost * 15 + cost) / 16);
+
+   output->damage.index = (output->damage.index + 1) % WLC_OUTPUT_DAMAGE_HISTORY;
+   pixman_region32_copy(&output->damage.history[output->damage.index], frame);
+}
+
+static bool
+should_render(struct wlc_output *output)
+{
+   assert(output);
+   return (wlc_get_active() && !output->state.pending && output->bsurface.display && output->active.mode != UINT_MAX);
+}
+
+static bool
+frame_damage(struct wlc_output *output, pixman_region32_t *frame, const struct wlc_geometry *geometry, struct wlc_geometry *out_damage)
+{
+   assert(output && frame && geometry && out_damage);
+
+   pixman_region32_t damage;
+   pixman_region32_init(&damage);
+   wlc_output_damage_to_pixels(output, frame, &damage);
+   pixman_region32_intersect_rect(&damage, &damage, geometry->origin.x, geometry->origin.y, geometry->size.w, geometry->size.h);
+   const bool damaged = pixman_region32_not_empty(&damage);
+   *out_damage = region_extents(&damage);
+   pixman_region32_fini(&damage);
+   return damaged;
+}
+
+static struct wlc_output*
+issue_reads(struct wlc_output *output, pixman_region32_t *frame)
+{
+   assert(output && frame);
+
+   const wlc_handle handle = convert_to_wlc_handle(output);
+   for (size_t i = 0; i < output->reads.items.count;) {
+      struct pixels_read *r = chck_iter_pool_get(&output->reads, i);
+
+      if (r->issued || (r->damage_only && !frame_damage(output, frame, &r->geometry, &r->damage))) {
+         ++i;
+         continue;
+      }
 
-   if (!view)
+      if (wlc_render_readback_begin(&output->render, &output->context, r->format, &r->geometry, &r->readback)) {
+         if (!r->damage_only)
+            r->damage = r->readback.geometry;
+
+         r->issued = true;
+         ++i;
+         continue;
+      }
+
+      struct pixels_read read = *r;
+      chck_iter_pool_remove(&output->reads, i);
+      read.done(handle, &read.geometry, &read.damage, 0, NULL, read.arg);
+
+      // Callback may have created or destroyed outputs
+      if (!(output = convert_from_wlc_handle(handle, "output")))
+         return NULL;
+   }
+
+   return output;
+}
+
+static struct wlc_output*
+collect_reads(struct wlc_output *output)
+{
+   assert(output);
+
+   const wlc_handle handle = convert_to_wlc_handle(output);
+   for (size_t i = 0; i < output->reads.items.count;) {
+      struct pixels_read *r = chck_iter_pool_get(&output->reads, i);
+
+      // Give the GPU a frame to finish the copy before blocking on it
+      const void *data;
+      if (!r->issued || !(data = wlc_render_readback_map(&output->render, &output->context, &r->readback, ++r->age >= 2))) {
+         ++i;
+         continue;
+      }
+
+      struct pixels_read read = *r;
+      chck_iter_pool_remove(&output->reads, i);
+      read.done(handle, &read.readback.geometry, &read.damage, read.time, data, read.arg);
+
+      // Callback may have created or destroyed outputs
+      if (!(output = convert_from_wlc_handle(handle, "output")))
+         return NULL;
+
+      wlc_render_readback_end(&output->render, &output->context, &read.readback);
+   }
+
+   // Keep the loop ticking until the reads in flight are delivered
+   struct pixels_read *r;
+   chck_iter_pool_for_each(&output->reads, r) {
+      if (r->issued) {
+         wlc_output_schedule_repaint(output);
+         break;
+      }
+   }
+
+   return output;
+}
+
+static void
+cancel_reads(struct wlc_output *output, bool queued)
+{
+   assert(output);
+
+   for (size_t i = 0; i < output->reads.items.count;) {
+      struct pixels_read *r = chck_iter_pool_get(&output->reads, i);
+
+      if (!r->issued && !queued) {
+         ++i;
+         continue;
+      }
+
+      struct pixels_read read = *r;
+      chck_iter_pool_remove(&output->reads, i);
+      wlc_render_readback_end(&output->render, &output->context, &read.readback);
+      read.done(convert_to_wlc_handle(output), &read.geometry, &read.damage, 0, NULL, read.arg);
+   }
+}
+
+static void
+finish_repaint(struct wlc_output *output, pixman_region32_t *frame, pixman_region32_t *region)
+{
+   assert(output && frame && region);
+
+   rendering_output = output;
+
+   uint64_t t = get_time_ns();
+   emit_render_hook(output, wlc_interface()->output.render.post, convert_to_wlc_handle(output));
+   t = phase_mark(output, WLC_FRAME_PHASE_HOOKS, t);
+   wlc_render_flush_fakefb(&output->render, &output->context);
+   t = phase_mark(output, WLC_FRAME_PHASE_FLUSH, t);
+
+   // Pointer is drawn over what is already there, only where it was cleared this frame
+   struct wlc_render_event ev = { .output = output, .type = WLC_RENDER_EVENT_POINTER };
+
+   int nrects;
+   const pixman_box32_t *r = pixman_region32_rectangles(region, &nrects);
+   for (int i = 0; i < nrects; ++i) {
+      scissor_box(output, &r[i]);
+      wl_signal_emit(&wlc_system_signals()->render, &ev);
+   }
+
+   scissor_region(output, region);
+   wlc_render_submit(&output->render, &output->context);
+   phase_mark(output, WLC_FRAME_PHASE_PAINT, t);
+
+   rendering_output = NULL;
+
+   // Last chance to queue reads of this frame
+   const wlc_handle handle = convert_to_wlc_handle(output);
+   ev = (struct wlc_render_event){ .output = output, .type = WLC_RENDER_EVENT_FRAME, .frame = frame };
+   wl_signal_emit(&wlc_system_signals()->render, &ev);
+
+   if (!(output = convert_from_wlc_handle(handle, "output")))
       return;
 
-   struct wlc_surface *surface;
-   if (!(surface = convert_from_wlc_resource(view->surface, "surface")))
+   if (!(output = issue_reads(output, frame)))
       return;
 
-   WLC_INTERFACE_EMIT(view.render.pre, convert_to_wlc_handle(view));
-   wlc_render_flush_fakefb(&output->render, &output->context);
-   wlc_render_view_paint(&output->render, &output->context, view);
+   present(output, frame);
+   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint");
+}
+
+static void
+cb_painted(void *data)
+{
+   assert(data);
 
-   struct wlc_geometry b;
-   wlc_view_get_bounds(view, &b, NULL);
-   subsurfaces_render(output, surface, (struct wlc_coordinate_scale) {1, 1}, callbacks, b.origin);
+   struct wlc_output *output;
+   if (!(output = convert_from_wlc_handle((wlc_handle)data, "output")))
+      return;
 
-   WLC_INTERFACE_EMIT(view.render.post, convert_to_wlc_handle(view));
-   wlc_render_flush_fakefb(&output->render, &output->context);
+   output->state.painting = false;
+   phase_mark(output, WLC_FRAME_PHASE_PAINT, output->stats.painting);
+   scissor_region(output, &output->paint.region);
+   finish_repaint(output, &output->paint.frame, &output->paint.region);
 }
 
 static bool
-should_render(struct wlc_output *output)
+paint_threaded(struct wlc_output *output)
 {
    assert(output);
-   return (wlc_get_active() && !output->state.pending && output->bsurface.display && output->active.mode != UINT_MAX);
+
+   // View render hooks draw between the views, those frames have to be painted in order on the main loop
+   if (!wlc_options()->render_threads || !wlc_render_has_items(&output->render) || wlc_interface()->view.render.pre || wlc_interface()->view.render.post)
+      return false;
+
+   if (!output->paint.thread && !(output->paint.thread = wlc_render_thread(cb_painted, (void*)convert_to_wlc_handle(output))))
+      wlc_options()->render_threads = false;
+
+   return (output->paint.thread != NULL);
 }
 
 static bool
@@ -317,70 +1326,118 @@ repaint(struct wlc_output *output)
 
    if (!should_render(output)) {
       wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Skipped repaint");
+      output->stats.frame.skipped++;
       output->state.activity = output->state.scheduled = false;
       finish_frame_tasks(output);
       return false;
    }
 
+   output->schedule.start = get_time_ns();
    wlc_render_resolution(&output->render, &output->context, &output->mode, &output->virtual, output->scale);
 
    if (output->state.sleeping) {
       // fake sleep
+      pixman_region32_t frame;
+      pixman_region32_init_rect(&frame, 0, 0, output->virtual.w, output->virtual.h);
+      wlc_render_scissor(&output->render, &output->context, NULL);
       wlc_render_clear(&output->render, &output->context);
-      output->state.pending = true;
-      wlc_context_swap(&output->context, &output->bsurface);
+      present(output, &frame);
+      pixman_region32_fini(&frame);
       wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint");
       return true;
    }
 
-   const bool bg_visible = get_visible_views(output, &output->visible);
+   // View state commit is timed separately inside get_visible_views
+   uint64_t t = get_time_ns();
+   const uint64_t commit = output->stats.phase[WLC_FRAME_PHASE_COMMIT];
+   const bool rebuild = (!wlc_options()->retained_scene || output->scene.dirty);
 
-   if (!output->state.background_visible && bg_visible) {
-      wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Background visible");
-      output->state.background_visible = true;
-   } else if (output->state.background_visible && !bg_visible) {
-      wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Background not visible");
-      output->state.background_visible = false;
+   if (rebuild) {
+      const bool bg_visible = get_visible_views(output);
+
+      if (!output->state.background_visible && bg_visible) {
+         wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Background visible");
+         output->state.background_visible = true;
+      } else if (output->state.background_visible && !bg_visible) {
+         wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Background not visible");
+         output->state.background_visible = false;
+      }
+   } else {
+      wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Retained scene");
+   }
+
+   accumulate_damage(output, rebuild);
+   phase_mark(output, WLC_FRAME_PHASE_VISIBILITY, t);
+   output->stats.phase[WLC_FRAME_PHASE_VISIBILITY] -= output->stats.phase[WLC_FRAME_PHASE_COMMIT] - commit;
+
+   if (wlc_options()->damage_tracking && !pixman_region32_not_empty(&output->damage.current)) {
+      // Nothing changed on screen, keep the clients ticking without compositing
+      // No flip happens, so there is no presentation time to report for the committed content
+      chck_iter_pool_for_each_call(&output->feedbacks, wlc_presentation_feedback_discarded_ptr);
+      chck_iter_pool_flush(&output->feedbacks);
+      send_frame_callbacks(&output->callbacks, wlc_get_time(NULL));
+      output->stats.frame.skipped++;
+      memset(output->stats.phase, 0, sizeof(output->stats.phase));
+      wlc_dlog(WLC_DBG_RENDER_LOOP, "-> No damage");
+
+      if (!(output = collect_reads(output)))
+         return false;
+
+      schedule_next_frame(output);
+      return false;
    }
 
+   // Damage added from now on belongs to the next frame
+   pixman_region32_t frame, region;
+   pixman_region32_init(&frame);
+   pixman_region32_init(&region);
+   pixman_region32_copy(&frame, &output->damage.current);
+   pixman_region32_clear(&output->damage.current);
+   repaint_region(output, &frame, &region);
+   limit_repaint_region(&region);
+   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint region %d rects", pixman_region32_n_rects(&region));
+
    rendering_output = output;
-   wlc_render_clear(&output->render, &output->context);
+   t = get_time_ns();
+   clear_region(output, &region);
+   t = phase_mark(output, WLC_FRAME_PHASE_PAINT, t);
 
    if (output->state.background_visible) {
-      WLC_INTERFACE_EMIT(output.render.pre, convert_to_wlc_handle(output));
+      emit_render_hook(output, wlc_interface()->output.render.pre, convert_to_wlc_handle(output));
+      t = phase_mark(output, WLC_FRAME_PHASE_HOOKS, t);
       wlc_render_flush_fakefb(&output->render, &output->context);
+      phase_mark(output, WLC_FRAME_PHASE_FLUSH, t);
    }
 
-   {
-      struct wlc_view **v;
+   if (paint_threaded(output)) {
+      // Snapshot what to paint and let protocol dispatch continue, the frame is finished in cb_painted
+      struct visible_view *v;
       chck_iter_pool_for_each(&output->visible, v)
-         render_view(output, *v, &output->callbacks);
-      chck_iter_pool_flush(&output->visible);
-   }
-
-   WLC_INTERFACE_EMIT(output.render.post, convert_to_wlc_handle(output));
-   wlc_render_flush_fakefb(&output->render, &output->context);
+         snapshot_view(output, v, &region);
 
-   struct wlc_render_event ev = { .output = output, .type = WLC_RENDER_EVENT_POINTER };
-   wl_signal_emit(&wlc_system_signals()->render, &ev);
+      rendering_output = NULL;
 
-   rendering_output = NULL;
+      pixman_region32_copy(&output->paint.frame, &frame);
+      pixman_region32_copy(&output->paint.region, &region);
+      output->state.pending = output->state.painting = true;
+      output->stats.painting = get_time_ns();
+      wlc_render_thread_submit(output->paint.thread, &output->render, &output->paint.items);
+      pixman_region32_fini(&frame);
+      pixman_region32_fini(&region);
 
-   output->state.pending = true;
-   wlc_context_swap(&output->context, &output->bsurface);
+      wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint on render thread");
+      return true;
+   }
 
    {
-      wlc_resource *r;
-      chck_iter_pool_for_each(&output->callbacks, r) {
-         struct wl_resource *resource;
-         if ((resource = wl_resource_from_wlc_resource(*r, "callback")))
-            wl_callback_send_done(resource, output->state.frame_time);
-         wlc_resource_release_ptr(r);
-      }
-      chck_iter_pool_flush(&output->callbacks);
+      struct visible_view *v;
+      chck_iter_pool_for_each(&output->visible, v)
+         render_view(output, v, &region);
    }
 
-   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint");
+   finish_repaint(output, &frame, &region);
+   pixman_region32_fini(&frame);
+   pixman_region32_fini(&region);
    return true;
 }
 
@@ -392,6 +1449,30 @@ cb_idle_timer(void *data)
    return 1;
 }
 
+static int
+cb_hidden_timer(void *data)
+{
+   assert(data);
+
+   struct wlc_output *output;
+   if (!(output = convert_from_wlc_handle((wlc_handle)data, "output")))
+      return 1;
+
+   output->state.hidden_scheduled = false;
+
+   const uint32_t time = wlc_get_time(NULL);
+
+   wlc_handle *h;
+   chck_iter_pool_for_each(stacked_views(output), h) {
+      struct wlc_view *v;
+      if ((v = convert_from_wlc_handle(*h, "view")) && v->state.hidden)
+         flush_hidden_surface_tree(convert_from_wlc_resource(v->surface, "surface"), time);
+   }
+
+   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Hidden frame");
+   return 1;
+}
+
 static void
 cancel_repaint(struct wlc_output *output)
 {
@@ -400,35 +1481,43 @@ cancel_repaint(struct wlc_output *output)
 }
 
 void
-wlc_output_finish_frame(struct wlc_output *output, const struct timespec *ts)
+wlc_output_finish_frame(struct wlc_output *output, const struct timespec *ts, uint64_t seq, uint32_t flags)
 {
    assert(ts);
 
    if (!output)
       return;
 
+   const uint64_t previous = output->state.frame_time;
    output->state.pending = false;
+   output->state.frame_time = timespec_to_ns(ts);
+   output->state.seq = (seq ? seq : output->state.seq + 1);
 
-   // XXX: uint32_t holds mostly for 50 days before overflowing
-   //      is this tied to wayland somewhere, or should we increase precision?
-   const uint32_t last = output->state.frame_time;
-   output->state.frame_time = ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
-   const uint32_t ms = output->state.frame_time - last;
+   if (previous && output->state.frame_time > previous)
+      histogram_add(&output->stats.frame.interval, output->state.frame_time - previous);
 
-   // TODO: handle presentation feedback here
+   // Flip landed on a later vblank than the one the frame was scheduled for
+   if (output->schedule.target && output->state.frame_time > output->schedule.target + refresh_period(output) / 2)
+      output->stats.frame.missed++;
 
-   if (output->state.activity && !output->task.terminate) {
-      output->state.ims = chck_clampf(output->state.ims * (output->state.activity ? 0.9 : 1.1), 1, 41);
-      wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Interpolated idle time %f (%u : %d)", output->state.ims, ms, output->state.activity);
-      wl_event_source_timer_update(output->timer.idle, output->state.ims);
-      output->state.scheduled = true;
-      output->state.activity = false;
-   } else {
-      output->state.scheduled = false;
+   const uint64_t t = get_time_ns();
+   present_feedbacks(output, output->state.frame_time, flags);
+
+   // Clients start their next frame only once the previous one is on screen
+   send_frame_callbacks(&output->callbacks, output->state.frame_time / 1000000);
+   phase_mark(output, WLC_FRAME_PHASE_CALLBACKS, t);
+   record_frame(output);
+
+   struct pixels_read *r;
+   chck_iter_pool_for_each(&output->reads, r) {
+      if (r->issued && !r->time)
+         r->time = output->state.frame_time;
    }
 
-   wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Finished frame");
-   finish_frame_tasks(output);
+   if (!(output = collect_reads(output)))
+      return;
+
+   schedule_next_frame(output);
 }
 
 void
@@ -442,15 +1531,23 @@ wlc_output_surface_destroy(struct wlc_output *output, struct wlc_surface *surfac
    wlc_render_surface_destroy(&output->render, &output->context, surface);
    surface->output = 0;
 
+   wlc_output_damage(output, &surface->painted);
+   surface->painted = wlc_geometry_zero;
+   wlc_output_invalidate_scene(output);
    wlc_output_schedule_repaint(output);
 
-   wlc_resource *r;
-   chck_iter_pool_for_each(&output->surfaces, r) {
-      if (*r != convert_to_wlc_resource(surface))
-         continue;
+   // Order of the surfaces doesn't matter, move the last one to the removed slot
+   wlc_resource *slot;
+   if ((slot = chck_iter_pool_get(&output->surfaces, surface->output_index)) && *slot == convert_to_wlc_resource(surface)) {
+      const size_t last = output->surfaces.items.count - 1;
+      wlc_resource *moved = chck_iter_pool_get(&output->surfaces, last);
+
+      struct wlc_surface *s;
+      if (moved != slot && (s = convert_from_wlc_resource(*moved, "surface")))
+         s->output_index = surface->output_index;
 
-      chck_iter_pool_remove(&output->surfaces, _I - 1);
-      break;
+      *slot = *moved;
+      chck_iter_pool_remove(&output->surfaces, last);
    }
 
    wlc_dlog(WLC_DBG_RENDER, "-> Deattached surface (%" PRIuWLC ") from output (%" PRIuWLC ")", convert_to_wlc_resource(surface), convert_to_wlc_handle(output));
@@ -483,6 +1580,9 @@ wlc_output_surface_attach(struct wlc_output *output, struct wlc_surface *surface
          return false;
       }
 
+      surface->output_index = output->surfaces.items.count - 1;
+
+      wlc_output_invalidate_scene(output);
       wlc_dlog(WLC_DBG_RENDER, "-> Attached surface (%" PRIuWLC ") to output (%" PRIuWLC ")", r, convert_to_wlc_handle(output));
    }
 
@@ -519,10 +1619,248 @@ wlc_output_schedule_repaint(struct wlc_output *output)
       return;
 
    output->state.scheduled = true;
-   wl_event_source_timer_update(output->timer.idle, 1);
+   wl_event_source_timer_update(output->timer.idle, frame_delay(output));
    wlc_dlog(WLC_DBG_RENDER_LOOP, "-> Repaint scheduled");
 }
 
+void
+wlc_output_schedule_hidden_frame(struct wlc_output *output)
+{
+   if (!output || output->state.hidden_scheduled)
+      return;
+
+   wl_event_source_timer_update(output->timer.hidden, 1000 / wlc_options()->hidden_frame_rate);
+   output->state.hidden_scheduled = true;
+}
+
+void
+wlc_output_damage(struct wlc_output *output, const struct wlc_geometry *geometry)
+{
+   assert(geometry);
+
+   if (!output)
+      return;
+
+   pixman_region32_union_rect(&output->damage.current, &output->damage.current, geometry->origin.x, geometry->origin.y, geometry->size.w, geometry->size.h);
+}
+
+void
+wlc_output_damage_pixels(struct wlc_output *output, const struct wlc_geometry *geometry)
+{
+   assert(geometry);
+
+   if (!output || !output->mode.w || !output->mode.h)
+      return;
+
+   const float sw = (float)output->virtual.w / output->mode.w, sh = (float)output->virtual.h / output->mode.h;
+   const int32_t x1 = floor(geometry->origin.x * sw), y1 = floor(geometry->origin.y * sh);
+   const int32_t x2 = ceil((geometry->origin.x + geometry->size.w) * sw), y2 = ceil((geometry->origin.y + geometry->size.h) * sh);
+   wlc_output_damage(output, &(struct wlc_geometry){ .origin = { x1, y1 }, .size = { x2 - x1, y2 - y1 } });
+}
+
+void
+wlc_output_damage_to_pixels(struct wlc_output *output, pixman_region32_t *damage, pixman_region32_t *out_pixels)
+{
+   assert(output && damage && out_pixels);
+
+   if (!output->virtual.w || !output->virtual.h)
+      return;
+
+   const float sw = (float)output->mode.w / output->virtual.w, sh = (float)output->mode.h / output->virtual.h;
+
+   int nrects;
+   const pixman_box32_t *r = pixman_region32_rectangles(damage, &nrects);
+   for (int i = 0; i < nrects; ++i) {
+      const int32_t x1 = floor(r[i].x1 * sw), y1 = floor(r[i].y1 * sh);
+      const int32_t x2 = ceil(r[i].x2 * sw), y2 = ceil(r[i].y2 * sh);
+      pixman_region32_union_rect(out_pixels, out_pixels, x1, y1, x2 - x1, y2 - y1);
+   }
+}
+
+void
+wlc_output_damage_all(struct wlc_output *output)
+{
+   if (!output)
+      return;
+
+   pixman_region32_union_rect(&output->damage.current, &output->damage.current, 0, 0, output->virtual.w, output->virtual.h);
+}
+
+void
+wlc_output_invalidate_scene(struct wlc_output *output)
+{
+   if (!output)
+      return;
+
+   output->scene.dirty = output->hit.dirty = true;
+}
+
+static void
+hit_extents_recursive(struct wlc_surface *parent, struct wlc_point offset, struct wlc_geometry *extents)
+{
+   assert(parent && extents);
+
+   // Same walk as the pointer's find_surface_at_position_recursive
+   wlc_resource *sub;
+   chck_iter_pool_for_each(&parent->subsurface_list, sub) {
+      struct wlc_surface *subsurface;
+      if (!(subsurface = convert_from_wlc_resource(*sub, "surface")))
+         continue;
+
+      const struct wlc_geometry g = {
+         .origin = {
+            offset.x + (int32_t)(subsurface->commit.subsurface_position.x * parent->coordinate_transform.w),
+            offset.y + (int32_t)(subsurface->commit.subsurface_position.y * parent->coordinate_transform.h)
+         },
+         .size = subsurface->size
+      };
+
+      hit_extents_recursive(subsurface, g.origin, extents);
+      geometry_union(extents, &g);
+   }
+}
+
+static void
+hit_cells(struct wlc_output *output, const struct wlc_geometry *g, uint32_t *out_x1, uint32_t *out_y1, uint32_t *out_x2, uint32_t *out_y2)
+{
+   assert(output && g && out_x1 && out_y1 && out_x2 && out_y2);
+
+   // Cells at the edges extend past the output, so every point has a cell
+   const int32_t x[2] = { g->origin.x, g->origin.x + (int32_t)g->size.w };
+   const int32_t y[2] = { g->origin.y, g->origin.y + (int32_t)g->size.h };
+   *out_x1 = (x[0] < 0 ? 0 : chck_minu32(x[0] / HIT_GRID_CELL, output->hit.cols - 1));
+   *out_x2 = (x[1] < 0 ? 0 : chck_minu32(x[1] / HIT_GRID_CELL, output->hit.cols - 1));
+   *out_y1 = (y[0] < 0 ? 0 : chck_minu32(y[0] / HIT_GRID_CELL, output->hit.rows - 1));
+   *out_y2 = (y[1] < 0 ? 0 : chck_minu32(y[1] / HIT_GRID_CELL, output->hit.rows - 1));
+}
+
+static bool
+build_hit_grid(struct wlc_output *output)
+{
+   assert(output);
+
+   chck_iter_pool_flush(&output->hit.views);
+
+   wlc_handle *h;
+   chck_iter_pool_for_each(stacked_views(output), h) {
+      struct wlc_view *v;
+      struct wlc_surface *s;
+      if (!(v = convert_from_wlc_handle(*h, "view")) || !(s = convert_from_wlc_resource(v->surface, "surface")))
+         continue;
+
+      struct wlc_hit_view entry = { .view = *h, .subsurfaces = (s->subsurface_list.items.count > 0) };
+      wlc_view_get_bounds(v, &entry.extents, NULL);
+      hit_extents_recursive(s, entry.extents.origin, &entry.extents);
+
+      if (!chck_iter_pool_push_back(&output->hit.views, &entry))
+         return false;
+   }
+
+   output->hit.cols = chck_maxu32((output->virtual.w + HIT_GRID_CELL - 1) / HIT_GRID_CELL, 1);
+   output->hit.rows = chck_maxu32((output->virtual.h + HIT_GRID_CELL - 1) / HIT_GRID_CELL, 1);
+   const size_t ncells = output->hit.cols * output->hit.rows;
+
+   if (ncells + 1 > output->hit.cells_allocated) {
+      uint32_t *cells;
+      if (!(cells = chck_realloc_mul_of(output->hit.cells, ncells + 1, sizeof(uint32_t))))
+         return false;
+
+      output->hit.cells = cells;
+      output->hit.cells_allocated = ncells + 1;
+   }
+
+   // Count the views of each cell one cell ahead, so the prefix sums give where each cell starts
+   uint32_t *cells = output->hit.cells;
+   memset(cells, 0, (ncells + 1) * sizeof(uint32_t));
+
+   struct wlc_hit_view *e;
+   chck_iter_pool_for_each(&output->hit.views, e) {
+      uint32_t x1, y1, x2, y2;
+      hit_cells(output, &e->extents, &x1, &y1, &x2, &y2);
+      for (uint32_t y = y1; y <= y2; ++y) {
+         for (uint32_t x = x1; x <= x2; ++x)
+            cells[y * output->hit.cols + x + 1]++;
+      }
+   }
+
+   for (size_t i = 1; i <= ncells; ++i)
+      cells[i] += cells[i - 1];
+
+   if (cells[ncells] > output->hit.allocated) {
+      struct wlc_hit_view *entries;
+      if (!(entries = chck_realloc_mul_of(output->hit.entries, cells[ncells], sizeof(struct wlc_hit_view))))
+         return false;
+
+      output->hit.entries = entries;
+      output->hit.allocated = cells[ncells];
+   }
+
+   // Fill advancing the starts to the ends, then shift them back
+   chck_iter_pool_for_each(&output->hit.views, e) {
+      uint32_t x1, y1, x2, y2;
+      hit_cells(output, &e->extents, &x1, &y1, &x2, &y2);
+      for (uint32_t y = y1; y <= y2; ++y) {
+         for (uint32_t x = x1; x <= x2; ++x)
+            output->hit.entries[cells[y * output->hit.cols + x]++] = *e;
+      }
+   }
+
+   memmove(cells + 1, cells, ncells * sizeof(uint32_t));
+   cells[0] = 0;
+
+   output->hit.serial = ++hit_serial;
+   output->hit.dirty = false;
+   return true;
+}
+
+const struct wlc_hit_view*
+wlc_output_get_views_at(struct wlc_output *output, const struct wlc_point *point, size_t *out_memb, struct wlc_geometry *out_cell)
+{
+   assert(output && point && out_memb);
+   *out_memb = 0;
+
+   if (output->hit.dirty && !build_hit_grid(output))
+      return NULL;
+
+   uint32_t x, y, x2, y2;
+   hit_cells(output, &(struct wlc_geometry){ *point, wlc_size_zero }, &x, &y, &x2, &y2);
+   (void)x2, (void)y2;
+
+   if (out_cell) {
+      // Far enough for any point, near enough that the far edge still fits int32_t
+      const int32_t far = INT32_MAX / 4;
+      const int32_t x1 = (x == 0 ? -far : (int32_t)(x * HIT_GRID_CELL)), y1 = (y == 0 ? -far : (int32_t)(y * HIT_GRID_CELL));
+      const int32_t ex = (x + 1 == output->hit.cols ? far : (int32_t)((x + 1) * HIT_GRID_CELL));
+      const int32_t ey = (y + 1 == output->hit.rows ? far : (int32_t)((y + 1) * HIT_GRID_CELL));
+      *out_cell = (struct wlc_geometry){ .origin = { x1, y1 }, .size = { ex - x1, ey - y1 } };
+   }
+
+   const uint32_t cell = y * output->hit.cols + x;
+   *out_memb = output->hit.cells[cell + 1] - output->hit.cells[cell];
+   return output->hit.entries + output->hit.cells[cell];
+}
+
+void
+wlc_output_surface_commit(struct wlc_output *output, struct wlc_surface *surface)
+{
+   assert(surface);
+
+   if (!output)
+      return;
+
+   // Surfaces committing many times a frame are queued once
+   if (!output->scene.dirty && surface->scene.queued != output->scene.queue) {
+      const wlc_resource r = convert_to_wlc_resource(surface);
+      if (chck_iter_pool_push_back(&output->scene.committed, &r)) {
+         surface->scene.queued = output->scene.queue;
+      } else {
+         output->scene.dirty = true;
+      }
+   }
+
+   wlc_output_schedule_repaint(output);
+}
+
 bool
 wlc_output_set_backend_surface(struct wlc_output *output, struct wlc_backend_surface *bsurface)
 {
@@ -553,6 +1891,8 @@ wlc_output_set_backend_surface(struct wlc_output *output, struct wlc_backend_sur
    if (output->state.created)
       WLC_INTERFACE_EMIT(output.context.destroyed, convert_to_wlc_handle(output));
 
+   // Reads in flight die with the context, queued ones are taken from the next one
+   cancel_reads(output, false);
    wlc_render_release(&output->render, &output->context);
    wlc_context_release(&output->context);
    wlc_backend_surface_release(&output->bsurface);
@@ -585,6 +1925,8 @@ wlc_output_set_backend_surface(struct wlc_output *output, struct wlc_backend_sur
       if (output->state.created)
          WLC_INTERFACE_EMIT(output.context.created, convert_to_wlc_handle(output));
 
+      wlc_output_damage_all(output);
+
       wlc_log(WLC_LOG_INFO, "Set new bsurface to output (%" PRIuWLC ")", convert_to_wlc_handle(output));
    } else {
       wlc_log(WLC_LOG_INFO, "Removed bsurface from output (%" PRIuWLC ")", convert_to_wlc_handle(output));
@@ -660,38 +2002,15 @@ wlc_output_set_information(struct wlc_output *output, struct wlc_output_informat
    //      and commited during start of next render to avoid spurious information updates
 }
 
-static void
-remove_from_pool(struct chck_iter_pool *pool, wlc_handle handle)
-{
-   wlc_handle *h;
-   chck_iter_pool_for_each(pool, h) {
-      if (*h != handle)
-         continue;
-
-      chck_iter_pool_remove(pool, _I - 1);
-      break;
-   }
-}
-
-static bool
-exists_in_pool(struct chck_iter_pool *pool, wlc_handle handle)
-{
-   wlc_handle *h;
-   chck_iter_pool_for_each(pool, h) {
-      if (*h == handle)
-         return true;
-   }
-   return false;
-}
-
 void
 wlc_output_unlink_view(struct wlc_output *output, struct wlc_view *view)
 {
-   if (!output || wlc_view_get_output_ptr(view) != output)
+   if (!output || view->stack.output != convert_to_wlc_handle(output))
       return;
 
-   remove_from_pool(&output->views, convert_to_wlc_handle(view));
-   remove_from_pool(&output->mutable, convert_to_wlc_handle(view));
+   stack_remove(output, view);
+   output->stack.mutable_dirty = true;
+   wlc_output_invalidate_scene(output);
    wlc_output_schedule_repaint(output);
 }
 
@@ -703,47 +2022,56 @@ wlc_output_link_view(struct wlc_output *output, struct wlc_view *view, enum outp
    if (!output)
       return;
 
+   struct wlc_output *from = wlc_view_get_output_ptr(view);
+
    struct wlc_output *old;
-   if ((old = wlc_view_get_output_ptr(view))) {
-      remove_from_pool(&old->views, convert_to_wlc_handle(view));
+   if ((old = convert_from_wlc_handle(view->stack.output, "output"))) {
+      stack_remove(old, view);
       if (old != output)
-         remove_from_pool(&old->mutable, convert_to_wlc_handle(view));
+         old->stack.mutable_dirty = true;
+      wlc_output_invalidate_scene(old);
    }
 
+   // Unlinked views have to be dropped first, the view may still be in the array from before
+   if (old != output)
+      mutable_views(output);
+
    bool added = false;
    wlc_handle handle = convert_to_wlc_handle(view);
 
    if (other) {
-      wlc_handle *h, otherh = convert_to_wlc_handle(other);
-      chck_iter_pool_for_each(&output->views, h) {
-         if (*h != otherh)
-            continue;
-
-         added = chck_iter_pool_insert(&output->views, (link == LINK_ABOVE ? _I : _I - 1), &handle);
-         break;
+      if (other != view && other->stack.output == convert_to_wlc_handle(output)) {
+         if (link == LINK_ABOVE) {
+            stack_insert(output, view, other, convert_from_wlc_handle(other->stack.above, "view"));
+         } else {
+            stack_insert(output, view, convert_from_wlc_handle(other->stack.below, "view"), other);
+         }
+         added = true;
       }
    } else {
       switch (link) {
          case LINK_ABOVE:
-            added = chck_iter_pool_push_back(&output->views, &handle);
+            stack_insert(output, view, convert_from_wlc_handle(output->stack.top, "view"), NULL);
             break;
 
          case LINK_BELOW:
-            added = chck_iter_pool_push_front(&output->views, &handle);
+            stack_insert(output, view, NULL, convert_from_wlc_handle(output->stack.bottom, "view"));
             break;
       }
+      added = true;
    }
 
-   if (!exists_in_pool(&output->mutable, handle))
-      chck_iter_pool_push_back(&output->mutable, &handle);
+   if (added && old != output && !chck_iter_pool_push_back(&output->mutable, &handle))
+      output->stack.mutable_dirty = true;
 
-   if (old != output && view->state.created)
-      WLC_INTERFACE_EMIT(view.move_to_output, convert_to_wlc_handle(view), convert_to_wlc_handle(old), (added ? convert_to_wlc_handle(output) : 0));
+   if (from != output && view->state.created)
+      WLC_INTERFACE_EMIT(view.move_to_output, convert_to_wlc_handle(view), convert_to_wlc_handle(from), (added ? convert_to_wlc_handle(output) : 0));
 
    if (!added)
       return;
 
    attach_view(output, view);
+   wlc_output_invalidate_scene(output);
    wlc_output_schedule_repaint(output);
 }
 
@@ -767,15 +2095,6 @@ wlc_output_set_resolution_ptr(struct wlc_output *output, const struct wlc_size *
    virtual.w /= scale;
    virtual.h /= scale;
 
-   size_t gsz;
-   if (chck_mul_ofsz(virtual.w, virtual.h, &gsz)) {
-      wlc_log(WLC_LOG_WARN, "Requested resolution %ux%u (%ux%u) overflows when multiplied, ignoring resolution", resolution->w, resolution->h, virtual.w, virtual.h);
-      return false;
-   }
-
-   free(output->blit);
-   except(output->blit = calloc(1, gsz));
-
    struct wlc_size old = output->resolution;
    output->resolution = *resolution;
    output->virtual = virtual;
@@ -783,6 +2102,8 @@ wlc_output_set_resolution_ptr(struct wlc_output *output, const struct wlc_size *
 
    output_push_to_resources(output);
    WLC_INTERFACE_EMIT(output.resolution, convert_to_wlc_handle(output), &old, &output->resolution);
+   wlc_output_damage_all(output);
+   wlc_output_invalidate_scene(output);
    wlc_output_schedule_repaint(output);
    return true;
 }
@@ -805,6 +2126,8 @@ wlc_output_set_sleep_ptr(struct wlc_output *output, bool sleep)
       output->bsurface.api.sleep(&output->bsurface, sleep);
 
    if (!(output->state.sleeping = sleep)) {
+      wlc_output_damage_all(output);
+      wlc_output_invalidate_scene(output);
       wlc_output_schedule_repaint(output);
       wlc_log(WLC_LOG_INFO, "Output (%p) wake up", output);
    } else {
@@ -824,19 +2147,48 @@ wlc_output_set_mask_ptr(struct wlc_output *output, uint32_t mask)
       return;
 
    output->active.mask = mask;
+   wlc_output_invalidate_scene(output);
    wlc_output_schedule_repaint(output);
 }
 
+void
+wlc_output_set_render_margin_ptr(struct wlc_output *output, uint32_t margin)
+{
+   if (!output)
+      return;
+
+   output->schedule.margin = margin;
+}
+
 bool
 wlc_output_set_views_ptr(struct wlc_output *output, const wlc_handle *views, size_t memb)
 {
-   if (!output || !chck_iter_pool_set_c_array(&output->views, views, memb) || !chck_iter_pool_set_c_array(&output->mutable, views, memb))
+   if (!output || !chck_iter_pool_set_c_array(&output->mutable, views, memb))
       return false;
 
-   wlc_handle *h;
-   chck_iter_pool_for_each(&output->views, h)
-      attach_view(output, convert_from_wlc_handle(*h, "view"));
+   struct wlc_view *v;
+   while ((v = convert_from_wlc_handle(output->stack.top, "view")))
+      stack_remove(output, v);
+
+   for (size_t i = 0; i < memb; ++i) {
+      if (!(v = convert_from_wlc_handle(views[i], "view")))
+         continue;
+
+      struct wlc_output *old;
+      if ((old = convert_from_wlc_handle(v->stack.output, "output"))) {
+         stack_remove(old, v);
+         old->stack.mutable_dirty = true;
+         wlc_output_invalidate_scene(old);
+      }
+
+      stack_insert(output, v, convert_from_wlc_handle(output->stack.top, "view"), NULL);
+      attach_view(output, v);
+   }
 
+   // Handles of views that don't exist are dropped
+   output->stack.mutable_dirty = true;
+
+   wlc_output_invalidate_scene(output);
    wlc_output_schedule_repaint(output);
    return true;
 }
@@ -847,7 +2199,7 @@ wlc_output_get_views_ptr(struct wlc_output *output, size_t *out_memb)
    if (out_memb)
       *out_memb = 0;
 
-   return (output ? chck_iter_pool_to_c_array(&output->views, out_memb) : NULL);
+   return (output ? chck_iter_pool_to_c_array(stacked_views(output), out_memb) : NULL);
 }
 
 wlc_handle*
@@ -856,7 +2208,7 @@ wlc_output_get_mutable_views_ptr(struct wlc_output *output, size_t *out_memb)
    if (out_memb)
       *out_memb = 0;
 
-   return (output ? chck_iter_pool_to_c_array(&output->mutable, out_memb) : NULL);
+   return (output ? chck_iter_pool_to_c_array(mutable_views(output), out_memb) : NULL);
 }
 
 void
@@ -926,6 +2278,62 @@ wlc_output_set_mask(wlc_handle output, uint32_t mask)
    wlc_output_set_mask_ptr(convert_from_wlc_handle(output, "output"), mask);
 }
 
+WLC_API uint32_t
+wlc_output_get_render_margin(wlc_handle output)
+{
+   void *ptr = get(convert_from_wlc_handle(output, "output"), offsetof(struct wlc_output, schedule.margin));
+   return (ptr ? *(uint32_t*)ptr : 0);
+}
+
+WLC_API void
+wlc_output_set_render_margin(wlc_handle output, uint32_t margin)
+{
+   wlc_output_set_render_margin_ptr(convert_from_wlc_handle(output, "output"), margin);
+}
+
+WLC_API const struct wlc_frame_stats*
+wlc_output_get_frame_stats(wlc_handle output)
+{
+   return get(convert_from_wlc_handle(output, "output"), offsetof(struct wlc_output, stats.frame));
+}
+
+WLC_API void
+wlc_output_reset_frame_stats(wlc_handle output)
+{
+   struct wlc_frame_stats *stats;
+   if ((stats = get(convert_from_wlc_handle(output, "output"), offsetof(struct wlc_output, stats.frame))))
+      memset(stats, 0, sizeof(struct wlc_frame_stats));
+}
+
+bool
+wlc_output_queue_read(struct wlc_output *output, enum wlc_pixel_format format, const struct wlc_geometry *geometry, bool damage_only,
+      void (*done)(wlc_handle output, const struct wlc_geometry *geometry, const struct wlc_geometry *damage, uint64_t time, const void *data, void *arg), void *arg)
+{
+   assert(output && geometry && done);
+   struct pixels_read read = { .geometry = *geometry, .format = format, .done = done, .arg = arg, .damage_only = damage_only };
+   read.readback.slot = -1;
+   return chck_iter_pool_push_back(&output->reads, &read);
+}
+
+WLC_API bool
+wlc_output_read_pixels_async(wlc_handle output, enum wlc_pixel_format format, const struct wlc_geometry *geometry, bool damage_only,
+      void (*done)(wlc_handle output, const struct wlc_geometry *geometry, const struct wlc_geometry *damage, uint64_t time, const void *data, void *arg), void *arg)
+{
+   assert(geometry && done);
+
+   struct wlc_output *o;
+   if (!(o = convert_from_wlc_handle(output, "output")) || !wlc_output_queue_read(o, format, geometry, damage_only, done, arg))
+      return false;
+
+   // Force a frame that covers the geometry
+   if (!damage_only) {
+      wlc_output_damage_pixels(o, geometry);
+      wlc_output_schedule_repaint(o);
+   }
+
+   return true;
+}
+
 WLC_API const wlc_handle*
 wlc_output_get_views(wlc_handle output, size_t *out_memb)
 {
@@ -980,19 +2388,52 @@ wlc_output_release(struct wlc_output *output)
    if (!output)
       return;
 
+   // Frame the thread was painting never reaches the screen
+   if (wlc_render_thread_release(output->paint.thread))
+      output->state.pending = output->state.painting = false;
+
+   output->paint.thread = NULL;
+
+   cancel_reads(output, true);
+
    if (output->timer.idle)
       wl_event_source_remove(output->timer.idle);
 
+   if (output->timer.hidden)
+      wl_event_source_remove(output->timer.hidden);
+
    wlc_output_set_information(output, NULL);
    wlc_output_set_backend_surface(output, NULL);
+   // Views still linked are left without an output
+   struct wlc_view *v;
+   while ((v = convert_from_wlc_handle(output->stack.top, "view")))
+      stack_remove(output, v);
+
    chck_iter_pool_release(&output->surfaces);
    chck_iter_pool_release(&output->views);
    chck_iter_pool_release(&output->mutable);
+   flush_visible(output);
    chck_iter_pool_release(&output->visible);
    chck_iter_pool_release(&output->callbacks);
-
-   free(output->blit);
-   output->blit = NULL;
+   chck_iter_pool_for_each_call(&output->feedbacks, wlc_presentation_feedback_discarded_ptr);
+   chck_iter_pool_release(&output->feedbacks);
+   chck_iter_pool_release(&output->reads);
+   chck_iter_pool_release(&output->damage.scene);
+   chck_iter_pool_release(&output->damage.stage);
+   chck_iter_pool_release(&output->damage.rects);
+   chck_iter_pool_release(&output->scene.surfaces);
+   chck_iter_pool_release(&output->scene.committed);
+   chck_iter_pool_release(&output->hit.views);
+   free(output->hit.entries);
+   free(output->hit.cells);
+   chck_iter_pool_for_each_call(&output->paint.items, wlc_render_item_release);
+   chck_iter_pool_release(&output->paint.items);
+
+   pixman_region32_fini(&output->paint.frame);
+   pixman_region32_fini(&output->paint.region);
+   pixman_region32_fini(&output->damage.current);
+   for (uint32_t i = 0; i < WLC_OUTPUT_DAMAGE_HISTORY; ++i)
+      pixman_region32_fini(&output->damage.history[i]);
 
    if (output->wl.output)
       wl_global_destroy(output->wl.output);
@@ -1005,9 +2446,18 @@ wlc_output(struct wlc_output *output)
 {
    assert(output);
 
+   pixman_region32_init(&output->paint.frame);
+   pixman_region32_init(&output->paint.region);
+   pixman_region32_init(&output->damage.current);
+   for (uint32_t i = 0; i < WLC_OUTPUT_DAMAGE_HISTORY; ++i)
+      pixman_region32_init(&output->damage.history[i]);
+
    if (!(output->timer.idle = wl_event_loop_add_timer(wlc_event_loop(), cb_idle_timer, (void*)convert_to_wlc_handle(output))))
       goto fail;
 
+   if (!(output->timer.hidden = wl_event_loop_add_timer(wlc_event_loop(), cb_hidden_timer, (void*)convert_to_wlc_handle(output))))
+      goto fail;
+
    if (!(output->wl.output = wl_global_create(wlc_display(), &wl_output_interface, 2, output, wl_output_bind)))
       goto fail;
 
@@ -1018,11 +2468,22 @@ wlc_output(struct wlc_output *output)
        !chck_iter_pool(&output->views, 4, 0, sizeof(wlc_handle)) ||
        !chck_iter_pool(&output->mutable, 4, 0, sizeof(wlc_handle)) ||
        !chck_iter_pool(&output->callbacks, 32, 0, sizeof(wlc_resource)) ||
-       !chck_iter_pool(&output->visible, 32, 0, sizeof(struct wlc_view*)))
+       !chck_iter_pool(&output->feedbacks, 32, 0, sizeof(wlc_resource)) ||
+       !chck_iter_pool(&output->reads, 4, 0, sizeof(struct pixels_read)) ||
+       !chck_iter_pool(&output->visible, 32, 0, sizeof(struct visible_view)) ||
+       !chck_iter_pool(&output->damage.scene, 32, 0, sizeof(struct scene_view)) ||
+       !chck_iter_pool(&output->damage.stage, 32, 0, sizeof(struct scene_view)) ||
+       !chck_iter_pool(&output->damage.rects, 32, 0, sizeof(EGLint) * 4) ||
+       !chck_iter_pool(&output->scene.surfaces, 32, 0, sizeof(struct scene_surface)) ||
+       !chck_iter_pool(&output->scene.committed, 32, 0, sizeof(wlc_resource)) ||
+       !chck_iter_pool(&output->hit.views, 32, 0, sizeof(struct wlc_hit_view)) ||
+       !chck_iter_pool(&output->paint.items, 32, 0, sizeof(struct wlc_render_item)))
       goto fail;
 
    output->active.mode = UINT_MAX;
-   output->state.ims = 41;
+   output->schedule.margin = 2000;
+   output->scene.serial = ++scene_serial;
+   output->scene.queue = ++scene_serial;
    output->scale = 1;
 
    wlc_output_set_sleep_ptr(output, false);
@@ -1045,7 +2506,11 @@ wlc_output_render_surface(struct wlc_output *output, struct wlc_surface *surface
    if (!surface->commit.attached)
       return;
 
+   // Usually called from render hooks, which may have changed GL state and expect the surface drawn before they continue
+   wlc_render_invalidate(&output->render, &output->context);
    wlc_render_surface_paint(&output->render, &output->context, surface, geometry);
+   wlc_render_submit(&output->render, &output->context);
+   take_feedbacks(output, surface);
 
    wlc_resource *r;
    chck_iter_pool_for_each(&surface->commit.frame_cbs, r)
@@ -2,6 +2,7 @@
 #define _WLC_OUTPUT_H_
 
 #include <stdint.h>
+#include <pixman.h>
 #include <wayland-util.h>
 #include <chck/string/string.h>
 #include <chck/pool/pool.h>
@@ -12,10 +13,14 @@
 #include "internal.h"
 
 struct wl_global;
+struct wlc_render_thread;
 struct wlc_surface;
 struct wlc_buffer;
 struct timespec;
 
+// Number of previously presented frames we remember damage for (buffer age)
+#define WLC_OUTPUT_DAMAGE_HISTORY 3
+
 enum output_link {
    LINK_BELOW,
    LINK_ABOVE,
@@ -27,6 +32,13 @@ struct wlc_output_mode {
    uint32_t flags; // WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED
 };
 
+// View in the hit-test grid of an output
+struct wlc_hit_view {
+   wlc_handle view;
+   struct wlc_geometry extents; // bounds of the view and its subsurfaces, right and bottom edges included
+   bool subsurfaces;
+};
+
 struct wlc_output_information {
    struct chck_iter_pool modes;
    struct chck_string name, make, model;
@@ -50,16 +62,66 @@ struct wlc_output {
    struct chck_iter_pool surfaces, views, mutable;
    struct chck_iter_pool callbacks, visible;
 
-   // Pixel blit buffer size of current resolution
-   // Used to do visibility checks
-   bool *blit;
+   // Views are stacked bottom to top in a list linked through wlc_view.stack, so restacks are O(1).
+   // views is the array of the list, rebuilt when needed after the stacking changed.
+   // mutable is in link order, views unlinked since are dropped from it when needed.
+   struct {
+      wlc_handle bottom, top;
+      bool views_dirty, mutable_dirty;
+   } stack;
+
+   // Presentation feedbacks of surfaces in the frame being presented
+   struct chck_iter_pool feedbacks;
+
+   // Asynchronous pixel reads, queued until a frame is painted and in flight until delivered
+   struct chck_iter_pool reads;
 
    // Scale of the output
    // Affects virtual resolution by dividing with the scale
    uint32_t scale;
 
+   // Damage in virtual resolution coordinates
+   // current is accumulated for the next frame, history holds damage of presented frames
+   // scene is what we painted last frame, used to detect moved, restacked and removed views
+   struct {
+      pixman_region32_t current;
+      pixman_region32_t history[WLC_OUTPUT_DAMAGE_HISTORY];
+      struct chck_iter_pool scene, stage, rects;
+      uint32_t index;
+   } damage;
+
+   // Retained scene, the visible views with their surface trees flattened in paint order.
+   // Reused between frames until invalidated by restacks, view state, masks or surface tree changes,
+   // meanwhile damage is collected only from the surfaces in committed.
+   // Surfaces remember their index in the scene and whether they are queued in committed, tagged with serial and queue.
+   struct {
+      struct chck_iter_pool surfaces, committed;
+      uint32_t serial, queue;
+      bool dirty;
+   } scene;
+
+   // Uniform grid over the output for hit-testing, each cell lists the views whose extents touch it, bottom to top.
+   // Rebuilt on first query after the scene was invalidated, serial is unique to each build.
+   struct {
+      struct chck_iter_pool views;
+      struct wlc_hit_view *entries;
+      uint32_t *cells; // entries of cell i are cells[i] to cells[i + 1]
+      size_t allocated, cells_allocated;
+      uint32_t cols, rows, serial;
+      bool dirty;
+   } hit;
+
+   // Render thread painting the views off the main loop (WLC_RENDER_THREADS)
+   // frame and region are kept for presenting once the thread is done
+   struct {
+      struct wlc_render_thread *thread;
+      struct chck_iter_pool items;
+      pixman_region32_t frame, region;
+   } paint;
+
    struct {
       struct wl_event_source *idle;
+      struct wl_event_source *hidden;
    } timer;
 
    struct {
@@ -73,10 +135,29 @@ struct wlc_output {
       bool sleep;
    } task;
 
+   // Frame scheduler, predicts next vblank from the flip timestamps and the mode refresh.
+   // Times are CLOCK_MONOTONIC nanoseconds, except margin which is in microseconds.
+   struct {
+      uint64_t target;
+      uint64_t start, cost;
+      uint32_t margin;
+   } schedule;
+
+   // Frame statistics, phase times of the frame in flight are accumulated until it's presented.
+   // Times are CLOCK_MONOTONIC nanoseconds.
+   struct {
+      struct wlc_frame_stats frame;
+      uint64_t phase[WLC_FRAME_PHASE_LAST];
+      uint64_t repaint; // start of repaint to swap
+      uint64_t painting; // submission to render thread
+   } stats;
+
    struct {
-      float ims;
-      uint32_t frame_time;
+      uint64_t frame_time; // CLOCK_MONOTONIC nanoseconds of the last flip
+      uint64_t seq; // vblank counter of the last flip
       bool pending, scheduled, activity, sleeping;
+      bool painting; // render thread is painting the pending frame
+      bool hidden_scheduled;
       bool background_visible;
       bool created;
    } state;
@@ -91,8 +172,30 @@ WLC_NONULL bool wlc_output_information(struct wlc_output_information *info);
 void wlc_output_information_release(struct wlc_output_information *info);
 WLC_NONULL bool wlc_output_information_add_mode(struct wlc_output_information *info, struct wlc_output_mode *mode);
 
-WLC_NONULLV(2) void wlc_output_finish_frame(struct wlc_output *output, const struct timespec *ts);
+WLC_NONULLV(2) void wlc_output_finish_frame(struct wlc_output *output, const struct timespec *ts, uint64_t seq, uint32_t flags);
 void wlc_output_schedule_repaint(struct wlc_output *output);
+void wlc_output_schedule_hidden_frame(struct wlc_output *output);
+WLC_NONULLV(2) void wlc_output_damage(struct wlc_output *output, const struct wlc_geometry *geometry);
+WLC_NONULLV(2) void wlc_output_damage_pixels(struct wlc_output *output, const struct wlc_geometry *geometry);
+
+// Scales damage in virtual resolution to framebuffer pixels, adding it to out_pixels
+WLC_NONULL void wlc_output_damage_to_pixels(struct wlc_output *output, pixman_region32_t *damage, pixman_region32_t *out_pixels);
+
+// Queues a read taken after the next rendered frame, see wlc_output_read_pixels_async.
+// Nothing is damaged, reads queued from WLC_RENDER_EVENT_FRAME are taken from the frame being finished.
+WLC_NONULLV(1,3,5) bool wlc_output_queue_read(struct wlc_output *output, enum wlc_pixel_format format, const struct wlc_geometry *geometry, bool damage_only,
+      void (*done)(wlc_handle output, const struct wlc_geometry *geometry, const struct wlc_geometry *damage, uint64_t time, const void *data, void *arg), void *arg);
+void wlc_output_damage_all(struct wlc_output *output);
+
+// Rebuilds the retained scene on next repaint, for changes in what is visible and where
+void wlc_output_invalidate_scene(struct wlc_output *output);
+
+// Views that may be under the point, bottom to top, valid until the scene changes.
+// The same views are returned for every point in out_cell.
+WLC_NONULLV(1,2,3) const struct wlc_hit_view* wlc_output_get_views_at(struct wlc_output *output, const struct wlc_point *point, size_t *out_memb, struct wlc_geometry *out_cell);
+
+// Collects new content of the surface on next repaint and schedules it
+WLC_NONULLV(2) void wlc_output_surface_commit(struct wlc_output *output, struct wlc_surface *surface);
 WLC_NONULLV(2) bool wlc_output_surface_attach(struct wlc_output *output, struct wlc_surface *surface, struct wlc_buffer *buffer);
 WLC_NONULLV(2) void wlc_output_surface_destroy(struct wlc_output *output, struct wlc_surface *surface);
 bool wlc_output_set_backend_surface(struct wlc_output *output, struct wlc_backend_surface *surface);
@@ -107,6 +210,7 @@ void wlc_output_focus_ptr(struct wlc_output *output);
 void wlc_output_set_sleep_ptr(struct wlc_output *output, bool sleep);
 WLC_NONULLV(2) bool wlc_output_set_resolution_ptr(struct wlc_output *output, const struct wlc_size *resolution, uint32_t scale);
 void wlc_output_set_mask_ptr(struct wlc_output *output, uint32_t mask);
+void wlc_output_set_render_margin_ptr(struct wlc_output *output, uint32_t margin);
 WLC_NONULLV(2) void wlc_output_get_pixels_ptr(struct wlc_output *output, bool (*pixels)(const struct wlc_size *size, uint8_t *rgba, void *arg), void *arg);
 bool wlc_output_set_views_ptr(struct wlc_output *output, const wlc_handle *views, size_t memb);
 const wlc_handle* wlc_output_get_views_ptr(struct wlc_output *output, size_t *out_memb);
@@ -0,0 +1,29 @@
+#ifndef _WLC_PRESENTATION_H_
+#define _WLC_PRESENTATION_H_
+
+#include <stdint.h>
+#include "resources/resources.h"
+
+struct wlc_output;
+
+struct wlc_presentation {
+   struct wlc_source feedbacks;
+
+   struct {
+      struct wl_global *presentation;
+   } wl;
+};
+
+WLC_NONULLV(2) void wlc_presentation_feedback_presented(wlc_resource feedback, struct wlc_output *output, uint64_t time, uint32_t refresh, uint64_t seq, uint32_t flags);
+void wlc_presentation_feedback_discarded(wlc_resource feedback);
+
+static inline void
+wlc_presentation_feedback_discarded_ptr(wlc_resource *feedback)
+{
+   wlc_presentation_feedback_discarded(*feedback);
+}
+
+void wlc_presentation_release(struct wlc_presentation *presentation);
+WLC_NONULL bool wlc_presentation(struct wlc_presentation *presentation);
+
+#endif /* _WLC_PRESENTATION_H_ */
@@ -0,0 +1,374 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pixman.h>
+#include <wayland-server.h>
+#include <chck/math/math.h>
+#include <wlc/wlc-wayland.h>
+#include "wayland-wlc-screencopy-server-protocol.h"
+#include "internal.h"
+#include "macros.h"
+#include "screencopy.h"
+#include "compositor/output.h"
+
+// Sessions accumulate output damage every frame and read back only the damaged extents into the client buffer.
+
+// Sessions live in slabs, so the buffer destroy listener can point into them.
+struct screencopy_session {
+   pixman_region32_t damage; // framebuffer pixels, not copied yet
+   struct wlc_geometry requested, region; // region is requested clamped to the output mode
+   wlc_handle output;
+   struct wl_resource *buffer; // buffer of the copy in progress, NULL if none or destroyed
+   struct wl_listener buffer_destroy;
+   bool copying, queued, inert;
+};
+
+static void
+cb_buffer_destroy(struct wl_listener *listener, void *data)
+{
+   (void)data;
+
+   struct screencopy_session *session;
+   except((session = wl_container_of(listener, session, buffer_destroy)));
+
+   // Copy fails once its read completes
+   wl_list_remove(&listener->link);
+   wl_list_init(&listener->link);
+   session->buffer = NULL;
+}
+
+static void
+session_set_buffer(struct screencopy_session *session, struct wl_resource *buffer)
+{
+   assert(session);
+
+   wl_list_remove(&session->buffer_destroy.link);
+   wl_list_init(&session->buffer_destroy.link);
+
+   if ((session->buffer = buffer))
+      wl_resource_add_destroy_listener(buffer, &session->buffer_destroy);
+}
+
+static bool
+session_constructor(struct screencopy_session *session)
+{
+   assert(session);
+   pixman_region32_init(&session->damage);
+   session->buffer_destroy.notify = cb_buffer_destroy;
+   wl_list_init(&session->buffer_destroy.link);
+   return true;
+}
+
+static void
+session_destructor(struct screencopy_session *session)
+{
+   assert(session);
+   session_set_buffer(session, NULL);
+   pixman_region32_fini(&session->damage);
+}
+
+static void
+session_fail(struct screencopy_session *session, struct wl_resource *resource)
+{
+   assert(session && resource);
+
+   // Failure is final, see the failed event
+   session->copying = false;
+   session->inert = true;
+   session_set_buffer(session, NULL);
+   pixman_region32_clear(&session->damage);
+   wlc_screencopy_session_send_failed(resource);
+}
+
+static void
+session_configure(struct screencopy_session *session, struct wl_resource *resource, struct wlc_output *output)
+{
+   assert(session && resource && output);
+
+   const int32_t x1 = chck_max32(session->requested.origin.x, 0), y1 = chck_max32(session->requested.origin.y, 0);
+   const int32_t x2 = chck_min32(session->requested.origin.x + session->requested.size.w, output->mode.w);
+   const int32_t y2 = chck_min32(session->requested.origin.y + session->requested.size.h, output->mode.h);
+   const struct wlc_geometry region = { .origin = { x1, y1 }, .size = { chck_max32(x2 - x1, 0), chck_max32(y2 - y1, 0) } };
+
+   if (session->region.size.w == region.size.w && session->region.size.h == region.size.h && session->region.origin.x == region.origin.x && session->region.origin.y == region.origin.y)
+      return;
+
+   // Copy in progress, queued or not, was for the old buffer size
+   if (session->copying) {
+      session_fail(session, resource);
+      return;
+   }
+
+   session->region = region;
+   pixman_region32_reset(&session->damage, &(pixman_box32_t){ x1, y1, x1 + region.size.w, y1 + region.size.h });
+   wlc_screencopy_session_send_buffer(resource, WL_SHM_FORMAT_XRGB8888, region.size.w, region.size.h, region.size.w * 4);
+}
+
+static void
+session_force(struct screencopy_session *session, struct wlc_output *output)
+{
+   assert(session && output);
+
+   if (!session->copying || session->queued || !pixman_region32_not_empty(&session->damage))
+      return;
+
+   // Damage the rest has not seen yet, the read is queued once the frame is finished
+   const pixman_box32_t *e = pixman_region32_extents(&session->damage);
+   wlc_output_damage_pixels(output, &(struct wlc_geometry){ .origin = { e->x1, e->y1 }, .size = { e->x2 - e->x1, e->y2 - e->y1 } });
+   wlc_output_schedule_repaint(output);
+}
+
+static void
+cb_read(wlc_handle output, const struct wlc_geometry *geometry, const struct wlc_geometry *damage, uint64_t time, const void *data, void *arg)
+{
+   (void)damage;
+
+   struct screencopy_session *session;
+   const wlc_resource r = (wlc_resource)arg;
+   if (!(session = convert_from_wlc_resource(r, "screencopy-session")))
+      return;
+
+   struct wl_resource *resource = wl_resource_from_wlc_resource(r, "screencopy-session");
+   session->queued = false;
+
+   // Session failed while the read was in flight
+   if (session->inert)
+      return;
+
+   // Buffer size was checked on copy, and a resize fails the copy, so only a destroyed buffer is left to check
+   struct wl_shm_buffer *shm;
+   if (!data || !session->buffer || !(shm = wl_shm_buffer_get(session->buffer))) {
+      session_fail(session, resource);
+      return;
+   }
+
+   // Read covers the damage extents, keep to the region
+   const int32_t x1 = chck_max32(geometry->origin.x, session->region.origin.x), y1 = chck_max32(geometry->origin.y, session->region.origin.y);
+   const int32_t x2 = chck_min32(geometry->origin.x + geometry->size.w, session->region.origin.x + session->region.size.w);
+   const int32_t y2 = chck_min32(geometry->origin.y + geometry->size.h, session->region.origin.y + session->region.size.h);
+
+   if (x2 > x1 && y2 > y1) {
+      // Read rows are bottom to top, shm buffers top to bottom
+      const int32_t stride = wl_shm_buffer_get_stride(shm);
+      wl_shm_buffer_begin_access(shm);
+      uint8_t *dst = wl_shm_buffer_get_data(shm);
+      for (int32_t y = y1; y < y2; ++y) {
+         const uint8_t *src = (const uint8_t*)data + ((size_t)(geometry->origin.y + geometry->size.h - 1 - y) * geometry->size.w + (x1 - geometry->origin.x)) * 4;
+         memcpy(dst + (size_t)(y - session->region.origin.y) * stride + (x1 - session->region.origin.x) * 4, src, (x2 - x1) * 4);
+      }
+      wl_shm_buffer_end_access(shm);
+      wlc_screencopy_session_send_damage(resource, x1 - session->region.origin.x, y1 - session->region.origin.y, x2 - x1, y2 - y1);
+   }
+
+   session->copying = false;
+   session_set_buffer(session, NULL);
+   const uint64_t sec = time / 1000000000;
+   wlc_screencopy_session_send_ready(resource, sec >> 32, sec & 0xffffffff, time % 1000000000);
+}
+
+static void
+session_frame(struct screencopy_session *session, wlc_resource r, struct wlc_output *output, pixman_region32_t *frame)
+{
+   assert(session && output && frame);
+
+   struct wl_resource *resource;
+   if (!(resource = wl_resource_from_wlc_resource(r, "screencopy-session")))
+      return;
+
+   session_configure(session, resource, output);
+
+   if (session->inert)
+      return;
+
+   pixman_region32_t damage;
+   pixman_region32_init(&damage);
+   wlc_output_damage_to_pixels(output, frame, &damage);
+   pixman_region32_intersect_rect(&damage, &damage, session->region.origin.x, session->region.origin.y, session->region.size.w, session->region.size.h);
+   pixman_region32_union(&session->damage, &session->damage, &damage);
+   pixman_region32_fini(&damage);
+
+   if (!session->copying || session->queued || !pixman_region32_not_empty(&session->damage))
+      return;
+
+   const pixman_box32_t *e = pixman_region32_extents(&session->damage);
+   const struct wlc_geometry extents = { .origin = { e->x1, e->y1 }, .size = { e->x2 - e->x1, e->y2 - e->y1 } };
+
+   // Read is issued right after this event, for this frame
+   if (!wlc_output_queue_read(output, WLC_BGRA8888, &extents, false, cb_read, (void*)r)) {
+      session_fail(session, resource);
+      return;
+   }
+
+   session->queued = true;
+   pixman_region32_clear(&session->damage);
+}
+
+static void
+render_event(struct wl_listener *listener, void *data)
+{
+   struct wlc_screencopy *screencopy;
+   except(screencopy = wl_container_of(listener, screencopy, listener.render));
+
+   struct wlc_render_event *ev = data;
+   if (ev->type != WLC_RENDER_EVENT_FRAME)
+      return;
+
+   const wlc_handle output = convert_to_wlc_handle(ev->output);
+
+   struct screencopy_session *s;
+   wlc_slab_for_each(&screencopy->sessions.pool, s) {
+      if (s->inert || s->output != output)
+         continue;
+
+      session_frame(s, convert_to_wlc_resource(s), ev->output, ev->frame);
+   }
+}
+
+static void
+wlc_screencopy_session_cb_copy(struct wl_client *client, struct wl_resource *resource, struct wl_resource *buffer)
+{
+   (void)client;
+
+   struct screencopy_session *session;
+   if (!(session = convert_from_wl_resource(resource, "screencopy-session")))
+      return;
+
+   if (session->copying) {
+      wl_resource_post_error(resource, WLC_SCREENCOPY_SESSION_ERROR_ALREADY_COPYING, "copy requested while a copy is in progress");
+      return;
+   }
+
+   struct wlc_output *output;
+   if (session->inert || !(output = convert_from_wlc_handle(session->output, "output"))) {
+      session_fail(session, resource);
+      return;
+   }
+
+   // Mode may have changed without a frame since
+   session_configure(session, resource, output);
+
+   struct wl_shm_buffer *shm;
+   if (!(shm = wl_shm_buffer_get(buffer)) ||
+       (wl_shm_buffer_get_format(shm) != WL_SHM_FORMAT_XRGB8888 && wl_shm_buffer_get_format(shm) != WL_SHM_FORMAT_ARGB8888) ||
+       (uint32_t)wl_shm_buffer_get_width(shm) != session->region.size.w || (uint32_t)wl_shm_buffer_get_height(shm) != session->region.size.h ||
+       (uint32_t)wl_shm_buffer_get_stride(shm) < session->region.size.w * 4) {
+      wl_resource_post_error(resource, WLC_SCREENCOPY_SESSION_ERROR_INVALID_BUFFER, "buffer doesn't match the buffer event");
+      return;
+   }
+
+   session->copying = true;
+   session_set_buffer(session, buffer);
+   session_force(session, output);
+}
+
+static void
+wlc_screencopy_session_cb_invalidate(struct wl_client *client, struct wl_resource *resource)
+{
+   (void)client;
+
+   struct screencopy_session *session;
+   if (!(session = convert_from_wl_resource(resource, "screencopy-session")) || session->inert)
+      return;
+
+   pixman_region32_reset(&session->damage, &(pixman_box32_t){ session->region.origin.x, session->region.origin.y, session->region.origin.x + session->region.size.w, session->region.origin.y + session->region.size.h });
+
+   struct wlc_output *output;
+   if ((output = convert_from_wlc_handle(session->output, "output")))
+      session_force(session, output);
+}
+
+static const struct wlc_screencopy_session_interface wlc_screencopy_session_implementation = {
+   .destroy = wlc_cb_resource_destructor,
+   .copy = wlc_screencopy_session_cb_copy,
+   .invalidate = wlc_screencopy_session_cb_invalidate,
+};
+
+static void
+wlc_screencopy_manager_cb_capture_output_region(struct wl_client *client, struct wl_resource *resource, uint32_t id, struct wl_resource *output_resource, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+   struct wlc_screencopy *screencopy;
+   if (!(screencopy = wl_resource_get_user_data(resource)))
+      return;
+
+   wlc_resource r;
+   if (!(r = wlc_resource_create(&screencopy->sessions, client, &wlc_screencopy_session_interface, wl_resource_get_version(resource), 1, id)))
+      return;
+
+   wlc_resource_implement(r, &wlc_screencopy_session_implementation, NULL);
+
+   struct screencopy_session *session = convert_from_wlc_resource(r, "screencopy-session");
+   session->output = wlc_handle_from_wl_output_resource(output_resource);
+   session->requested = (struct wlc_geometry){ .origin = { x, y }, .size = { chck_clamp32(width, 0, INT32_MAX - chck_max32(x, 0)), chck_clamp32(height, 0, INT32_MAX - chck_max32(y, 0)) } };
+
+   struct wlc_output *output;
+   if (!(output = convert_from_wlc_handle(session->output, "output"))) {
+      session_fail(session, wl_resource_from_wlc_resource(r, "screencopy-session"));
+      return;
+   }
+
+   // Region starts empty so the first configure always sends the buffer event
+   session->region = (struct wlc_geometry){ .origin = { -1, -1 } };
+   session_configure(session, wl_resource_from_wlc_resource(r, "screencopy-session"), output);
+}
+
+static void
+wlc_screencopy_manager_cb_capture_output(struct wl_client *client, struct wl_resource *resource, uint32_t id, struct wl_resource *output_resource)
+{
+   wlc_screencopy_manager_cb_capture_output_region(client, resource, id, output_resource, 0, 0, INT32_MAX, INT32_MAX);
+}
+
+static const struct wlc_screencopy_manager_interface wlc_screencopy_manager_implementation = {
+   .destroy = wlc_cb_resource_destructor,
+   .capture_output = wlc_screencopy_manager_cb_capture_output,
+   .capture_output_region = wlc_screencopy_manager_cb_capture_output_region,
+};
+
+static void
+wlc_screencopy_manager_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+   struct wl_resource *resource;
+   if (!(resource = wl_resource_create_checked(client, &wlc_screencopy_manager_interface, version, 1, id)))
+      return;
+
+   wl_resource_set_implementation(resource, &wlc_screencopy_manager_implementation, data, NULL);
+}
+
+void
+wlc_screencopy_release(struct wlc_screencopy *screencopy)
+{
+   if (!screencopy)
+      return;
+
+   if (screencopy->listener.render.notify)
+      wl_list_remove(&screencopy->listener.render.link);
+
+   if (screencopy->wl.manager)
+      wl_global_destroy(screencopy->wl.manager);
+
+   wlc_source_release(&screencopy->sessions);
+   memset(screencopy, 0, sizeof(struct wlc_screencopy));
+}
+
+bool
+wlc_screencopy(struct wlc_screencopy *screencopy)
+{
+   assert(screencopy);
+   memset(screencopy, 0, sizeof(struct wlc_screencopy));
+
+   if (!(screencopy->wl.manager = wl_global_create(wlc_display(), &wlc_screencopy_manager_interface, 1, screencopy, wlc_screencopy_manager_bind)))
+      goto screencopy_interface_fail;
+
+   if (!wlc_source(&screencopy->sessions, "screencopy-session", session_constructor, session_destructor, 8, sizeof(struct screencopy_session)))
+      goto fail;
+
+   screencopy->listener.render.notify = render_event;
+   wl_signal_add(&wlc_system_signals()->render, &screencopy->listener.render);
+   return true;
+
+screencopy_interface_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to bind screencopy interface");
+fail:
+   wlc_screencopy_release(screencopy);
+   return false;
+}
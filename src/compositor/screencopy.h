@@ -0,0 +1,23 @@
+#ifndef _WLC_SCREENCOPY_H_
+#define _WLC_SCREENCOPY_H_
+
+#include <stdbool.h>
+#include <wayland-server.h>
+#include "resources/resources.h"
+
+struct wlc_screencopy {
+   struct wlc_source sessions;
+
+   struct {
+      struct wl_listener render;
+   } listener;
+
+   struct {
+      struct wl_global *manager;
+   } wl;
+};
+
+void wlc_screencopy_release(struct wlc_screencopy *screencopy);
+WLC_NONULL bool wlc_screencopy(struct wlc_screencopy *screencopy);
+
+#endif /* _WLC_SCREENCOPY_H_ */
@@ -185,14 +185,14 @@ focus_view(struct wlc_keyboard *keyboard, struct wlc_view *view)
    if (!view || !(surface = wl_resource_from_wlc_resource(view->surface, "surface")))
       return;
 
-   wlc_resource *r;
+   wlc_resource r;
    struct wl_client *client = wl_resource_get_client(surface);
-   chck_pool_for_each(&keyboard->resources.pool, r) {
+   wlc_resource_for_each_for_client(&keyboard->resources, client, r) {
       struct wl_resource *wr;
-      if (!(wr = wl_resource_from_wlc_resource(*r, "keyboard")) || wl_resource_get_client(wr) != client)
+      if (!(wr = wl_resource_from_wlc_resource(r, "keyboard")))
          continue;
 
-      if (!chck_iter_pool_push_back(&keyboard->focused.resources, r))
+      if (!chck_iter_pool_push_back(&keyboard->focused.resources, &r))
          wlc_log(WLC_LOG_WARN, "Failed to push focused keyboard resource to pool (out of memory?)");
 
       {
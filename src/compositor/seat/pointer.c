@@ -116,6 +116,34 @@ find_surface_at_position_recursive(const struct wlc_geometry *point, struct wlc_
    }
 }
 
+static bool
+geometry_intersect(const struct wlc_geometry *a, const struct wlc_geometry *b, struct wlc_geometry *out)
+{
+   assert(a && b && out);
+
+   const int32_t x1 = chck_max32(a->origin.x, b->origin.x), y1 = chck_max32(a->origin.y, b->origin.y);
+   const int32_t x2 = chck_min32(a->origin.x + (int32_t)a->size.w, b->origin.x + (int32_t)b->size.w);
+   const int32_t y2 = chck_min32(a->origin.y + (int32_t)a->size.h, b->origin.y + (int32_t)b->size.h);
+
+   if (x2 <= x1 || y2 <= y1) {
+      *out = wlc_geometry_zero;
+      return false;
+   }
+
+   *out = (struct wlc_geometry){ .origin = { x1, y1 }, .size = { x2 - x1, y2 - y1 } };
+   return true;
+}
+
+static void
+cache_hit(struct wlc_pointer *pointer, struct wlc_output *output, const struct wlc_focused_surface *hit, const struct wlc_geometry *area)
+{
+   assert(pointer && output && hit && area);
+   pointer->hit.surface = *hit;
+   pointer->hit.area = *area;
+   pointer->hit.output = convert_to_wlc_handle(output);
+   pointer->hit.serial = output->hit.serial;
+}
+
 static bool
 surface_under_pointer(struct wlc_pointer *pointer, struct wlc_output *output, struct wlc_focused_surface *out)
 {
@@ -131,10 +159,28 @@ surface_under_pointer(struct wlc_pointer *pointer, struct wlc_output *output, st
       .size = { .w = 1, .h = 1 }
    };
 
-   wlc_handle *h;
-   chck_iter_pool_for_each_reverse(&output->views, h) {
+   // Nothing changed since the last hit-test, and the pointer is still where its result holds
+   if (pointer->hit.output == convert_to_wlc_handle(output) && !output->hit.dirty &&
+       pointer->hit.serial == output->hit.serial && wlc_geometry_contains(&pointer->hit.area, &point)) {
+      *out = pointer->hit.surface;
+      return (out->id != 0);
+   }
+
+   pointer->hit.output = 0;
+
+   size_t memb;
+   struct wlc_geometry cell;
+   const struct wlc_hit_view *views = wlc_output_get_views_at(output, &point.origin, &memb, &cell);
+
+   if (memb == 0) {
+      cache_hit(pointer, output, out, &cell);
+      return false;
+   }
+
+   for (size_t i = memb; i > 0; --i) {
       struct wlc_view *view;
-      if (!(view = convert_from_wlc_handle(*h, "view")) || !view_visible(view, output->active.mask))
+      if (!wlc_geometry_contains(&views[i - 1].extents, &point) ||
+          !(view = convert_from_wlc_handle(views[i - 1].view, "view")) || !view_visible(view, output->active.mask))
          continue;
 
       struct wlc_geometry b, v;
@@ -149,6 +195,19 @@ surface_under_pointer(struct wlc_pointer *pointer, struct wlc_output *output, st
             return true;
          } else if (wlc_geometry_contains(&v, &point)) {
             out->id = view->surface;
+
+            // Result holds within the view, unless subsurfaces or the views above reach there
+            struct wlc_geometry area;
+            if (views[i - 1].subsurfaces || !geometry_intersect(&v, &cell, &area))
+               return true;
+
+            for (size_t j = i; j < memb; ++j) {
+               struct wlc_geometry overlap;
+               if (geometry_intersect(&views[j].extents, &area, &overlap))
+                  return true;
+            }
+
+            cache_hit(pointer, output, out, &area);
             return true;
          }
       }
@@ -157,6 +216,24 @@ surface_under_pointer(struct wlc_pointer *pointer, struct wlc_output *output, st
    return false;
 }
 
+static struct wlc_point
+cursor_position(struct wlc_pointer *pointer, struct wlc_output *output)
+{
+   assert(pointer && output);
+   return (struct wlc_point){
+      chck_clamp(pointer->pos.x, 0, output->resolution.w),
+      chck_clamp(pointer->pos.y, 0, output->resolution.h)
+   };
+}
+
+static bool
+default_cursor_visible(struct wlc_pointer *pointer)
+{
+   assert(pointer);
+   struct wlc_view *view = convert_from_wlc_handle(pointer->focused.view, "view");
+   return (!view || is_x11_view(view)); // focused->x11.id workarounds bug <https://github.com/Cloudef/wlc/issues/21>
+}
+
 static void
 pointer_paint(struct wlc_pointer *pointer, struct wlc_output *output)
 {
@@ -165,12 +242,7 @@ pointer_paint(struct wlc_pointer *pointer, struct wlc_output *output)
    if (!pointer || output != active_output(pointer))
       return;
 
-   const struct wlc_point pos = {
-      chck_clamp(pointer->pos.x, 0, output->resolution.w),
-      chck_clamp(pointer->pos.y, 0, output->resolution.h)
-   };
-
-   struct wlc_view *view = convert_from_wlc_handle(pointer->focused.view, "view");
+   const struct wlc_point pos = cursor_position(pointer, output);
    struct wlc_surface *surface;
 
    if ((surface = convert_from_wlc_resource(pointer->surface, "surface"))) {
@@ -180,12 +252,60 @@ pointer_paint(struct wlc_pointer *pointer, struct wlc_output *output)
       } else {
          wlc_output_render_surface(output, surface, &(struct wlc_geometry){ .origin = { pos.x - pointer->tip.x, pos.y - pointer->tip.y }, surface->size }, &output->callbacks);
       }
-   } else if (!view || is_x11_view(view)) { // focused->x11.id workarounds bug <https://github.com/Cloudef/wlc/issues/21>
+   } else if (default_cursor_visible(pointer)) {
       // Show default cursor when no focus and no surface.
       wlc_render_pointer_paint(&output->render, &output->context, &pos);
    }
 }
 
+static void
+pointer_damage(struct wlc_pointer *pointer, struct wlc_output *output)
+{
+   assert(output);
+
+   if (!pointer)
+      return;
+
+   struct wlc_geometry g = wlc_geometry_zero;
+   struct wlc_surface *surface = NULL;
+
+   if (output == active_output(pointer)) {
+      const struct wlc_point pos = cursor_position(pointer, output);
+      if ((surface = convert_from_wlc_resource(pointer->surface, "surface"))) {
+         g = (struct wlc_geometry){ .origin = { pos.x - pointer->tip.x, pos.y - pointer->tip.y }, .size = surface->size };
+      } else if (default_cursor_visible(pointer)) {
+         g = (struct wlc_geometry){ .origin = pos, .size = { 14, 14 } };
+      }
+   }
+
+   const wlc_handle handle = convert_to_wlc_handle(output);
+   if (pointer->painted.output != handle) {
+      // cursor is not, and was not on this output
+      if (wlc_geometry_equals(&g, &wlc_geometry_zero))
+         return;
+
+      // cursor moved here from another output, clean up the old one
+      struct wlc_output *old;
+      if ((old = convert_from_wlc_handle(pointer->painted.output, "output"))) {
+         wlc_output_damage(old, &pointer->painted.geometry);
+         wlc_output_schedule_repaint(old);
+      }
+
+      wlc_output_damage(output, &g);
+   } else if (!wlc_geometry_equals(&pointer->painted.geometry, &g)) {
+      wlc_output_damage(output, &pointer->painted.geometry);
+      wlc_output_damage(output, &g);
+   }
+
+   if (surface && pixman_region32_not_empty(&surface->commit.damage)) {
+      wlc_output_damage(output, &g);
+      pixman_region32_clear(&surface->commit.damage);
+   }
+
+   pointer->painted.geometry = g;
+   pointer->painted.output = handle;
+}
+
 static void
 render_event(struct wl_listener *listener, void *data)
 {
@@ -198,6 +318,10 @@ render_event(struct wl_listener *listener, void *data)
          pointer_paint(pointer, ev->output);
          break;
 
+      case WLC_RENDER_EVENT_DAMAGE:
+         pointer_damage(pointer, ev->output);
+         break;
+
       default: break;
    }
 }
@@ -240,13 +364,13 @@ focus_view(struct wlc_pointer *pointer, struct wlc_surface *surf, wlc_handle old
       return;
 
    struct wl_client *client = wl_resource_get_client(surface);
-   wlc_resource *r;
-   chck_pool_for_each(&pointer->resources.pool, r) {
+   wlc_resource r;
+   wlc_resource_for_each_for_client(&pointer->resources, client, r) {
       struct wl_resource *wr;
-      if (!(wr = wl_resource_from_wlc_resource(*r, "pointer")) || wl_resource_get_client(wr) != client)
+      if (!(wr = wl_resource_from_wlc_resource(r, "pointer")))
          continue;
 
-      if (!chck_iter_pool_push_back(&pointer->focused.resources, r))
+      if (!chck_iter_pool_push_back(&pointer->focused.resources, &r))
          wlc_log(WLC_LOG_WARN, "Failed to push focused pointer resource to pool (out of memory?)");
 
       uint32_t serial = wl_display_next_serial(wlc_display());
@@ -40,12 +40,26 @@ struct wlc_pointer {
 
    wlc_resource surface;
 
+   // Where the cursor was painted last, used for damage tracking
+   struct {
+      struct wlc_geometry geometry;
+      wlc_handle output;
+   } painted;
+
    struct {
       struct chck_iter_pool resources;
       struct wlc_focused_surface surface;
       wlc_handle view;
    } focused;
 
+   // Last hit-test, and the area where it holds until the output's hit-test grid is rebuilt
+   struct {
+      struct wlc_focused_surface surface;
+      struct wlc_geometry area;
+      wlc_handle output;
+      uint32_t serial;
+   } hit;
+
    struct {
       struct wl_listener render;
    } listener;
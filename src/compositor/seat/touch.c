@@ -34,10 +34,11 @@ view_under_touch(const struct wlc_point *pos, struct wlc_output *output)
    if (!output)
       return NULL;
 
-   wlc_handle *h;
-   chck_iter_pool_for_each_reverse(&output->views, h) {
+   size_t memb;
+   const struct wlc_hit_view *views = wlc_output_get_views_at(output, pos, &memb, NULL);
+   for (size_t i = memb; i > 0; --i) {
       struct wlc_view *view;
-      if (!(view = convert_from_wlc_handle(*h, "view")) || !view_visible(view, output->active.mask))
+      if (!(view = convert_from_wlc_handle(views[i - 1].view, "view")) || !view_visible(view, output->active.mask))
          continue;
 
       struct wlc_geometry b;
@@ -65,10 +66,10 @@ wlc_touch_touch(struct wlc_touch *touch, uint32_t time, enum wlc_touch_type type
    if (!(surface = wl_resource_from_wlc_resource(focused->surface, "surface")) || !(client = wl_resource_get_client(surface)))
       return;
 
-   wlc_resource *r;
-   chck_pool_for_each(&touch->resources.pool, r) {
+   wlc_resource r;
+   wlc_resource_for_each_for_client(&touch->resources, client, r) {
       struct wl_resource *wr;
-      if (!(wr = wl_resource_from_wlc_resource(*r, "touch")) || wl_resource_get_client(wr) != client)
+      if (!(wr = wl_resource_from_wlc_resource(r, "touch")))
          continue;
 
       switch (type) {
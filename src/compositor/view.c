@@ -62,6 +62,9 @@ wlc_view_update(struct wlc_view *view)
 {
    assert(view);
 
+   // Mask and parent are not part of the pending state, but change what is visible
+   wlc_output_invalidate_scene(wlc_view_get_output_ptr(view));
+
    if (!memcmp(&view->pending, &view->commit, sizeof(view->commit)))
       return;
 
@@ -86,7 +89,7 @@ wlc_view_unmap(struct wlc_view *view)
 {
    assert(view);
 
-   wlc_output_unlink_view(wlc_view_get_output_ptr(view), view);
+   wlc_output_unlink_view(convert_from_wlc_handle(view->stack.output, "output"), view);
 
    if (!view->state.created)
       return;
@@ -178,6 +181,9 @@ wlc_view_ack_surface_attach(struct wlc_view *view, struct wlc_surface *surface)
       wlc_view_request_geometry(view, &g);
    }
 
+   if (!wlc_geometry_equals(&view->surface_pending.visible, &view->surface_commit.visible))
+      wlc_output_invalidate_scene(wlc_view_get_output_ptr(view));
+
    view->surface_commit = view->surface_pending;
 }
 
@@ -254,6 +260,16 @@ wlc_view_get_opaque(struct wlc_view *view, struct wlc_geometry *out_opaque)
    return wlc_surface_get_opaque(convert_from_wlc_resource(view->surface, "surface"), &v.origin, out_opaque);
 }
 
+void
+wlc_view_get_opaque_region(struct wlc_view *view, pixman_region32_t *out_opaque)
+{
+   assert(view && out_opaque);
+
+   struct wlc_geometry b, v;
+   wlc_view_get_bounds(view, &b, &v);
+   wlc_surface_get_opaque_region(convert_from_wlc_resource(view->surface, "surface"), &v.origin, out_opaque);
+}
+
 void
 wlc_view_get_input(struct wlc_view *view, struct wlc_geometry *out_input)
 {
@@ -279,6 +295,7 @@ wlc_view_request_geometry(struct wlc_view *view, const struct wlc_geometry *r)
       WLC_INTERFACE_EMIT(view.request.geometry, convert_to_wlc_handle(view), r);
    } else {
       memcpy(&view->pending.geometry, r, sizeof(view->pending.geometry));
+      wlc_output_invalidate_scene(wlc_view_get_output_ptr(view));
    }
 
    configure_view(view, view->pending.edges, &view->pending.geometry);
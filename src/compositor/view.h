@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <sys/types.h>
+#include <pixman.h>
 #include <wlc/geometry.h>
 #include <wayland-util.h>
 #include <chck/pool/pool.h>
@@ -57,8 +58,17 @@ struct wlc_view {
    uint32_t type;
    uint32_t mask;
 
+   // Links in the stacking list of the output the view is linked to, see wlc_output.stack
+   struct {
+      wlc_handle output, below, above;
+   } stack;
+
    struct {
       bool created;
+
+      // Masked out or fully occluded on its output
+      // Commits won't schedule repaints, frame callbacks are throttled instead
+      bool hidden;
    } state;
 };
 
@@ -75,6 +85,7 @@ WLC_NONULL void wlc_view_commit_state(struct wlc_view *view, struct wlc_view_sta
 WLC_NONULL void wlc_view_ack_surface_attach(struct wlc_view *view, struct wlc_surface *surface);
 WLC_NONULLV(1,2) void wlc_view_get_bounds(struct wlc_view *view, struct wlc_geometry *out_bounds, struct wlc_geometry *out_visible);
 WLC_NONULL bool wlc_view_get_opaque(struct wlc_view *view, struct wlc_geometry *out_opaque);
+WLC_NONULL void wlc_view_get_opaque_region(struct wlc_view *view, pixman_region32_t *out_opaque);
 WLC_NONULL void wlc_view_get_input(struct wlc_view *view, struct wlc_geometry *out_input);
 WLC_NONULL bool wlc_view_request_geometry(struct wlc_view *view, const struct wlc_geometry *r);
 bool wlc_view_request_state(struct wlc_view *view, enum wlc_view_state_bit state, bool toggle);
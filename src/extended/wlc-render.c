@@ -49,6 +49,8 @@ wlc_output_schedule_render(wlc_handle output)
    if (!(o = convert_from_wlc_handle(output, "output")))
       return;
 
+   // We don't know what the compositor wants to draw, repaint everything
+   wlc_output_damage_all(o);
    wlc_output_schedule_repaint(o);
 }
 
@@ -62,6 +64,12 @@ wlc_output_get_renderer(wlc_handle output)
    return o->render.api.renderer_type;
 }
 
+WLC_API void
+wlc_set_renderer(enum wlc_renderer renderer)
+{
+   wlc_render_set_preferred(renderer);
+}
+
 WLC_API bool
 wlc_surface_get_textures(wlc_resource surface, uint32_t out_textures[], enum wlc_surface_format *out_format)
 {
@@ -102,6 +110,8 @@ wlc_surface_flush_frame_callbacks(wlc_resource surface)
    surface_flush_frame_callbacks_recursive(surf, output);
 
    struct wlc_view *v;
-   if ((v = convert_from_wlc_handle(surf->parent_view, "view")))
+   if ((v = convert_from_wlc_handle(surf->parent_view, "view"))) {
       wlc_view_commit_state(v, &v->pending, &v->commit);
+      wlc_output_invalidate_scene(output);
+   }
 }
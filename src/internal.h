@@ -302,10 +302,13 @@ struct wlc_output_event {
 
 enum wlc_render_event_type {
    WLC_RENDER_EVENT_POINTER,
+   WLC_RENDER_EVENT_DAMAGE, // emitted before composition, add damage with wlc_output_damage
+   WLC_RENDER_EVENT_FRAME, // emitted after composition, frame is the damage of the frame
 };
 
 struct wlc_render_event {
    struct wlc_output *output;
+   struct pixman_region32 *frame; // WLC_RENDER_EVENT_FRAME, virtual resolution
    enum wlc_render_event_type type;
 };
 
@@ -324,6 +327,17 @@ struct wlc_system_signals {
 /** Pointer to the system signals */
 struct wlc_system_signals* wlc_system_signals(void);
 
+/** Options read from the environment in wlc_init */
+struct wlc_options {
+   uint32_t hidden_frame_rate; // WLC_HIDDEN_FRAME_RATE, frame callback rate of masked out or occluded views
+   bool damage_tracking; // WLC_DAMAGE_TRACKING, repaint only damaged areas of outputs
+   bool render_threads; // WLC_RENDER_THREADS, paint views on per-output render threads if the renderer supports it
+   bool retained_scene; // WLC_RETAINED_SCENE, reuse the visible views between frames until something changes them
+};
+
+/** Pointer to the options */
+struct wlc_options* wlc_options(void);
+
 /** Types of debug for  wlc_dlog */
 enum wlc_debug {
    WLC_DBG_HANDLE,
@@ -4,6 +4,7 @@
 #include "internal.h"
 #include "backend.h"
 #include "drm.h"
+#include "headless.h"
 
 #ifdef ENABLE_X11_BACKEND
 #  include "x11.h"
@@ -39,7 +40,7 @@ wlc_backend_surface_release(struct wlc_backend_surface *surface)
 }
 
 uint32_t
-wlc_backend_update_outputs(struct wlc_backend *backend, struct chck_pool *outputs)
+wlc_backend_update_outputs(struct wlc_backend *backend, struct wlc_slab *outputs)
 {
    assert(backend);
 
@@ -67,6 +68,14 @@ wlc_backend(struct wlc_backend *backend)
    assert(backend);
    memset(backend, 0, sizeof(struct wlc_backend));
 
+   if (wlc_headless_requested()) {
+      if (!wlc_headless(backend))
+         goto fail;
+
+      backend->type = WLC_BACKEND_HEADLESS;
+      return true;
+   }
+
    bool (*init[])(struct wlc_backend*) = {
 #ifdef ENABLE_X11_BACKEND
       wlc_x11,
@@ -89,6 +98,7 @@ wlc_backend(struct wlc_backend *backend)
       }
    }
 
+fail:
    wlc_log(WLC_LOG_WARN, "Could not initialize any backend");
    return false;
 }
@@ -5,7 +5,7 @@
 #include <stdbool.h>
 #include "EGL/egl.h"
 
-struct chck_pool;
+struct wlc_slab;
 
 struct wlc_backend_surface {
    void *internal;
@@ -13,6 +13,9 @@ struct wlc_backend_surface {
    EGLNativeDisplayType display;
    EGLNativeWindowType window;
 
+   // Size of the offscreen surface used when there is no window
+   struct wlc_size size;
+
    struct {
       WLC_NONULL void (*terminate)(struct wlc_backend_surface *surface);
       WLC_NONULL void (*sleep)(struct wlc_backend_surface *surface, bool sleep);
@@ -24,7 +27,7 @@ struct wlc_backend {
    enum wlc_backend_type type;
 
    struct {
-      WLC_NONULL uint32_t (*update_outputs)(struct chck_pool *outputs);
+      WLC_NONULL uint32_t (*update_outputs)(struct wlc_slab *outputs);
       void (*terminate)(void);
    } api;
 };
@@ -32,7 +35,7 @@ struct wlc_backend {
 WLC_NONULL bool wlc_backend_surface(struct wlc_backend_surface *surface, void (*destructor)(struct wlc_backend_surface*), size_t internal_size);
 void wlc_backend_surface_release(struct wlc_backend_surface *surface);
 
-WLC_NONULL uint32_t wlc_backend_update_outputs(struct wlc_backend *backend, struct chck_pool *outputs);
+WLC_NONULL uint32_t wlc_backend_update_outputs(struct wlc_backend *backend, struct wlc_slab *outputs);
 void wlc_backend_release(struct wlc_backend *backend);
 WLC_NONULL bool wlc_backend(struct wlc_backend *backend);
 
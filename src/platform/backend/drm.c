@@ -11,6 +11,7 @@
 #include <dlfcn.h>
 #include <wayland-server.h>
 #include <wayland-util.h>
+#include "wayland-presentation-time-server-protocol.h"
 #include "internal.h"
 #include "macros.h"
 #include "drm.h"
@@ -77,7 +78,7 @@ static void
 page_flip_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *data)
 {
    assert(data);
-   (void)fd, (void)frame;
+   (void)fd;
    struct wlc_backend_surface *bsurface = data;
    struct drm_surface *dsurface = bsurface->internal;
 
@@ -90,7 +91,7 @@ page_flip_handler(int fd, unsigned int frame, unsigned int sec, unsigned int use
    ts.tv_nsec = usec * 1000;
 
    struct wlc_output *o;
-   wlc_output_finish_frame(wl_container_of(bsurface, o, bsurface), &ts);
+   wlc_output_finish_frame(wl_container_of(bsurface, o, bsurface), &ts, frame, WP_PRESENTATION_FEEDBACK_KIND_VSYNC | WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK | WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION);
    dsurface->flipping = false;
 }
 
@@ -407,11 +408,11 @@ terminate(void)
 }
 
 static bool
-output_exists_for_connector(struct chck_pool *outputs, drmModeConnector *connector)
+output_exists_for_connector(struct wlc_slab *outputs, drmModeConnector *connector)
 {
    assert(outputs && connector);
    struct wlc_output *o;
-   chck_pool_for_each(outputs, o) {
+   wlc_slab_for_each(outputs, o) {
       struct drm_surface *dsurface = o->bsurface.internal;
       if (dsurface && dsurface->connector->connector_id == connector->connector_id)
          return true;
@@ -432,7 +433,7 @@ info_exists_for_drm_surface(struct chck_iter_pool *infos, struct drm_surface *ds
 }
 
 static uint32_t
-update_outputs(struct chck_pool *outputs)
+update_outputs(struct wlc_slab *outputs)
 {
    struct chck_iter_pool infos;
    if (!chck_iter_pool(&infos, 4, 0, sizeof(struct drm_output_information)) || !query_drm(drm.fd, &infos))
@@ -440,7 +441,7 @@ update_outputs(struct chck_pool *outputs)
 
    if (outputs) {
       struct wlc_output *o;
-      chck_pool_for_each(outputs, o) {
+      wlc_slab_for_each(outputs, o) {
          struct drm_surface *dsurface;
          if (!(dsurface = o->bsurface.internal))
             continue;
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <chck/math/math.h>
+#include <chck/string/string.h>
+#include <wayland-server.h>
+#include <wayland-util.h>
+#include "wayland-presentation-time-server-protocol.h"
+#include "internal.h"
+#include "macros.h"
+#include "headless.h"
+#include "backend.h"
+#include "compositor/compositor.h"
+#include "compositor/output.h"
+
+// Virtual outputs without any display hardware.
+// Rendering goes to offscreen EGL surfaces and flips complete from a timerfd at the mode refresh.
+
+struct headless_surface {
+   struct wlc_backend_surface *bsurface;
+   struct wl_event_source *event_source;
+   uint64_t epoch, period, next, seq;
+   int fd;
+};
+
+static struct {
+   struct wlc_backend *backend;
+
+   struct {
+      struct wlc_size resolution;
+      uint32_t refresh; // mHz
+   } mode;
+} headless;
+
+// Outputs only use the display as identity, offscreen contexts always use EGL_DEFAULT_DISPLAY
+#define HEADLESS_DISPLAY ((EGLNativeDisplayType)&headless)
+
+static uint64_t
+get_time_ns(void)
+{
+   struct timespec ts;
+   wlc_get_time(&ts);
+   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+timer_event(int fd, uint32_t mask, void *data)
+{
+   (void)mask;
+   struct headless_surface *hsurface = data;
+
+   uint64_t expirations;
+   if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations) || !hsurface->bsurface)
+      return 0;
+
+   struct timespec ts;
+   ts.tv_sec = hsurface->next / 1000000000;
+   ts.tv_nsec = hsurface->next % 1000000000;
+
+   struct wlc_backend_surface *bsurface = hsurface->bsurface;
+   hsurface->bsurface = NULL;
+
+   struct wlc_output *o;
+   wlc_output_finish_frame(wl_container_of(bsurface, o, bsurface), &ts, hsurface->seq, WP_PRESENTATION_FEEDBACK_KIND_VSYNC);
+   return 0;
+}
+
+static bool
+page_flip(struct wlc_backend_surface *bsurface)
+{
+   struct headless_surface *hsurface = bsurface->internal;
+   assert(hsurface);
+
+   // Complete on the first virtual vblank after now
+   const uint64_t now = get_time_ns();
+   if (!hsurface->epoch)
+      hsurface->epoch = now;
+
+   hsurface->seq = (now - hsurface->epoch) / hsurface->period + 1;
+   hsurface->next = hsurface->epoch + hsurface->seq * hsurface->period;
+
+   struct itimerspec its;
+   memset(&its, 0, sizeof(its));
+   its.it_value.tv_sec = hsurface->next / 1000000000;
+   its.it_value.tv_nsec = hsurface->next % 1000000000;
+
+   if (timerfd_settime(hsurface->fd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+      wlc_log(WLC_LOG_WARN, "Failed to arm headless frame timer");
+      return false;
+   }
+
+   hsurface->bsurface = bsurface;
+   return true;
+}
+
+static void
+surface_release(struct wlc_backend_surface *bsurface)
+{
+   struct headless_surface *hsurface = bsurface->internal;
+
+   if (hsurface->event_source)
+      wl_event_source_remove(hsurface->event_source);
+
+   if (hsurface->fd >= 0)
+      close(hsurface->fd);
+}
+
+static bool
+add_output(struct wlc_output_information *info)
+{
+   struct wlc_backend_surface bsurface;
+   if (!wlc_backend_surface(&bsurface, surface_release, sizeof(struct headless_surface)))
+      return false;
+
+   struct headless_surface *hsurface = bsurface.internal;
+   hsurface->period = 1000000000000 / headless.mode.refresh;
+
+   if ((hsurface->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) < 0)
+      goto timer_fail;
+
+   if (!(hsurface->event_source = wl_event_loop_add_fd(wlc_event_loop(), hsurface->fd, WL_EVENT_READABLE, timer_event, hsurface)))
+      goto timer_fail;
+
+   bsurface.display = HEADLESS_DISPLAY;
+   bsurface.size = headless.mode.resolution;
+   bsurface.api.page_flip = page_flip;
+
+   struct wlc_output_event ev = { .add = { &bsurface, info }, .type = WLC_OUTPUT_EVENT_ADD };
+   wl_signal_emit(&wlc_system_signals()->output, &ev);
+   return true;
+
+timer_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to create headless frame timer");
+   wlc_backend_surface_release(&bsurface);
+   return false;
+}
+
+static void
+fake_information(struct wlc_output_information *info, uint32_t id)
+{
+   assert(info);
+   wlc_output_information(info);
+   chck_string_set_cstr(&info->make, "wlc", false);
+   chck_string_set_cstr(&info->model, "Headless", false);
+   info->connector = WLC_CONNECTOR_WLC;
+   info->connector_id = id;
+
+   struct wlc_output_mode mode = {0};
+   mode.refresh = headless.mode.refresh;
+   mode.width = headless.mode.resolution.w;
+   mode.height = headless.mode.resolution.h;
+   mode.flags = WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
+   wlc_output_information_add_mode(info, &mode);
+}
+
+static uint32_t
+update_outputs(struct wlc_slab *outputs)
+{
+   uint32_t alive = 0;
+   if (outputs) {
+      struct wlc_output *o;
+      wlc_slab_for_each(outputs, o) {
+         if (o->bsurface.display == HEADLESS_DISPLAY)
+            ++alive;
+      }
+   }
+
+   const char *env;
+   uint32_t fakes = 1;
+   if ((env = getenv("WLC_OUTPUTS"))) {
+      chck_cstr_to_u32(env, &fakes);
+      fakes = chck_maxu32(fakes, 1);
+   }
+
+   uint32_t count = 0;
+   for (uint32_t i = alive; i < fakes; ++i) {
+      struct wlc_output_information info;
+      fake_information(&info, 1 + i);
+      count += (add_output(&info) ? 1 : 0);
+   }
+
+   return count;
+}
+
+static void
+terminate(void)
+{
+   memset(&headless, 0, sizeof(headless));
+}
+
+bool
+wlc_headless_requested(void)
+{
+   const char *env = getenv("WLC_BACKEND");
+   return (env && chck_cstreq(env, "headless"));
+}
+
+bool
+wlc_headless(struct wlc_backend *backend)
+{
+   headless.backend = backend;
+   headless.mode.resolution = (struct wlc_size){ 800, 480 };
+   headless.mode.refresh = 60 * 1000; // mHz
+
+   const char *env;
+   if ((env = getenv("WLC_HEADLESS_RESOLUTION"))) {
+      uint32_t w, h;
+      if (sscanf(env, "%ux%u", &w, &h) == 2 && w > 0 && h > 0) {
+         headless.mode.resolution = (struct wlc_size){ w, h };
+      } else {
+         wlc_log(WLC_LOG_WARN, "Invalid WLC_HEADLESS_RESOLUTION '%s', expected WIDTHxHEIGHT", env);
+      }
+   }
+
+   if ((env = getenv("WLC_HEADLESS_REFRESH"))) {
+      uint32_t hz = 60;
+      chck_cstr_to_u32(env, &hz);
+      headless.mode.refresh = chck_clampu32(hz, 1, 1000) * 1000;
+   }
+
+   backend->api.update_outputs = update_outputs;
+   backend->api.terminate = terminate;
+   return true;
+}
@@ -0,0 +1,11 @@
+#ifndef _WLC_HEADLESS_H_
+#define _WLC_HEADLESS_H_
+
+#include <stdbool.h>
+
+struct wlc_backend;
+
+bool wlc_headless_requested(void);
+bool wlc_headless(struct wlc_backend *backend);
+
+#endif /* _WLC_HEADLESS_H_ */
@@ -4,6 +4,8 @@
 #include "internal.h"
 #include "context.h"
 #include "egl.h"
+#include "memory.h"
+#include "platform/render/render.h"
 
 void*
 wlc_context_get_proc_address(struct wlc_context *context, const char *procname)
@@ -49,6 +51,17 @@ wlc_context_destroy_image(struct wlc_context *context, EGLImageKHR image)
    return context->api.destroy_image(context->context, image);
 }
 
+pixman_image_t*
+wlc_context_get_framebuffer(struct wlc_context *context)
+{
+   assert(context);
+
+   if (!context->api.get_framebuffer)
+      return NULL;
+
+   return context->api.get_framebuffer(context->context);
+}
+
 bool
 wlc_context_bind(struct wlc_context *context)
 {
@@ -76,12 +89,23 @@ wlc_context_bind_to_wl_display(struct wlc_context *context, struct wl_display *d
 }
 
 void
-wlc_context_swap(struct wlc_context *context, struct wlc_backend_surface *bsurface)
+wlc_context_swap(struct wlc_context *context, struct wlc_backend_surface *bsurface, const EGLint *rects, EGLint nrects)
 {
    assert(context);
 
    if (context->api.swap)
-      context->api.swap(context->context, bsurface);
+      context->api.swap(context->context, bsurface, rects, nrects);
+}
+
+uint32_t
+wlc_context_buffer_age(struct wlc_context *context)
+{
+   assert(context);
+
+   if (!context->api.buffer_age)
+      return 0;
+
+   return context->api.buffer_age(context->context);
 }
 
 void
@@ -104,9 +128,16 @@ wlc_context(struct wlc_context *context, struct wlc_backend_surface *surface)
 
    void* (*constructor[])(struct wlc_backend_surface*, struct wlc_context_api*) = {
       wlc_egl,
+      wlc_memory,
       NULL
    };
 
+   // Pixman renders into memory, so try that first when it's preferred
+   if (wlc_render_get_preferred() == WLC_RENDERER_PIXMAN) {
+      constructor[0] = wlc_memory;
+      constructor[1] = wlc_egl;
+   }
+
    for (uint32_t i = 0; constructor[i]; ++i) {
       if ((context->context = constructor[i](surface, &context->api)))
          return true;
@@ -14,6 +14,10 @@
 #include "compositor/output.h"
 #include "platform/backend/backend.h"
 
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#  define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
 struct ctx {
    const char *extensions;
    struct wl_display *wl_display;
@@ -22,6 +26,7 @@ struct ctx {
    EGLSurface surface;
    EGLConfig config;
    bool flip_failed;
+   bool buffer_age;
 
    struct {
       // Needed for EGL hw surfaces
@@ -148,6 +153,27 @@ terminate(struct ctx *context)
    free(context);
 }
 
+static EGLDisplay
+get_display(struct ctx *context, struct wlc_backend_surface *bsurface)
+{
+   assert(context && bsurface);
+
+   if (bsurface->window)
+      return eglGetDisplay(bsurface->display);
+
+   // No window, render offscreen. Prefer surfaceless platform so we don't need X11 or a GPU.
+   context->extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+   if (has_extension(context, "EGL_MESA_platform_surfaceless") && has_extension(context, "EGL_EXT_platform_base")) {
+      PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (void*)eglGetProcAddress("eglGetPlatformDisplayEXT");
+      EGLDisplay display;
+      if (get_platform_display && (display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL)))
+         return display;
+   }
+
+   return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
 static struct ctx*
 create_context(struct wlc_backend_surface *bsurface)
 {
@@ -157,7 +183,7 @@ create_context(struct wlc_backend_surface *bsurface)
    if (!(context = calloc(1, sizeof(struct ctx))))
       return NULL;
 
-   if (!(context->display = eglGetDisplay(bsurface->display)))
+   if (!(context->display = get_display(context, bsurface)))
       goto egl_fail;
 
    EGLint major, minor;
@@ -172,7 +198,7 @@ create_context(struct wlc_backend_surface *bsurface)
    } configs[] = {
       {
          (const EGLint[]){
-            EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+            EGL_SURFACE_TYPE, (bsurface->window ? EGL_WINDOW_BIT : EGL_PBUFFER_BIT),
             EGL_RED_SIZE, 1,
             EGL_GREEN_SIZE, 1,
             EGL_BLUE_SIZE, 1,
@@ -203,8 +229,19 @@ create_context(struct wlc_backend_surface *bsurface)
    if ((context->context = eglCreateContext(context->display, context->config, EGL_NO_CONTEXT, context_attribs)) == EGL_NO_CONTEXT)
       goto egl_fail;
 
-   if ((context->surface = eglCreateWindowSurface(context->display, context->config, bsurface->window, NULL)) == EGL_NO_SURFACE)
-      goto egl_fail;
+   if (bsurface->window) {
+      if ((context->surface = eglCreateWindowSurface(context->display, context->config, bsurface->window, NULL)) == EGL_NO_SURFACE)
+         goto egl_fail;
+   } else {
+      const EGLint pbuffer_attribs[] = {
+         EGL_WIDTH, bsurface->size.w,
+         EGL_HEIGHT, bsurface->size.h,
+         EGL_NONE
+      };
+
+      if ((context->surface = eglCreatePbufferSurface(context->display, context->config, pbuffer_attribs)) == EGL_NO_SURFACE)
+         goto egl_fail;
+   }
 
    if (!eglMakeCurrent(context->display, context->surface, context->surface, context->context))
       goto egl_fail;
@@ -259,12 +296,16 @@ create_context(struct wlc_backend_surface *bsurface)
       context->api.eglQueryWaylandBufferWL = (void*)eglGetProcAddress("eglQueryWaylandBufferWL");
    }
 
-   if (has_extension(context, "EGL_EXT_swap_buffers_with_damage")) {
-      // FIXME: get hw that supports this feature
-      context->api.eglSwapBuffersWithDamage = (void*)eglGetProcAddress("eglSwapBuffersWithDamage");
+   if (has_extension(context, "EGL_KHR_swap_buffers_with_damage")) {
+      context->api.eglSwapBuffersWithDamage = (void*)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+   } else if (has_extension(context, "EGL_EXT_swap_buffers_with_damage")) {
+      context->api.eglSwapBuffersWithDamage = (void*)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+   }
+
+   if (has_extension(context, "EGL_EXT_buffer_age")) {
+      context->buffer_age = true;
    } else {
-      // FIXME: get hw that supports this feature
-      // wlc_log(WLC_LOG_WARN, "EGL_EXT_swap_buffers_with_damage not supported. Performance could be affected.");
+      wlc_log(WLC_LOG_INFO, "EGL_EXT_buffer_age not supported, every frame will be repainted fully");
    }
 
    EGL_CALL(eglSwapInterval(context->display, 1));
@@ -316,7 +357,7 @@ bind_to_wl_display(struct ctx *context, struct wl_display *wl_display)
 }
 
 static void
-swap(struct ctx *context, struct wlc_backend_surface *bsurface)
+swap(struct ctx *context, struct wlc_backend_surface *bsurface, const EGLint *rects, EGLint nrects)
 {
    assert(context);
 
@@ -327,13 +368,33 @@ swap(struct ctx *context, struct wlc_backend_surface *bsurface)
       abort();
    }
 
-   if (!context->flip_failed)
-      ret = EGL_CALL(eglSwapBuffers(context->display, context->surface));
+   if (!context->flip_failed) {
+      if (rects && nrects > 0 && context->api.eglSwapBuffersWithDamage) {
+         ret = EGL_CALL(context->api.eglSwapBuffersWithDamage(context->display, context->surface, (EGLint*)rects, nrects));
+      } else {
+         ret = EGL_CALL(eglSwapBuffers(context->display, context->surface));
+      }
+   }
 
    if (ret == EGL_TRUE && bsurface->api.page_flip)
       context->flip_failed = !bsurface->api.page_flip(bsurface);
 }
 
+static uint32_t
+buffer_age(struct ctx *context)
+{
+   assert(context);
+
+   if (!context->buffer_age || !bind(context))
+      return 0;
+
+   EGLint age = 0;
+   if (!eglQuerySurface(context->display, context->surface, EGL_BUFFER_AGE_EXT, &age) || age < 0)
+      return 0;
+
+   return age;
+}
+
 static void*
 get_proc_address(struct ctx *context, const char *procname)
 {
@@ -382,6 +443,7 @@ wlc_egl(struct wlc_backend_surface *bsurface, struct wlc_context_api *api)
    api->bind = bind;
    api->bind_to_wl_display = bind_to_wl_display;
    api->swap = swap;
+   api->buffer_age = buffer_age;
    api->get_proc_address = get_proc_address;
    api->destroy_image = destroy_image;
    api->create_image = create_image;
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pixman.h>
+#include "internal.h"
+#include "memory.h"
+#include "context.h"
+#include "platform/backend/backend.h"
+
+// Context for offscreen surfaces without EGL, frames are rendered into a framebuffer in system memory.
+
+struct ctx {
+   pixman_image_t *framebuffer;
+   bool flip_failed;
+};
+
+static void
+terminate(struct ctx *context)
+{
+   assert(context);
+
+   if (context->framebuffer)
+      pixman_image_unref(context->framebuffer);
+
+   free(context);
+}
+
+static bool
+bind(struct ctx *context)
+{
+   (void)context;
+   return true;
+}
+
+static void
+swap(struct ctx *context, struct wlc_backend_surface *bsurface, const EGLint *rects, EGLint nrects)
+{
+   (void)rects, (void)nrects;
+   assert(context);
+
+   if (!context->flip_failed && bsurface->api.page_flip)
+      context->flip_failed = !bsurface->api.page_flip(bsurface);
+}
+
+static uint32_t
+buffer_age(struct ctx *context)
+{
+   (void)context;
+   // There is only one framebuffer and it always contains the previous frame
+   return 1;
+}
+
+static pixman_image_t*
+get_framebuffer(struct ctx *context)
+{
+   assert(context);
+   return context->framebuffer;
+}
+
+void*
+wlc_memory(struct wlc_backend_surface *bsurface, struct wlc_context_api *api)
+{
+   assert(bsurface && api);
+
+   if (bsurface->window || !bsurface->size.w || !bsurface->size.h)
+      return NULL;
+
+   struct ctx *context;
+   if (!(context = calloc(1, sizeof(struct ctx))))
+      return NULL;
+
+   if (!(context->framebuffer = pixman_image_create_bits(PIXMAN_x8r8g8b8, bsurface->size.w, bsurface->size.h, NULL, 0))) {
+      wlc_log(WLC_LOG_WARN, "Failed to allocate %ux%u framebuffer", bsurface->size.w, bsurface->size.h);
+      terminate(context);
+      return NULL;
+   }
+
+   api->terminate = terminate;
+   api->bind = bind;
+   api->swap = swap;
+   api->buffer_age = buffer_age;
+   api->get_framebuffer = get_framebuffer;
+
+   wlc_log(WLC_LOG_INFO, "Memory context (%ux%u) initialized", bsurface->size.w, bsurface->size.h);
+   return context;
+}
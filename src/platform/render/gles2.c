@@ -1,11 +1,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 #include <dlfcn.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 #include <wayland-server.h>
+#include <pixman.h>
 #include <chck/string/string.h>
+#include <chck/math/math.h>
+#include <chck/overflow/overflow.h>
+#include <chck/pool/pool.h>
 #include "internal.h"
 #include "gles2.h"
 #include "render.h"
@@ -57,44 +62,142 @@ static const char *uniform_names[UNIFORM_LAST] = {
    "resolution",
 };
 
-static const struct {
-   GLenum format;
-   GLenum type;
-} format_map[] = {
-   { GL_RGBA, GL_UNSIGNED_BYTE }, // WLC_RGBA8888
+// Pixel pack buffers and sync objects of GLES3 and GL_NV_pixel_buffer_object, missing from GLES2 headers
+#ifndef GL_PIXEL_PACK_BUFFER
+#  define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#  define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_MAP_READ_BIT
+#  define GL_MAP_READ_BIT 0x0001
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#  define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#  define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+#ifndef GL_TIMEOUT_EXPIRED
+#  define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+#ifndef GL_WAIT_FAILED
+#  define GL_WAIT_FAILED 0x911D
+#endif
+
+// Above this many dirty rectangles the fakefb is cleared by their extents in one go
+#define FAKEFB_MAX_CLEARS 8
+
+// Readbacks in flight, a frame or two of latency is all we need to hide
+#define READBACK_RING 3
+
+// Marks cached GL state as unknown
+#define STATE_UNKNOWN ((GLuint)~0)
+
+// Quads are drawn with 16 bit indices, batches above this are split into several draws
+#define BATCH_MAX_QUADS 4096
+
+// How many batches back a quad may join one with the same state, if it doesn't overlap the batches in between
+#define BATCH_LOOKBACK 8
+
+// Shared texture for small shm surfaces, allocated in cells so it can be tracked with one bitmask per row
+#define ATLAS_SIZE 2048
+#define ATLAS_CELL 32
+#define ATLAS_CELLS (ATLAS_SIZE / ATLAS_CELL)
+#define ATLAS_MAX 256 // largest buffer side that goes into the atlas
+
+// x, y, u, v for each corner
+struct quad {
+   GLfloat vertices[16];
+   uint32_t batch;
+};
+
+// Queued quads sharing program, textures and blending, drawn with one call
+struct batch {
+   GLuint textures[3];
+   GLenum blend[2];
+   enum program_type program;
+   GLfloat bounds[4];
+   uint32_t quads, first;
 };
 
 struct ctx {
    const char *extensions;
 
-   struct ctx_program *program;
-
    struct ctx_program {
       GLuint obj;
       GLuint uniforms[UNIFORM_LAST];
    } programs[PROGRAM_LAST];
 
+   // Last state set to GL, redundant changes are skipped
+   struct {
+      struct ctx_program *program;
+      GLuint textures[3];
+      GLuint unit;
+      GLenum blend[2];
+      GLuint blending, scissor; // GL_TRUE, GL_FALSE or STATE_UNKNOWN
+   } state;
+
+   // Quads queued for the frame, submitted at the latest before anything else touches the framebuffer
+   struct {
+      struct chck_iter_pool quads, batches, culled;
+      GLfloat *vertices;
+      size_t allocated;
+      size_t opaque; // queued opaque quads, nothing to cull without them
+      GLuint vbo, ibo;
+   } draw;
+
+   struct {
+      uint64_t rows[ATLAS_CELLS]; // used cells
+      GLuint texture;
+      GLenum filter;
+      bool enabled;
+   } atlas;
+
    struct wlc_size resolution, mode;
    uint32_t scale;
 
+   // Scissor in framebuffer pixels, and the same rectangle in virtual resolution for clipping quads
+   struct wlc_geometry clip;
+   GLfloat clip_bounds[4];
+
    GLuint textures[TEXTURE_LAST];
+   GLenum filters[TEXTURE_LAST];
    GLuint clear_fbo;
    GLenum internal_format;
    GLenum preferred_type;
    bool native_resolution;
-   bool fakefb_dirty;
+   pixman_region32_t fakefb_dirty; // written by write_pixels since the last flush
+   bool scissor;
+   bool unpack_subimage;
+
+   bool read_bgra;
+
+   struct ctx_readback {
+      GLuint pbo;
+      void *fence;
+      GLsizeiptr size;
+      bool used, mapped;
+   } readback[READBACK_RING];
 
    struct {
       PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
+      void* (*glMapBufferRange)(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+      GLboolean (*glUnmapBuffer)(GLenum target);
+      void* (*glFenceSync)(GLenum condition, GLbitfield flags);
+      GLenum (*glClientWaitSync)(void *sync, GLbitfield flags, uint64_t timeout);
+      void (*glDeleteSync)(void *sync);
    } api;
 };
 
 struct paint {
    struct wlc_geometry visible;
+   struct wlc_geometry opaque; // part known to have no translucent pixels, if any
    enum program_type program;
-   bool filter;
+   bool filter, overlay, inset;
 };
 
+#ifndef NDEBUG
 static const char*
 gl_error_string(const GLenum error)
 {
@@ -127,7 +230,11 @@ gl_call(const char *func, uint32_t line, const char *glfunc)
 #  define __STRING(x) #x
 #endif
 
-#define GL_CALL(x) x; gl_call(__PRETTY_FUNCTION__, __LINE__, __STRING(x))
+#define GL_CALL(x) do { x; gl_call(__PRETTY_FUNCTION__, __LINE__, __STRING(x)); } while (0)
+#else
+// glGetError synchronizes with the driver, release builds don't check every call
+#define GL_CALL(x) do { x; } while (0)
+#endif
 
 WLC_PURE static bool
 has_extension(const struct ctx *context, const char *extension)
@@ -151,13 +258,459 @@ has_extension(const struct ctx *context, const char *extension)
    return false;
 }
 
+static void
+invalidate_state(struct ctx *context)
+{
+   assert(context);
+   context->state.program = NULL;
+   context->state.unit = STATE_UNKNOWN;
+   context->state.blend[0] = context->state.blend[1] = STATE_UNKNOWN;
+   context->state.blending = context->state.scissor = STATE_UNKNOWN;
+
+   for (GLuint i = 0; i < 3; ++i)
+      context->state.textures[i] = STATE_UNKNOWN;
+}
+
 static void
 set_program(struct ctx *context, enum program_type type)
 {
    assert(context && type >= 0 && type < PROGRAM_LAST);
 
-   context->program = &context->programs[type];
-   GL_CALL(glUseProgram(context->program->obj));
+   if (context->state.program == &context->programs[type])
+      return;
+
+   context->state.program = &context->programs[type];
+   GL_CALL(glUseProgram(context->state.program->obj));
+}
+
+static void
+bind_texture(struct ctx *context, GLuint unit, GLuint texture)
+{
+   assert(context && unit < 3);
+
+   if (context->state.unit != unit) {
+      GL_CALL(glActiveTexture(GL_TEXTURE0 + unit));
+      context->state.unit = unit;
+   }
+
+   if (context->state.textures[unit] != texture) {
+      GL_CALL(glBindTexture(GL_TEXTURE_2D, texture));
+      context->state.textures[unit] = texture;
+   }
+}
+
+static void
+forget_texture(struct ctx *context, GLuint texture)
+{
+   assert(context);
+
+   // Deleted textures are unbound, and the name may be handed out again
+   for (GLuint i = 0; i < 3; ++i) {
+      if (context->state.textures[i] == texture)
+         context->state.textures[i] = 0;
+   }
+}
+
+static void
+set_filter(GLenum *current, GLenum filter)
+{
+   assert(current);
+
+   // Filter is state of the texture bound to the active unit
+   if (*current == filter)
+      return;
+
+   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter));
+   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter));
+   *current = filter;
+}
+
+static void
+set_blend_func(struct ctx *context, GLenum src, GLenum dst)
+{
+   assert(context);
+
+   if (context->state.blend[0] == src && context->state.blend[1] == dst)
+      return;
+
+   GL_CALL(glBlendFunc(src, dst));
+   context->state.blend[0] = src;
+   context->state.blend[1] = dst;
+}
+
+static void
+sync_scissor(struct ctx *context)
+{
+   assert(context);
+
+   if (!context->scissor) {
+      if (context->state.scissor != GL_FALSE) {
+         GL_CALL(glDisable(GL_SCISSOR_TEST));
+      }
+
+      context->state.scissor = GL_FALSE;
+      return;
+   }
+
+   if (context->state.scissor != GL_TRUE) {
+      GL_CALL(glEnable(GL_SCISSOR_TEST));
+   }
+
+   // scissor is in framebuffer pixels with lower left origin
+   const struct wlc_geometry *c = &context->clip;
+   GL_CALL(glScissor(c->origin.x, context->mode.h - (c->origin.y + c->size.h), c->size.w, c->size.h));
+   context->state.scissor = GL_TRUE;
+}
+
+static void
+set_blending(struct ctx *context, bool enabled)
+{
+   assert(context);
+
+   if (context->state.blending == (GLuint)enabled)
+      return;
+
+   if (enabled) {
+      GL_CALL(glEnable(GL_BLEND));
+   } else {
+      GL_CALL(glDisable(GL_BLEND));
+   }
+
+   context->state.blending = enabled;
+}
+
+static bool
+batch_opaque(const struct batch *b)
+{
+   return (b->blend[0] == GL_ONE && b->blend[1] == GL_ZERO);
+}
+
+static void
+quad_init(struct quad *q, const GLfloat r[4], const GLfloat t[4], uint32_t batch)
+{
+   assert(q && r && t);
+
+   // Corners in the order of the index buffer, (x1, y1), (x2, y1), (x1, y2), (x2, y2)
+   *q = (struct quad){ .vertices = {
+      r[0], r[1], t[0], t[1],
+      r[2], r[1], t[2], t[1],
+      r[0], r[3], t[0], t[3],
+      r[2], r[3], t[2], t[3],
+   }, .batch = batch };
+}
+
+static bool
+quad_crop(const GLfloat r[4], const GLfloat t[4], const GLfloat crop[4], GLfloat out_r[4], GLfloat out_t[4])
+{
+   assert(r && t && crop && out_r && out_t);
+
+   out_r[0] = fmaxf(r[0], crop[0]);
+   out_r[1] = fmaxf(r[1], crop[1]);
+   out_r[2] = fminf(r[2], crop[2]);
+   out_r[3] = fminf(r[3], crop[3]);
+
+   if (out_r[2] <= out_r[0] || out_r[3] <= out_r[1])
+      return false;
+
+   // Texture coordinates follow the edges, so the cropped quad samples the same texels as before
+   const GLfloat w = r[2] - r[0], h = r[3] - r[1];
+   for (int i = 0; i < 4; ++i) {
+      const GLfloat f = (out_r[i] - r[i & 1]) / (i & 1 ? h : w);
+      out_t[i] = t[i & 1] + (t[2 + (i & 1)] - t[i & 1]) * f;
+   }
+
+   return true;
+}
+
+static void
+cull_occluded(struct ctx *context)
+{
+   assert(context);
+
+   struct batch *b;
+   chck_iter_pool_for_each(&context->draw.batches, b)
+      b->quads = 0;
+
+   // Walk front to back, whatever is below an opaque quad is never seen.
+   // Partly hidden quads are split into the visible rectangles, edges are rounded out so nothing visible gets culled.
+   pixman_region32_t covered, visible;
+   pixman_region32_init(&covered);
+   pixman_region32_init(&visible);
+   chck_iter_pool_flush(&context->draw.culled);
+
+   for (size_t i = context->draw.quads.items.count; i > 0; --i) {
+      const struct quad *q = chck_iter_pool_get(&context->draw.quads, i - 1);
+      const GLfloat r[4] = { q->vertices[0], q->vertices[1], q->vertices[12], q->vertices[13] };
+      const GLfloat t[4] = { q->vertices[2], q->vertices[3], q->vertices[14], q->vertices[15] };
+      const uint32_t batch = q->batch;
+
+      const pixman_box32_t outer = { floorf(r[0]), floorf(r[1]), ceilf(r[2]), ceilf(r[3]) };
+      pixman_region32_reset(&visible, (pixman_box32_t*)&outer);
+      pixman_region32_subtract(&visible, &visible, &covered);
+
+      int nrects;
+      const pixman_box32_t *v = pixman_region32_rectangles(&visible, &nrects);
+      for (int j = 0; j < nrects; ++j) {
+         struct quad piece;
+
+         if (nrects == 1 && !memcmp(&v[j], &outer, sizeof(outer))) {
+            piece = *q;
+         } else {
+            GLfloat pr[4], pt[4];
+            if (!quad_crop(r, t, (GLfloat[]){ v[j].x1, v[j].y1, v[j].x2, v[j].y2 }, pr, pt))
+               continue;
+
+            quad_init(&piece, pr, pt, batch);
+         }
+
+         if (!chck_iter_pool_push_back(&context->draw.culled, &piece))
+            continue;
+
+         b = chck_iter_pool_get(&context->draw.batches, batch);
+         b->quads++;
+      }
+
+      b = chck_iter_pool_get(&context->draw.batches, batch);
+      if (batch_opaque(b)) {
+         const int32_t x1 = ceilf(r[0]), y1 = ceilf(r[1]), x2 = floorf(r[2]), y2 = floorf(r[3]);
+
+         if (x2 > x1 && y2 > y1)
+            pixman_region32_union_rect(&covered, &covered, x1, y1, x2 - x1, y2 - y1);
+      }
+   }
+
+   pixman_region32_fini(&covered);
+   pixman_region32_fini(&visible);
+
+   // Pieces were collected front to back, put them back in painting order
+   const size_t count = context->draw.culled.items.count;
+   for (size_t i = 0; i < count / 2; ++i) {
+      struct quad *a = chck_iter_pool_get(&context->draw.culled, i), *z = chck_iter_pool_get(&context->draw.culled, count - 1 - i);
+      const struct quad tmp = *a;
+      *a = *z;
+      *z = tmp;
+   }
+
+   wlc_dlog(WLC_DBG_RENDER, "-> Occlusion turned %zu quads into %zu", context->draw.quads.items.count, count);
+
+   const struct chck_iter_pool tmp = context->draw.quads;
+   context->draw.quads = context->draw.culled;
+   context->draw.culled = tmp;
+}
+
+static void
+draw_batch(struct ctx *context, const struct batch *b)
+{
+   assert(context && b);
+
+   if (!b->quads)
+      return;
+
+   set_program(context, b->program);
+   set_blending(context, !batch_opaque(b));
+
+   if (!batch_opaque(b))
+      set_blend_func(context, b->blend[0], b->blend[1]);
+
+   for (GLuint i = 0; i < 3 && b->textures[i]; ++i)
+      bind_texture(context, i, b->textures[i]);
+
+   // GLES2 has no base vertex, so each draw points the attributes at its own quads
+   const size_t stride = sizeof(((struct quad*)0)->vertices);
+   for (uint32_t done = 0; done < b->quads; done += BATCH_MAX_QUADS) {
+      const uint32_t n = chck_minu32(b->quads - done, BATCH_MAX_QUADS);
+      const uintptr_t offset = ((uintptr_t)b->first - b->quads + done) * stride;
+      GL_CALL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const void*)offset));
+      GL_CALL(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const void*)(offset + 2 * sizeof(GLfloat))));
+      GL_CALL(glDrawElements(GL_TRIANGLES, n * 6, GL_UNSIGNED_SHORT, NULL));
+   }
+}
+
+static void
+draw_batches(struct ctx *context)
+{
+   assert(context);
+
+   if (!context->draw.quads.items.count)
+      goto out;
+
+   if (context->draw.opaque)
+      cull_occluded(context);
+
+   const size_t count = context->draw.quads.items.count;
+   if (!count)
+      goto out;
+
+   if (context->draw.allocated < count) {
+      GLfloat *vertices;
+      if (!(vertices = chck_realloc_mul_of(context->draw.vertices, count, sizeof(((struct quad*)0)->vertices)))) {
+         wlc_log(WLC_LOG_WARN, "gles2: Out of memory, dropped %zu quads", count);
+         goto out;
+      }
+
+      context->draw.vertices = vertices;
+      context->draw.allocated = count;
+   }
+
+   // Lay out the vertices batch after batch, first is used as write cursor and ends up past the last quad
+   uint32_t first = 0;
+   struct batch *b;
+   chck_iter_pool_for_each(&context->draw.batches, b) {
+      b->first = first;
+      first += b->quads;
+   }
+
+   struct quad *q;
+   chck_iter_pool_for_each(&context->draw.quads, q) {
+      b = chck_iter_pool_get(&context->draw.batches, q->batch);
+      memcpy(context->draw.vertices + (size_t)b->first++ * 16, q->vertices, sizeof(q->vertices));
+   }
+
+   GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, context->draw.vbo));
+   GL_CALL(glBufferData(GL_ARRAY_BUFFER, count * sizeof(q->vertices), context->draw.vertices, GL_STREAM_DRAW));
+   GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, context->draw.ibo));
+   GL_CALL(glEnableVertexAttribArray(0));
+   GL_CALL(glEnableVertexAttribArray(1));
+
+   // Quads are clipped already, and the scissor may have changed between them
+   if (context->state.scissor != GL_FALSE) {
+      GL_CALL(glDisable(GL_SCISSOR_TEST));
+      context->state.scissor = GL_FALSE;
+   }
+
+   // Opaque quads don't overlap anything visible after culling, so they go first front to back without blending.
+   // The translucent remainder is blended back to front on top.
+   size_t index = context->draw.batches.items.count;
+   while (index > 0) {
+      b = chck_iter_pool_get(&context->draw.batches, --index);
+      if (batch_opaque(b))
+         draw_batch(context, b);
+   }
+
+   chck_iter_pool_for_each(&context->draw.batches, b) {
+      if (!batch_opaque(b))
+         draw_batch(context, b);
+   }
+
+   // Hooks expect the default blending
+   set_blending(context, true);
+   set_blend_func(context, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+   wlc_dlog(WLC_DBG_RENDER, "-> Drew %zu quads in %zu batches", count, context->draw.batches.items.count);
+
+out:
+   chck_iter_pool_flush(&context->draw.quads);
+   chck_iter_pool_flush(&context->draw.batches);
+   context->draw.opaque = 0;
+}
+
+static void
+submit(struct ctx *context)
+{
+   assert(context);
+
+   // Whoever draws next, for example a render hook, expects the frame so far and the requested scissor
+   draw_batches(context);
+   sync_scissor(context);
+}
+
+static bool
+batch_matches(const struct batch *b, enum program_type program, const GLuint textures[3], const GLenum blend[2])
+{
+   return (b->program == program && b->blend[0] == blend[0] && b->blend[1] == blend[1] &&
+           !memcmp(b->textures, textures, sizeof(b->textures)));
+}
+
+static bool
+bounds_overlap(const GLfloat a[4], const GLfloat b[4])
+{
+   return (a[0] < b[2] && b[0] < a[2] && a[1] < b[3] && b[1] < a[3]);
+}
+
+static bool
+whole_units(const GLfloat r[4])
+{
+   // culling rounds edges inwards, so edges a thousandth of a unit off are as good as whole
+   for (uint32_t i = 0; i < 4; ++i) {
+      if (fabsf(r[i] - roundf(r[i])) > 0.001f)
+         return false;
+   }
+
+   return true;
+}
+
+static void
+queue_quad(struct ctx *context, enum program_type program, const GLuint textures[3], const GLenum blend[2], const GLfloat rect[4], const GLfloat uv[4])
+{
+   assert(context && textures && blend && rect && uv);
+
+   // Scissor is applied here, so quads with different scissors can still share a draw
+   GLfloat r[4], t[4];
+   static const GLfloat unclipped[4] = { -INFINITY, -INFINITY, INFINITY, INFINITY };
+   if (!quad_crop(rect, uv, (context->scissor ? context->clip_bounds : unclipped), r, t))
+      return;
+
+   // Culling works in whole units, opaque quads with fractional edges are blended in order like the rest
+   GLenum mode[2] = { blend[0], blend[1] };
+   bool opaque = (mode[0] == GL_ONE && mode[1] == GL_ZERO);
+   if (opaque && !whole_units(r)) {
+      mode[1] = GL_ONE_MINUS_SRC_ALPHA;
+      opaque = false;
+   }
+
+   // Join the latest batch with the same state, as long as no batch drawn in between overlaps the quad.
+   // Opaque batches are drawn before everything else and never overlap after culling, so overlap with them doesn't matter.
+   struct batch *b = NULL;
+   size_t index = context->draw.batches.items.count;
+   for (size_t n = 0; index > 0 && n < BATCH_LOOKBACK; ++n) {
+      struct batch *c = chck_iter_pool_get(&context->draw.batches, index - 1);
+
+      if (batch_matches(c, program, textures, mode)) {
+         b = c;
+         break;
+      }
+
+      if (!opaque && !batch_opaque(c) && bounds_overlap(c->bounds, r))
+         break;
+
+      --index;
+   }
+
+   if (b) {
+      --index;
+      b->bounds[0] = fminf(b->bounds[0], r[0]);
+      b->bounds[1] = fminf(b->bounds[1], r[1]);
+      b->bounds[2] = fmaxf(b->bounds[2], r[2]);
+      b->bounds[3] = fmaxf(b->bounds[3], r[3]);
+   } else {
+      struct batch batch = { .program = program, .blend = { mode[0], mode[1] }, .bounds = { r[0], r[1], r[2], r[3] } };
+      memcpy(batch.textures, textures, sizeof(batch.textures));
+
+      if (!(b = chck_iter_pool_push_back(&context->draw.batches, &batch)))
+         return;
+
+      index = context->draw.batches.items.count - 1;
+   }
+
+   struct quad q;
+   quad_init(&q, r, t, index);
+
+   if (!chck_iter_pool_push_back(&context->draw.quads, &q))
+      return;
+
+   b->quads++;
+   context->draw.opaque += opaque;
+}
+
+static void
+restore_state(struct ctx *context)
+{
+   assert(context);
+
+   // Render hooks may use GL directly, for example with wlc_surface_get_textures
+   invalidate_state(context);
+   set_blending(context, true);
+   set_blend_func(context, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 }
 
 static GLuint
@@ -187,21 +740,17 @@ create_shader(const char *source, GLenum shader_type)
 static struct ctx*
 create_context(void)
 {
+   // Quads are queued in virtual resolution, so many of them can go in one draw
    const char *vert_shader =
       "#version 100\n"
-      "precision mediump float;\n"
+      "precision highp float;\n"
       "uniform vec2 resolution;\n"
-      "attribute vec4 pos;\n"
+      "attribute vec2 pos;\n"
       "attribute vec2 uv;\n"
       "varying vec2 v_uv;\n"
       "void main() {\n"
-      "  mat4 ortho = mat4("
-      "    2.0/resolution.x,         0,          0, 0,"
-      "            0,        -2.0/resolution.y,  0, 0,"
-      "            0,                0,         -1, 0,"
-      "           -1,                1,          0, 1"
-      "  );\n"
-      "  gl_Position = ortho * pos;\n"
+      "  vec2 p = pos / resolution;\n"
+      "  gl_Position = vec4(p.x * 2.0 - 1.0, 1.0 - p.y * 2.0, 0.0, 1.0);\n"
       "  v_uv = uv;\n"
       "}\n";
 
@@ -306,10 +855,22 @@ create_context(void)
    if (!(context = calloc(1, sizeof(struct ctx))))
       return NULL;
 
+   pixman_region32_init(&context->fakefb_dirty);
+
+   // Two triangles per quad, the same for every draw
+   GLushort *indices;
+   if (!(indices = chck_malloc_mul_of(BATCH_MAX_QUADS * 6, sizeof(GLushort))))
+      goto fail;
+
+   if (!chck_iter_pool(&context->draw.quads, 64, 0, sizeof(struct quad)) ||
+       !chck_iter_pool(&context->draw.batches, 16, 0, sizeof(struct batch)) ||
+       !chck_iter_pool(&context->draw.culled, 64, 0, sizeof(struct quad)))
+      goto fail;
+
    const char *str;
-   str = (const char*)GL_CALL(glGetString(GL_VERSION));
+   GL_CALL(str = (const char*)glGetString(GL_VERSION));
    wlc_log(WLC_LOG_INFO, "GL version: %s", str ? str : "(null)");
-   str = (const char*)GL_CALL(glGetString(GL_VENDOR));
+   GL_CALL(str = (const char*)glGetString(GL_VENDOR));
    wlc_log(WLC_LOG_INFO, "GL vendor: %s", str ? str : "(null)");
 
    /** TODO: Should be available in GLES3 */
@@ -320,7 +881,7 @@ create_context(void)
    wlc_log(WLC_LOG_INFO, "Preferred texture type: %d", context->preferred_type);
 #endif
 
-   context->extensions = (const char*)GL_CALL(glGetString(GL_EXTENSIONS));
+   GL_CALL(context->extensions = (const char*)glGetString(GL_EXTENSIONS));
    wlc_log(WLC_LOG_INFO, "%s", context->extensions);
 
    if (!has_extension(context, "GL_OES_EGL_image_external")) {
@@ -328,10 +889,21 @@ create_context(void)
       frag_shader_egl = frag_shader_dummy;
    }
 
-   if (!has_extension(context, "GL_EXT_texture_format_BGRA8888")) {
+   if (!(context->atlas.enabled = has_extension(context, "GL_EXT_texture_format_BGRA8888"))) {
       wlc_log(WLC_LOG_WARN, "gles2: GL_EXT_texture_format_BGRA8888 is not available, rendering for many surfaces will most likely be broken");
    }
 
+   GLint max_texture_size = 0;
+   GL_CALL(glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size));
+   if (context->atlas.enabled && max_texture_size < ATLAS_SIZE) {
+      wlc_log(WLC_LOG_INFO, "gles2: Maximum texture size %d is too small for the atlas, small surfaces are not batched", max_texture_size);
+      context->atlas.enabled = false;
+   }
+
+   if (!(context->unpack_subimage = has_extension(context, "GL_EXT_unpack_subimage"))) {
+      wlc_log(WLC_LOG_INFO, "gles2: GL_EXT_unpack_subimage not available, shm surfaces are always uploaded whole");
+   }
+
    const struct {
       const char *vert;
       const char *frag;
@@ -351,6 +923,8 @@ create_context(void)
       context->programs[i].obj = glCreateProgram();
       GL_CALL(glAttachShader(context->programs[i].obj, vert));
       GL_CALL(glAttachShader(context->programs[i].obj, frag));
+      GL_CALL(glBindAttribLocation(context->programs[i].obj, 0, "pos"));
+      GL_CALL(glBindAttribLocation(context->programs[i].obj, 1, "uv"));
       GL_CALL(glLinkProgram(context->programs[i].obj));
       GL_CALL(glDeleteShader(vert));
       GL_CALL(glDeleteShader(frag));
@@ -366,11 +940,9 @@ create_context(void)
       }
 
       set_program(context, i);
-      GL_CALL(glBindAttribLocation(context->programs[i].obj, 0, "pos"));
-      GL_CALL(glBindAttribLocation(context->programs[i].obj, 1, "uv"));
 
       for (int u = 0; u < UNIFORM_LAST; ++u) {
-         context->programs[i].uniforms[u] = GL_CALL(glGetUniformLocation(context->programs[i].obj, uniform_names[u]));
+         GL_CALL(context->programs[i].uniforms[u] = glGetUniformLocation(context->programs[i].obj, uniform_names[u]));
       }
 
       GL_CALL(glUniform1i(context->programs[i].uniforms[UNIFORM_TEXTURE0], 0));
@@ -391,36 +963,83 @@ create_context(void)
       { GL_RGBA, 0, 0, GL_UNSIGNED_BYTE, NULL }, // TEXTURE_FAKEFB
    };
 
+   invalidate_state(context);
    GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
    GL_CALL(glGenTextures(TEXTURE_LAST, context->textures));
 
    for (GLuint i = 0; i < TEXTURE_LAST; ++i) {
-      GL_CALL(glBindTexture(GL_TEXTURE_2D, context->textures[i]));
+      bind_texture(context, 0, context->textures[i]);
       GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
       GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
       GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, images[i].format, images[i].w, images[i].h, 0, images[i].format, images[i].type, images[i].data));
    }
 
-   GL_CALL(glEnableVertexAttribArray(0));
-   GL_CALL(glEnableVertexAttribArray(1));
+   for (GLushort i = 0; i < BATCH_MAX_QUADS; ++i) {
+      const GLushort v = i * 4;
+      memcpy(&indices[i * 6], (GLushort[]){ v, v + 1, v + 2, v + 2, v + 1, v + 3 }, 6 * sizeof(GLushort));
+   }
+
+   GL_CALL(glGenBuffers(1, &context->draw.vbo));
+   GL_CALL(glGenBuffers(1, &context->draw.ibo));
+   GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, context->draw.ibo));
+   GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, BATCH_MAX_QUADS * 6 * sizeof(GLushort), indices, GL_STATIC_DRAW));
+   free(indices);
 
    GL_CALL(glGenFramebuffers(1, &context->clear_fbo));
    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, context->clear_fbo));
    GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, context->textures[TEXTURE_FAKEFB], 0));
    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
 
-   GL_CALL(glEnable(GL_BLEND));
-   GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+   set_blending(context, true);
+   set_blend_func(context, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
    GL_CALL(glClearColor(0.0, 0.0, 0.0, 0.0));
    return context;
+
+fail:
+   free(indices);
+   pixman_region32_fini(&context->fakefb_dirty);
+   chck_iter_pool_release(&context->draw.quads);
+   chck_iter_pool_release(&context->draw.batches);
+   chck_iter_pool_release(&context->draw.culled);
+   free(context);
+   return NULL;
 }
 
 static void
-clear_fakefb(struct ctx *context)
+clear_fakefb(struct ctx *context, pixman_region32_t *region)
 {
-   // assumes texture already bound!
+   assert(context);
    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, context->clear_fbo));
-   GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
+
+   if (region) {
+      // Only the written pixels need clearing, texture rows start at the bottom of its framebuffer like glTexSubImage2D expects
+      int nrects;
+      const pixman_box32_t *r = pixman_region32_rectangles(region, &nrects);
+
+      if (nrects > FAKEFB_MAX_CLEARS) {
+         r = pixman_region32_extents(region);
+         nrects = 1;
+      }
+
+      if (context->state.scissor != GL_TRUE) {
+         GL_CALL(glEnable(GL_SCISSOR_TEST));
+         context->state.scissor = GL_TRUE;
+      }
+
+      for (int i = 0; i < nrects; ++i) {
+         GL_CALL(glScissor(r[i].x1, r[i].y1, r[i].x2 - r[i].x1, r[i].y2 - r[i].y1));
+         GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
+      }
+   } else {
+      // fakefb must be cleared whole, otherwise pixels outside scissor would leak to next frame
+      if (context->state.scissor != GL_FALSE) {
+         GL_CALL(glDisable(GL_SCISSOR_TEST));
+         context->state.scissor = GL_FALSE;
+      }
+
+      GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
+   }
+
    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
 }
 
@@ -429,15 +1048,19 @@ resolution(struct ctx *context, const struct wlc_size *mode, const struct wlc_si
 {
    assert(context && resolution && scale > 0);
 
+   // Queued quads are in the old resolution
+   draw_batches(context);
+
    if (!wlc_size_equals(&context->resolution, resolution)) {
       for (GLuint i = 0; i < PROGRAM_LAST; ++i) {
          set_program(context, i);
-         GL_CALL(glUniform2fv(context->program->uniforms[UNIFORM_RESOLUTION], 1, (GLfloat[]){ resolution->w, resolution->h }));
+         GL_CALL(glUniform2fv(context->state.program->uniforms[UNIFORM_RESOLUTION], 1, (GLfloat[]){ resolution->w, resolution->h }));
       }
 
-      GL_CALL(glBindTexture(GL_TEXTURE_2D, context->textures[TEXTURE_FAKEFB]));
+      bind_texture(context, 0, context->textures[TEXTURE_FAKEFB]);
       GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, resolution->w, resolution->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL));
-      clear_fakefb(context);
+      clear_fakefb(context, NULL);
+      pixman_region32_clear(&context->fakefb_dirty);
       context->resolution = *resolution;
    }
 
@@ -452,33 +1075,102 @@ resolution(struct ctx *context, const struct wlc_size *mode, const struct wlc_si
 }
 
 static void
-surface_gen_textures(struct wlc_surface *surface, const GLuint num_textures)
+surface_gen_textures(struct ctx *context, struct wlc_surface *surface, const GLuint num_textures)
 {
-   assert(surface);
+   assert(context && surface);
 
    for (GLuint i = 0; i < num_textures; ++i) {
       if (surface->textures[i])
          continue;
 
       GL_CALL(glGenTextures(1, &surface->textures[i]));
-      GL_CALL(glBindTexture(GL_TEXTURE_2D, surface->textures[i]));
+      surface->filters[i] = 0;
+      bind_texture(context, 0, surface->textures[i]);
       GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
       GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
    }
 }
 
+static uint64_t
+atlas_mask(uint32_t x, uint32_t w)
+{
+   assert(x + w <= ATLAS_CELLS && w > 0);
+   return (w >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << w) - 1) << x);
+}
+
+static bool
+atlas_alloc(struct ctx *context, const struct wlc_size *size, struct wlc_geometry *out_slot)
+{
+   assert(context && size && out_slot);
+   assert(size->w > 0 && size->h > 0 && size->w <= ATLAS_MAX && size->h <= ATLAS_MAX);
+
+   if (!context->atlas.texture) {
+      GL_CALL(glGenTextures(1, &context->atlas.texture));
+      bind_texture(context, 0, context->atlas.texture);
+      GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+      GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+      GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT, ATLAS_SIZE, ATLAS_SIZE, 0, GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL));
+      context->atlas.filter = 0;
+   }
+
+   // First fit, the atlas holds at most a few hundred surfaces
+   const uint32_t cw = (size->w + ATLAS_CELL - 1) / ATLAS_CELL, ch = (size->h + ATLAS_CELL - 1) / ATLAS_CELL;
+   for (uint32_t y = 0; y + ch <= ATLAS_CELLS; ++y) {
+      for (uint32_t x = 0; x + cw <= ATLAS_CELLS; ++x) {
+         const uint64_t mask = atlas_mask(x, cw);
+
+         uint32_t r;
+         for (r = y; r < y + ch && !(context->atlas.rows[r] & mask); ++r);
+
+         if (r < y + ch)
+            continue;
+
+         for (r = y; r < y + ch; ++r)
+            context->atlas.rows[r] |= mask;
+
+         *out_slot = (struct wlc_geometry){ .origin = { x * ATLAS_CELL, y * ATLAS_CELL }, .size = *size };
+         return true;
+      }
+   }
+
+   return false;
+}
+
 static void
-surface_flush_textures(struct wlc_surface *surface)
+atlas_free(struct ctx *context, struct wlc_surface *surface)
 {
-   assert(surface);
+   assert(context && surface);
+
+   if (!surface->atlas.size.w)
+      return;
+
+   const uint32_t x = surface->atlas.origin.x / ATLAS_CELL, y = surface->atlas.origin.y / ATLAS_CELL;
+   const uint32_t cw = (surface->atlas.size.w + ATLAS_CELL - 1) / ATLAS_CELL, ch = (surface->atlas.size.h + ATLAS_CELL - 1) / ATLAS_CELL;
+   const uint64_t mask = atlas_mask(x, cw);
+
+   for (uint32_t r = y; r < y + ch; ++r)
+      context->atlas.rows[r] &= ~mask;
+
+   surface->atlas = wlc_geometry_zero;
+}
+
+static void
+surface_flush_textures(struct ctx *context, struct wlc_surface *surface)
+{
+   assert(context && surface);
+
+   atlas_free(context, surface);
 
    for (GLuint i = 0; i < 3; ++i) {
       if (surface->textures[i]) {
          GL_CALL(glDeleteTextures(1, &surface->textures[i]));
+         forget_texture(context, surface->textures[i]);
       }
    }
 
    memset(surface->textures, 0, sizeof(surface->textures));
+   memset(surface->filters, 0, sizeof(surface->filters));
+   memset(&surface->shm, 0, sizeof(surface->shm));
 }
 
 static void
@@ -497,17 +1189,17 @@ surface_flush_images(struct wlc_context *context, struct wlc_surface *surface)
 static void
 surface_destroy(struct ctx *context, struct wlc_context *bound, struct wlc_surface *surface)
 {
-   (void)context;
    assert(context && bound && surface);
-   surface_flush_textures(surface);
+   draw_batches(context);
+   surface_flush_textures(context, surface);
    surface_flush_images(bound, surface);
    wlc_dlog(WLC_DBG_RENDER, "-> Destroyed surface");
 }
 
 static bool
-shm_attach(struct wlc_surface *surface, struct wlc_buffer *buffer, struct wl_shm_buffer *shm_buffer)
+shm_attach(struct ctx *context, struct wlc_surface *surface, struct wlc_buffer *buffer, struct wl_shm_buffer *shm_buffer)
 {
-   assert(surface && buffer && shm_buffer);
+   assert(context && surface && buffer && shm_buffer);
 
    buffer->shm_buffer = shm_buffer;
    buffer->size.w = wl_shm_buffer_get_width(shm_buffer);
@@ -515,7 +1207,8 @@ shm_attach(struct wlc_surface *surface, struct wlc_buffer *buffer, struct wl_shm
 
    GLint pitch;
    GLenum gl_format, gl_pixel_type;
-   switch (wl_shm_buffer_get_format(shm_buffer)) {
+   const uint32_t shm_format = wl_shm_buffer_get_format(shm_buffer);
+   switch (shm_format) {
       case WL_SHM_FORMAT_XRGB8888:
          pitch = wl_shm_buffer_get_stride(shm_buffer) / 4;
          gl_format = GL_BGRA_EXT;
@@ -543,16 +1236,83 @@ shm_attach(struct wlc_surface *surface, struct wlc_buffer *buffer, struct wl_shm
    if ((view = convert_from_wlc_handle(surface->view, "view")) && is_x11_view(view))
       wlc_x11_window_set_surface_format(surface, &view->x11);
 
-   surface_gen_textures(surface, 1);
-   GL_CALL(glBindTexture(GL_TEXTURE_2D, surface->textures[0]));
+   // Small BGRA surfaces share the atlas so they can be drawn together, without row length they must be tightly packed
+   const bool atlas = (context->atlas.enabled && gl_format == GL_BGRA_EXT && buffer->size.w > 0 && buffer->size.h > 0 &&
+                       buffer->size.w <= ATLAS_MAX && buffer->size.h <= ATLAS_MAX &&
+                       (context->unpack_subimage || (uint32_t)pitch == buffer->size.w));
+
+   bool reuse = false;
+   if (atlas) {
+      if (surface->textures[0])
+         surface_flush_textures(context, surface);
+
+      reuse = wlc_size_equals(&surface->atlas.size, &buffer->size);
+
+      if (!reuse) {
+         atlas_free(context, surface);
+         atlas_alloc(context, &buffer->size, &surface->atlas);
+      }
+   } else {
+      atlas_free(context, surface);
+   }
+
+   // Atlas is full, surface gets a texture of its own
+   const bool in_atlas = (surface->atlas.size.w > 0);
+
+   // Texture holds the previous contents of the surface, if the storage matches we only need to upload the damage
+   const bool partial = (context->unpack_subimage && (in_atlas ? reuse : surface->textures[0] != 0) && surface->shm.format == shm_format &&
+                         surface->shm.pitch == pitch && wlc_size_equals(&surface->shm.size, &buffer->size));
+
+   // Uploads are offset by the slot inside the atlas
+   const struct wlc_point origin = (in_atlas ? surface->atlas.origin : (struct wlc_point){ 0, 0 });
+
+   if (in_atlas) {
+      bind_texture(context, 0, context->atlas.texture);
+   } else {
+      surface_gen_textures(context, surface, 1);
+      bind_texture(context, 0, surface->textures[0]);
+   }
+
    GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, pitch));
    GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0));
    GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0));
    wl_shm_buffer_begin_access(buffer->shm_buffer);
    void *data = wl_shm_buffer_get_data(buffer->shm_buffer);
-   GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, gl_format, pitch, buffer->size.h, 0, gl_format, gl_pixel_type, data));
+
+   if (partial) {
+      // Committed damage is in surface coordinates
+      int nrects;
+      const int32_t scale = surface->commit.scale;
+      const pixman_box32_t *r = pixman_region32_rectangles(&surface->commit.damage, &nrects);
+      for (int i = 0; i < nrects; ++i) {
+         const int32_t x1 = chck_clamp32(r[i].x1 * scale, 0, buffer->size.w), y1 = chck_clamp32(r[i].y1 * scale, 0, buffer->size.h);
+         const int32_t x2 = chck_clamp32(r[i].x2 * scale, 0, buffer->size.w), y2 = chck_clamp32(r[i].y2 * scale, 0, buffer->size.h);
+
+         if (x2 <= x1 || y2 <= y1)
+            continue;
+
+         GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, x1));
+         GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, y1));
+         GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, origin.x + x1, origin.y + y1, x2 - x1, y2 - y1, gl_format, gl_pixel_type, data));
+      }
+
+      wlc_dlog(WLC_DBG_RENDER, "-> Uploaded %d damaged rects of shm surface", nrects);
+   } else {
+      if (in_atlas) {
+         GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, origin.x, origin.y, buffer->size.w, buffer->size.h, gl_format, gl_pixel_type, data));
+      } else {
+         GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, gl_format, pitch, buffer->size.h, 0, gl_format, gl_pixel_type, data));
+      }
+
+      surface->shm.size = buffer->size;
+      surface->shm.pitch = pitch;
+      surface->shm.format = shm_format;
+   }
+
    wl_shm_buffer_end_access(buffer->shm_buffer);
    GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0));
+   GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0));
+   GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0));
 
    return true;
 }
@@ -614,15 +1374,23 @@ egl_attach(struct ctx *context, struct wlc_context *ectx, struct wlc_surface *su
    }
 
    surface_flush_images(ectx, surface);
-   surface_gen_textures(surface, num_planes);
+   atlas_free(context, surface);
+   surface_gen_textures(context, surface, num_planes);
+   memset(&surface->shm, 0, sizeof(surface->shm));
 
    for (GLuint i = 0; i < num_planes; ++i) {
       EGLint attribs[] = { EGL_WAYLAND_PLANE_WL, i, EGL_NONE };
       if (!(surface->images[i] = wlc_context_create_image(ectx, EGL_WAYLAND_BUFFER_WL, buffer->legacy_buffer, attribs)))
          return false;
 
-      GL_CALL(glActiveTexture(GL_TEXTURE0 + i));
-      GL_CALL(glBindTexture(target, surface->textures[i]));
+      if (target == GL_TEXTURE_2D) {
+         bind_texture(context, i, surface->textures[i]);
+      } else {
+         GL_CALL(glActiveTexture(GL_TEXTURE0 + i));
+         GL_CALL(glBindTexture(target, surface->textures[i]));
+         context->state.unit = i;
+      }
+
       GL_CALL(context->api.glEGLImageTargetTexture2DOES(target, surface->images[i]));
    }
 
@@ -634,6 +1402,9 @@ surface_attach(struct ctx *context, struct wlc_context *bound, struct wlc_surfac
 {
    assert(context && bound && surface);
 
+   // Queued quads may sample the textures about to change
+   draw_batches(context);
+
    struct wl_resource *wl_buffer;
    if (!buffer || !(wl_buffer = convert_to_wl_resource(buffer, "buffer"))) {
       surface_destroy(context, bound, surface);
@@ -645,7 +1416,7 @@ surface_attach(struct ctx *context, struct wlc_context *bound, struct wlc_surfac
 
    struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(wl_buffer);
    if (shm_buffer) {
-      attached = shm_attach(surface, buffer, shm_buffer);
+      attached = shm_attach(context, surface, buffer, shm_buffer);
    } else if (wlc_context_query_buffer(bound, (void*)wl_buffer, EGL_TEXTURE_FORMAT, &format)) {
       attached = egl_attach(context, bound, surface, buffer, format);
    } else {
@@ -659,44 +1430,86 @@ surface_attach(struct ctx *context, struct wlc_context *bound, struct wlc_surfac
    return attached;
 }
 
+static bool
+program_opaque(enum program_type program)
+{
+   switch (program) {
+      case PROGRAM_RGB:
+      case PROGRAM_Y_UV:
+      case PROGRAM_Y_U_V:
+      case PROGRAM_Y_XUXV:
+         return true;
+      default:
+         break;
+   }
+
+   return false;
+}
+
 static void
-texture_paint(struct ctx *context, GLuint *textures, GLuint nmemb, const struct wlc_geometry *geometry, struct paint *settings)
+texture_paint(struct ctx *context, GLuint *textures, GLenum *filters, GLuint nmemb, const struct wlc_geometry *geometry, const struct wlc_geometry *slot, const struct wlc_size *size, struct paint *settings)
 {
-   const GLfloat vertices[8] = {
-      geometry->origin.x + geometry->size.w, geometry->origin.y,
-      geometry->origin.x, geometry->origin.y,
-      geometry->origin.x + geometry->size.w, geometry->origin.y + geometry->size.h,
-      geometry->origin.x, geometry->origin.y + geometry->size.h,
-   };
+   assert(context && textures && filters && geometry && settings && (!slot || size));
 
-   const GLfloat coords[8] = {
-      1, 0,
-      0, 0,
-      1, 1,
-      0, 1
-   };
+   GLuint queued[3] = { 0, 0, 0 };
+   const GLenum filter = (settings->filter || !context->native_resolution ? GL_LINEAR : GL_NEAREST);
+   for (GLuint i = 0; i < nmemb && i < 3 && textures[i]; ++i)
+      queued[i] = textures[i];
 
-   set_program(context, settings->program);
+   // Filter is texture state, quads already queued with the old one must be drawn first
+   for (GLuint i = 0; i < 3 && queued[i]; ++i) {
+      if (filters[i] == filter)
+         continue;
 
-   for (GLuint i = 0; i < nmemb; ++i) {
-      if (!textures[i])
-         break;
+      draw_batches(context);
+      bind_texture(context, i, queued[i]);
+      set_filter(&filters[i], filter);
+   }
 
-      GL_CALL(glActiveTexture(GL_TEXTURE0 + i));
-      GL_CALL(glBindTexture(GL_TEXTURE_2D, textures[i]));
+   // Slot is a rectangle of a texture of the given size, inset by half a texel if linear filtering must not pick up the neighbours
+   GLfloat uv[4] = { 0, 0, 1, 1 };
+   if (slot) {
+      const GLfloat inset = (settings->inset && filter == GL_LINEAR ? 0.5f : 0.0f);
+      uv[0] = (slot->origin.x + inset) / size->w;
+      uv[1] = (slot->origin.y + inset) / size->h;
+      uv[2] = (slot->origin.x + slot->size.w - inset) / size->w;
+      uv[3] = (slot->origin.y + slot->size.h - inset) / size->h;
+   }
 
-      if (settings->filter || !context->native_resolution) {
-         GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-         GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-      } else {
-         GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
-         GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-      }
+   const GLfloat rect[4] = { geometry->origin.x, geometry->origin.y, geometry->origin.x + (GLfloat)geometry->size.w, geometry->origin.y + (GLfloat)geometry->size.h };
+   const GLenum blend[2] = { GL_ONE, (settings->overlay ? GL_DST_COLOR : GL_ONE_MINUS_SRC_ALPHA) };
+   static const GLenum replace[2] = { GL_ONE, GL_ZERO };
+
+   // Programs without alpha output are opaque everywhere
+   if (!settings->overlay && program_opaque(settings->program)) {
+      queue_quad(context, settings->program, queued, replace, rect, uv);
+      return;
    }
 
-   GL_CALL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, vertices));
-   GL_CALL(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, coords));
-   GL_CALL(glDrawArrays(GL_TRIANGLE_STRIP, 0, 4));
+   if (settings->overlay || settings->opaque.size.w == 0 || settings->opaque.size.h == 0) {
+      queue_quad(context, settings->program, queued, blend, rect, uv);
+      return;
+   }
+
+   // Opaque region is drawn without blending, the rest around it as bands above, below, left and right of it
+   const struct wlc_geometry *o = &settings->opaque;
+   const GLfloat x1 = o->origin.x, y1 = o->origin.y, x2 = o->origin.x + (GLfloat)o->size.w, y2 = o->origin.y + (GLfloat)o->size.h;
+   const struct {
+      GLfloat crop[4];
+      const GLenum *blend;
+   } parts[] = {
+      { { -INFINITY, -INFINITY, INFINITY, y1 }, blend },
+      { { -INFINITY, y1, x1, y2 }, blend },
+      { { x1, y1, x2, y2 }, replace },
+      { { x2, y1, INFINITY, y2 }, blend },
+      { { -INFINITY, y2, INFINITY, INFINITY }, blend },
+   };
+
+   for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i) {
+      GLfloat r[4], t[4];
+      if (quad_crop(rect, uv, parts[i].crop, r, t))
+         queue_quad(context, settings->program, queued, parts[i].blend, r, t);
+   }
 }
 
 static void
@@ -713,15 +1526,22 @@ surface_paint_internal(struct ctx *context, struct wlc_surface *surface, const s
       if (wlc_geometry_equals(&settings->visible, geometry)) {
          settings->filter = true;
       } else {
-         // black borders are requested
+         // black borders are requested, the opaque region doesn't follow the letterboxed surface
+         settings->opaque = wlc_geometry_zero;
          struct paint settings2 = *settings;
          settings2.program = (settings2.program == PROGRAM_RGBA || settings2.program == PROGRAM_RGB ? settings2.program : PROGRAM_RGB);
-         texture_paint(context, &context->textures[TEXTURE_BLACK], 1, geometry, &settings2);
+         texture_paint(context, &context->textures[TEXTURE_BLACK], &context->filters[TEXTURE_BLACK], 1, geometry, NULL, NULL, &settings2);
          g = &settings->visible;
       }
    }
 
-   texture_paint(context, surface->textures, 3, g, settings);
+   if (surface->atlas.size.w > 0) {
+      settings->inset = true;
+      texture_paint(context, &context->atlas.texture, &context->atlas.filter, 1, g, &surface->atlas, &(struct wlc_size){ ATLAS_SIZE, ATLAS_SIZE }, settings);
+      settings->inset = false;
+   } else {
+      texture_paint(context, surface->textures, surface->filters, 3, g, NULL, NULL, settings);
+   }
 }
 
 static void
@@ -731,22 +1551,27 @@ surface_paint(struct ctx *context, struct wlc_surface *surface, const struct wlc
    memset(&settings, 0, sizeof(settings));
    settings.program = (enum program_type)surface->format;
    settings.visible = *geometry;
+
+   // Opaque extents are only exact for a single rectangle
+   if (pixman_region32_n_rects(&surface->commit.opaque) == 1)
+      wlc_surface_get_opaque(surface, &geometry->origin, &settings.opaque);
+
    surface_paint_internal(context, surface, geometry, &settings);
 
    if (DRAW_OPAQUE) {
       wlc_surface_get_opaque(surface, &geometry->origin, &settings.visible);
       settings.program = PROGRAM_RGB;
-      GL_CALL(glBlendFunc(GL_ONE, GL_DST_COLOR));
-      texture_paint(context, &context->textures[TEXTURE_RED], 1, &settings.visible, &settings);
-      GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+      settings.overlay = true;
+      texture_paint(context, &context->textures[TEXTURE_RED], &context->filters[TEXTURE_RED], 1, &settings.visible, NULL, NULL, &settings);
+      settings.overlay = false;
    }
 
    if (DRAW_INPUT) {
       wlc_surface_get_input(surface, &geometry->origin, &settings.visible);
       settings.program = PROGRAM_RGB;
-      GL_CALL(glBlendFunc(GL_ONE, GL_DST_COLOR));
-      texture_paint(context, &context->textures[TEXTURE_BLUE], 1, &settings.visible, &settings);
-      GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+      settings.overlay = true;
+      texture_paint(context, &context->textures[TEXTURE_BLUE], &context->filters[TEXTURE_BLUE], 1, &settings.visible, NULL, NULL, &settings);
+      settings.overlay = false;
    }
 }
 
@@ -765,22 +1590,26 @@ view_paint(struct ctx *context, struct wlc_view *view)
 
    struct wlc_geometry geometry;
    wlc_view_get_bounds(view, &geometry, &settings.visible);
+
+   if (pixman_region32_n_rects(&surface->commit.opaque) == 1)
+      wlc_view_get_opaque(view, &settings.opaque);
+
    surface_paint_internal(context, surface, &geometry, &settings);
 
    if (DRAW_OPAQUE) {
       wlc_view_get_opaque(view, &settings.visible);
       settings.program = PROGRAM_RGB;
-      GL_CALL(glBlendFunc(GL_ONE, GL_DST_COLOR));
-      texture_paint(context, &context->textures[TEXTURE_RED], 1, &settings.visible, &settings);
-      GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+      settings.overlay = true;
+      texture_paint(context, &context->textures[TEXTURE_RED], &context->filters[TEXTURE_RED], 1, &settings.visible, NULL, NULL, &settings);
+      settings.overlay = false;
    }
 
    if (DRAW_INPUT) {
       wlc_view_get_input(view, &settings.visible);
       settings.program = PROGRAM_RGB;
-      GL_CALL(glBlendFunc(GL_ONE, GL_DST_COLOR));
-      texture_paint(context, &context->textures[TEXTURE_BLUE], 1, &settings.visible, &settings);
-      GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+      settings.overlay = true;
+      texture_paint(context, &context->textures[TEXTURE_BLUE], &context->filters[TEXTURE_BLUE], 1, &settings.visible, NULL, NULL, &settings);
+      settings.overlay = false;
    }
 }
 
@@ -792,7 +1621,7 @@ pointer_paint(struct ctx *context, const struct wlc_point *pos)
    memset(&settings, 0, sizeof(settings));
    settings.program = PROGRAM_CURSOR;
    struct wlc_geometry g = { *pos, { 14, 14 } };
-   texture_paint(context, &context->textures[TEXTURE_CURSOR], 1, &g, &settings);
+   texture_paint(context, &context->textures[TEXTURE_CURSOR], &context->filters[TEXTURE_CURSOR], 1, &g, NULL, NULL, &settings);
 }
 
 static void
@@ -823,17 +1652,42 @@ clamp_to_bounds(struct wlc_geometry *g, const struct wlc_size *bounds)
       g->size.h -= (g->origin.y + g->size.h) - bounds->h;
 }
 
+static void
+swap_red_blue(uint8_t *data, size_t pixels, bool opaque)
+{
+   assert(data);
+
+   for (size_t i = 0; i < pixels; ++i, data += 4) {
+      const uint8_t r = data[0];
+      data[0] = data[2];
+      data[2] = r;
+
+      if (opaque)
+         data[3] = 0xff;
+   }
+}
+
+static GLenum
+read_format(const struct ctx *context, enum wlc_pixel_format format)
+{
+   // Without GL_EXT_read_format_bgra we read RGBA and swizzle
+   return (format != WLC_RGBA8888 && context->read_bgra ? GL_BGRA_EXT : GL_RGBA);
+}
+
 static void
 read_pixels(struct ctx *context, enum wlc_pixel_format format, const struct wlc_geometry *geometry, struct wlc_geometry *out_geometry, void *out_data)
 {
-   (void)context;
    assert(context && geometry && out_geometry && out_data);
+   draw_batches(context);
    struct wlc_geometry g = *geometry;
    clamp_to_bounds(&g, &context->mode);
    // flip vertical coords, OpenGL assumes lower left is (0, 0)
    const uint32_t flipped_y = context->mode.h - (g.origin.y + g.size.h);
-   GL_CALL(glReadPixels(g.origin.x, flipped_y, g.size.w, g.size.h, format_map[format].format, format_map[format].type, out_data));
+   GL_CALL(glReadPixels(g.origin.x, flipped_y, g.size.w, g.size.h, read_format(context, format), GL_UNSIGNED_BYTE, out_data));
    *out_geometry = g;
+
+   if (format != WLC_RGBA8888 && read_format(context, format) == GL_RGBA)
+      swap_red_blue(out_data, (size_t)g.size.w * g.size.h, false);
 }
 
 static void
@@ -841,11 +1695,160 @@ write_pixels(struct ctx *context, enum wlc_pixel_format format, const struct wlc
 {
    (void)context;
    assert(context && geometry && data);
+
+   // fakefb is RGBA, other formats are converted
+   uint8_t *rgba = NULL;
+   if (format != WLC_RGBA8888) {
+      const size_t pixels = (size_t)geometry->size.w * geometry->size.h;
+      if (!(rgba = chck_malloc_mul_of(pixels, 4)))
+         return;
+
+      memcpy(rgba, data, pixels * 4);
+      swap_red_blue(rgba, pixels, format == WLC_XRGB8888);
+      data = rgba;
+   }
+
+   // fakefb is in virtual resolution
+   struct wlc_geometry g = *geometry;
+   clamp_to_bounds(&g, &context->resolution);
+
+   if (g.size.w > 0 && g.size.h > 0) {
+      bind_texture(context, 0, context->textures[TEXTURE_FAKEFB]);
+      GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, g.origin.x, g.origin.y, g.size.w, g.size.h, GL_RGBA, GL_UNSIGNED_BYTE, data));
+      pixman_region32_union_rect(&context->fakefb_dirty, &context->fakefb_dirty, g.origin.x, g.origin.y, g.size.w, g.size.h);
+   }
+
+   free(rgba);
+}
+
+static int32_t
+readback_begin(struct ctx *context, enum wlc_pixel_format format, const struct wlc_geometry *geometry, struct wlc_geometry *out_geometry)
+{
+   assert(context && geometry && out_geometry);
+
+   // Swizzling would need a copy of the mapped data, so those reads are synchronous
+   if (!context->api.glMapBufferRange || read_format(context, format) != (format == WLC_RGBA8888 ? GL_RGBA : GL_BGRA_EXT))
+      return -1;
+
    struct wlc_geometry g = *geometry;
    clamp_to_bounds(&g, &context->mode);
-   GL_CALL(glBindTexture(GL_TEXTURE_2D, context->textures[TEXTURE_FAKEFB]));
-   GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, g.origin.x, g.origin.y, g.size.w, g.size.h, format_map[format].format, format_map[format].type, data));
-   context->fakefb_dirty = true;
+
+   if (!g.size.w || !g.size.h)
+      return -1;
+
+   int32_t slot = -1;
+   for (int32_t i = 0; i < READBACK_RING && slot < 0; ++i)
+      slot = (context->readback[i].used ? -1 : i);
+
+   if (slot < 0)
+      return -1;
+
+   draw_batches(context);
+   struct ctx_readback *r = &context->readback[slot];
+   r->size = (GLsizeiptr)g.size.w * g.size.h * 4;
+
+   if (!r->pbo) {
+      GL_CALL(glGenBuffers(1, &r->pbo));
+   }
+
+   // Copy happens on the GPU, glReadPixels returns without waiting for the frame to finish
+   const uint32_t flipped_y = context->mode.h - (g.origin.y + g.size.h);
+   GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbo));
+   GL_CALL(glBufferData(GL_PIXEL_PACK_BUFFER, r->size, NULL, GL_STREAM_READ));
+   GL_CALL(glReadPixels(g.origin.x, flipped_y, g.size.w, g.size.h, read_format(context, format), GL_UNSIGNED_BYTE, NULL));
+   GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+   if (context->api.glFenceSync) {
+      GL_CALL(r->fence = context->api.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+   }
+
+   r->used = true;
+   *out_geometry = g;
+   return slot;
+}
+
+static const void*
+readback_map(struct ctx *context, int32_t slot, bool wait)
+{
+   assert(context && slot >= 0 && slot < READBACK_RING && context->readback[slot].used);
+   struct ctx_readback *r = &context->readback[slot];
+
+   if (r->fence) {
+      GLenum status;
+      GL_CALL(status = context->api.glClientWaitSync(r->fence, GL_SYNC_FLUSH_COMMANDS_BIT, (wait ? UINT64_MAX : 0)));
+
+      if (status == GL_TIMEOUT_EXPIRED || (status == GL_WAIT_FAILED && !wait))
+         return NULL;
+   } else if (!wait) {
+      // Mapping would block until the copy is done
+      return NULL;
+   }
+
+   GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbo));
+   void *data;
+   GL_CALL(data = context->api.glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, r->size, GL_MAP_READ_BIT));
+   GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+   r->mapped = (data != NULL);
+   return data;
+}
+
+static void
+readback_end(struct ctx *context, int32_t slot)
+{
+   assert(context && slot >= 0 && slot < READBACK_RING);
+   struct ctx_readback *r = &context->readback[slot];
+
+   if (r->mapped) {
+      GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbo));
+      GL_CALL(context->api.glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+      GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+   }
+
+   if (r->fence) {
+      GL_CALL(context->api.glDeleteSync(r->fence));
+   }
+
+   r->fence = NULL;
+   r->used = r->mapped = false;
+}
+
+static void
+setup_readback(struct ctx *context, struct wlc_context *ectx)
+{
+   assert(context && ectx);
+
+   context->read_bgra = has_extension(context, "GL_EXT_read_format_bgra");
+
+   const char *version;
+   GL_CALL(version = (const char*)glGetString(GL_VERSION));
+   if (version && chck_cstrneq(version, "OpenGL ES 3", strlen("OpenGL ES 3"))) {
+      context->api.glMapBufferRange = wlc_context_get_proc_address(ectx, "glMapBufferRange");
+      context->api.glUnmapBuffer = wlc_context_get_proc_address(ectx, "glUnmapBuffer");
+      context->api.glFenceSync = wlc_context_get_proc_address(ectx, "glFenceSync");
+      context->api.glClientWaitSync = wlc_context_get_proc_address(ectx, "glClientWaitSync");
+      context->api.glDeleteSync = wlc_context_get_proc_address(ectx, "glDeleteSync");
+   } else if (has_extension(context, "GL_NV_pixel_buffer_object") && has_extension(context, "GL_EXT_map_buffer_range")) {
+      context->api.glMapBufferRange = wlc_context_get_proc_address(ectx, "glMapBufferRangeEXT");
+      context->api.glUnmapBuffer = wlc_context_get_proc_address(ectx, "glUnmapBufferOES");
+
+      if (has_extension(context, "GL_APPLE_sync")) {
+         context->api.glFenceSync = wlc_context_get_proc_address(ectx, "glFenceSyncAPPLE");
+         context->api.glClientWaitSync = wlc_context_get_proc_address(ectx, "glClientWaitSyncAPPLE");
+         context->api.glDeleteSync = wlc_context_get_proc_address(ectx, "glDeleteSyncAPPLE");
+      }
+   }
+
+   if (!context->api.glMapBufferRange || !context->api.glUnmapBuffer) {
+      wlc_log(WLC_LOG_INFO, "gles2: No pixel pack buffers available, pixel reads are synchronous");
+      context->api.glMapBufferRange = NULL;
+      context->api.glUnmapBuffer = NULL;
+   }
+
+   if (!context->api.glFenceSync || !context->api.glClientWaitSync || !context->api.glDeleteSync) {
+      context->api.glFenceSync = NULL;
+      context->api.glClientWaitSync = NULL;
+      context->api.glDeleteSync = NULL;
+   }
 }
 
 static void
@@ -853,24 +1856,57 @@ flush_fakefb(struct ctx *context)
 {
    assert(context);
 
-   if (!context->fakefb_dirty)
+   // Most views have hooks that don't write anything
+   if (!pixman_region32_not_empty(&context->fakefb_dirty))
       return;
 
    struct paint settings = {0};
    settings.program = PROGRAM_RGBA;
-   texture_paint(context, &context->textures[TEXTURE_FAKEFB], 1, &(struct wlc_geometry){ .origin = { 0, 0 }, .size = context->resolution }, &settings);
-   clear_fakefb(context);
-   context->fakefb_dirty = false;
+
+   // Quads of the written rectangles share state, so they are drawn together
+   int nrects;
+   const pixman_box32_t *r = pixman_region32_rectangles(&context->fakefb_dirty, &nrects);
+   for (int i = 0; i < nrects; ++i) {
+      const struct wlc_geometry g = { .origin = { r[i].x1, r[i].y1 }, .size = { r[i].x2 - r[i].x1, r[i].y2 - r[i].y1 } };
+      texture_paint(context, &context->textures[TEXTURE_FAKEFB], &context->filters[TEXTURE_FAKEFB], 1, &g, &g, &context->resolution, &settings);
+   }
+
+   draw_batches(context);
+   clear_fakefb(context, &context->fakefb_dirty);
+   pixman_region32_clear(&context->fakefb_dirty);
 }
 
 static void
 clear(struct ctx *context)
 {
-   (void)context;
    assert(context);
+   submit(context);
    GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
 }
 
+static void
+scissor(struct ctx *context, const struct wlc_geometry *geometry)
+{
+   assert(context);
+
+   // Applied to queued quads on the CPU, GL only sees it when something else draws
+   if (!(context->scissor = (geometry != NULL)))
+      return;
+
+   // geometry is in virtual resolution, rounded out to whole framebuffer pixels
+   assert(context->resolution.w > 0 && context->resolution.h > 0);
+   const float sw = (float)context->mode.w / context->resolution.w, sh = (float)context->mode.h / context->resolution.h;
+   const int32_t x1 = floor(geometry->origin.x * sw), y1 = floor(geometry->origin.y * sh);
+   const int32_t x2 = ceil((geometry->origin.x + geometry->size.w) * sw), y2 = ceil((geometry->origin.y + geometry->size.h) * sh);
+   context->clip = (struct wlc_geometry){ .origin = { x1, y1 }, .size = { x2 - x1, y2 - y1 } };
+
+   GLfloat *c = context->clip_bounds;
+   c[0] = x1 / sw;
+   c[1] = y1 / sh;
+   c[2] = x2 / sw;
+   c[3] = y2 / sh;
+}
+
 static void
 terminate(struct ctx *context)
 {
@@ -880,20 +1916,46 @@ terminate(struct ctx *context)
       GL_CALL(glDeleteProgram(context->programs[i].obj));
    }
 
+   for (int32_t i = 0; i < READBACK_RING; ++i) {
+      if (context->readback[i].used)
+         readback_end(context, i);
+
+      if (context->readback[i].pbo) {
+         GL_CALL(glDeleteBuffers(1, &context->readback[i].pbo));
+      }
+   }
+
+   if (context->atlas.texture) {
+      GL_CALL(glDeleteTextures(1, &context->atlas.texture));
+   }
+
    GL_CALL(glDeleteTextures(TEXTURE_LAST, context->textures));
+   GL_CALL(glDeleteBuffers(1, &context->draw.vbo));
+   GL_CALL(glDeleteBuffers(1, &context->draw.ibo));
    GL_CALL(glDeleteFramebuffers(1, &context->clear_fbo));
+   chck_iter_pool_release(&context->draw.quads);
+   chck_iter_pool_release(&context->draw.batches);
+   chck_iter_pool_release(&context->draw.culled);
+   free(context->draw.vertices);
+   pixman_region32_fini(&context->fakefb_dirty);
    free(context);
 }
 
 void*
-wlc_gles2(struct wlc_render_api *api)
+wlc_gles2(struct wlc_context *context, struct wlc_render_api *api)
 {
-   assert(api);
+   assert(context && api);
+
+   // Memory contexts have no GL to draw with
+   if (wlc_context_get_framebuffer(context))
+      return NULL;
 
    struct ctx *ctx;
    if (!(ctx = create_context()))
       return NULL;
 
+   setup_readback(ctx, context);
+
    api->renderer_type = WLC_RENDERER_GLES2;
    api->terminate = terminate;
    api->resolution = resolution;
@@ -906,6 +1968,12 @@ wlc_gles2(struct wlc_render_api *api)
    api->write_pixels = write_pixels;
    api->flush_fakefb = flush_fakefb;
    api->clear = clear;
+   api->scissor = scissor;
+   api->invalidate = restore_state;
+   api->submit = submit;
+   api->readback_begin = readback_begin;
+   api->readback_map = readback_map;
+   api->readback_end = readback_end;
 
    chck_cstr_to_bool(getenv("WLC_DRAW_OPAQUE"), &DRAW_OPAQUE);
    chck_cstr_to_bool(getenv("WLC_DRAW_INPUT"), &DRAW_INPUT);
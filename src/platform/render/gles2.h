@@ -1,8 +1,9 @@
 #ifndef _WLC_GLES2_H_
 #define _WLC_GLES2_H_
 
+struct wlc_context;
 struct wlc_render_api;
 
-void* wlc_gles2(struct wlc_render_api *api);
+void* wlc_gles2(struct wlc_context *context, struct wlc_render_api *api);
 
 #endif /* _WLC_GLES2_H_ */
@@ -0,0 +1,496 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <pixman.h>
+#include <wayland-server.h>
+#include "internal.h"
+#include "pixman.h"
+#include "render.h"
+#include "platform/context/context.h"
+#include "compositor/view.h"
+#include "xwayland/xwm.h"
+#include "resources/types/surface.h"
+#include "resources/types/buffer.h"
+
+// Software renderer, composites shm buffers straight from client memory into the memory context's framebuffer.
+
+static const uint8_t cursor_palette[];
+
+struct ctx {
+   pixman_image_t *target;
+   pixman_image_t *cursor;
+   struct wlc_size resolution, mode;
+   uint32_t scale;
+};
+
+static pixman_format_code_t
+shm_format_to_pixman(uint32_t format)
+{
+   switch (format) {
+      case WL_SHM_FORMAT_XRGB8888:
+         return PIXMAN_x8r8g8b8;
+      case WL_SHM_FORMAT_ARGB8888:
+         return PIXMAN_a8r8g8b8;
+      case WL_SHM_FORMAT_RGB565:
+         return PIXMAN_r5g6b5;
+      default: break;
+   }
+
+   return 0;
+}
+
+static pixman_format_code_t
+pixel_format_to_pixman(enum wlc_pixel_format format)
+{
+   switch (format) {
+      case WLC_BGRA8888:
+         return PIXMAN_a8r8g8b8;
+      case WLC_XRGB8888:
+         return PIXMAN_x8r8g8b8;
+      case WLC_RGBA8888:
+      default: break;
+   }
+
+   return PIXMAN_a8b8g8r8;
+}
+
+static bool
+box_from_geometry(const struct ctx *context, const struct wlc_geometry *geometry, pixman_box32_t *out_box)
+{
+   assert(context && geometry && out_box);
+
+   if (!context->resolution.w || !context->resolution.h)
+      return false;
+
+   // geometry is in virtual resolution, framebuffer is in mode pixels
+   const float sw = (float)context->mode.w / context->resolution.w, sh = (float)context->mode.h / context->resolution.h;
+   out_box->x1 = floor(geometry->origin.x * sw);
+   out_box->y1 = floor(geometry->origin.y * sh);
+   out_box->x2 = ceil((geometry->origin.x + geometry->size.w) * sw);
+   out_box->y2 = ceil((geometry->origin.y + geometry->size.h) * sh);
+   return (out_box->x2 > out_box->x1 && out_box->y2 > out_box->y1);
+}
+
+static void
+composite(struct ctx *context, pixman_op_t op, pixman_image_t *src, const struct wlc_size *size, const struct wlc_geometry *geometry)
+{
+   assert(context && src && size && geometry);
+
+   pixman_box32_t box;
+   if (!box_from_geometry(context, geometry, &box))
+      return;
+
+   const int32_t w = box.x2 - box.x1, h = box.y2 - box.y1;
+
+   if ((uint32_t)w != size->w || (uint32_t)h != size->h) {
+      pixman_transform_t transform;
+      pixman_transform_init_scale(&transform, pixman_double_to_fixed((double)size->w / w), pixman_double_to_fixed((double)size->h / h));
+      pixman_image_set_transform(src, &transform);
+      pixman_image_set_filter(src, PIXMAN_FILTER_BILINEAR, NULL, 0);
+   } else {
+      pixman_image_set_transform(src, NULL);
+      pixman_image_set_filter(src, PIXMAN_FILTER_NEAREST, NULL, 0);
+   }
+
+   pixman_image_composite32(op, src, NULL, context->target, 0, 0, 0, 0, box.x1, box.y1, w, h);
+}
+
+static void
+fill(struct ctx *context, const pixman_color_t *color, const struct wlc_geometry *geometry)
+{
+   assert(context && color && geometry);
+
+   pixman_box32_t box;
+   if (!box_from_geometry(context, geometry, &box))
+      return;
+
+   pixman_image_fill_boxes(PIXMAN_OP_SRC, context->target, color, 1, &box);
+}
+
+static void
+resolution(struct ctx *context, const struct wlc_size *mode, const struct wlc_size *resolution, uint32_t scale)
+{
+   assert(context && mode && resolution && scale > 0);
+   context->mode = *mode;
+   context->resolution = *resolution;
+   context->scale = scale;
+}
+
+static void
+surface_destroy(struct ctx *context, struct wlc_context *bound, struct wlc_surface *surface)
+{
+   (void)context, (void)bound;
+   assert(surface);
+   memset(&surface->shm, 0, sizeof(surface->shm));
+   wlc_dlog(WLC_DBG_RENDER, "-> Destroyed surface");
+}
+
+static bool
+surface_attach(struct ctx *context, struct wlc_context *bound, struct wlc_surface *surface, struct wlc_buffer *buffer)
+{
+   assert(context && bound && surface);
+
+   struct wl_resource *wl_buffer;
+   if (!buffer || !(wl_buffer = convert_to_wl_resource(buffer, "buffer"))) {
+      surface_destroy(context, bound, surface);
+      return true;
+   }
+
+   // Nothing is uploaded, the buffer is read directly when painting
+   struct wl_shm_buffer *shm_buffer;
+   if (!(shm_buffer = wl_shm_buffer_get(wl_buffer))) {
+      wlc_log(WLC_LOG_WARN, "pixman: Only shm buffers are supported");
+      return false;
+   }
+
+   const uint32_t shm_format = wl_shm_buffer_get_format(shm_buffer);
+   if (!shm_format_to_pixman(shm_format)) {
+      /* unknown shm buffer format */
+      return false;
+   }
+
+   buffer->shm_buffer = shm_buffer;
+   buffer->size.w = wl_shm_buffer_get_width(shm_buffer);
+   buffer->size.h = wl_shm_buffer_get_height(shm_buffer);
+   surface->format = (shm_format == WL_SHM_FORMAT_ARGB8888 ? SURFACE_RGBA : SURFACE_RGB);
+
+   struct wlc_view *view;
+   if ((view = convert_from_wlc_handle(surface->view, "view")) && is_x11_view(view))
+      wlc_x11_window_set_surface_format(surface, &view->x11);
+
+   surface->shm.size = buffer->size;
+   surface->shm.pitch = wl_shm_buffer_get_stride(shm_buffer);
+   surface->shm.format = shm_format;
+
+   wlc_dlog(WLC_DBG_RENDER, "-> Attached surface (%" PRIuWLC ") with buffer of size (%ux%u)", convert_to_wlc_resource(surface), buffer->size.w, buffer->size.h);
+   return true;
+}
+
+static pixman_format_code_t
+paint_format(uint32_t shm_format, bool opaque)
+{
+   const pixman_format_code_t format = shm_format_to_pixman(shm_format);
+
+   // x11 windows without alpha visual may still have garbage in the alpha channel
+   return (opaque && format == PIXMAN_a8r8g8b8 ? PIXMAN_x8r8g8b8 : format);
+}
+
+static const struct wlc_geometry*
+paint_geometry(struct wlc_surface *surface, const struct wlc_geometry *geometry, const struct wlc_geometry *visible)
+{
+   assert(surface && geometry && visible);
+   // black borders are requested
+   return (!wlc_size_equals(&surface->size, &geometry->size) && !wlc_geometry_equals(visible, geometry) ? visible : geometry);
+}
+
+static void
+paint_bits(struct ctx *context, pixman_format_code_t format, void *data, const struct wlc_size *size, int32_t stride, const struct wlc_geometry *geometry, const struct wlc_geometry *visible)
+{
+   assert(context && data && size && geometry && visible);
+
+   if (!wlc_geometry_equals(visible, geometry))
+      fill(context, &(pixman_color_t){ 0, 0, 0, 0xffff }, geometry);
+
+   pixman_image_t *image;
+   if (!(image = pixman_image_create_bits(format, size->w, size->h, data, stride)))
+      return;
+
+   composite(context, (PIXMAN_FORMAT_A(format) ? PIXMAN_OP_OVER : PIXMAN_OP_SRC), image, size, visible);
+   pixman_image_unref(image);
+}
+
+static struct wl_shm_buffer*
+committed_shm_buffer(struct wlc_surface *surface, struct wlc_buffer **out_buffer)
+{
+   assert(surface && out_buffer);
+
+   // Buffer may have been destroyed by the client since attach, only trust what is committed now
+   struct wl_resource *wl_buffer;
+   struct wl_shm_buffer *shm_buffer;
+   if (!(*out_buffer = wlc_surface_get_buffer(surface)) ||
+       !(wl_buffer = convert_to_wl_resource(*out_buffer, "buffer")) ||
+       !(shm_buffer = wl_shm_buffer_get(wl_buffer)) ||
+       !shm_format_to_pixman(wl_shm_buffer_get_format(shm_buffer)))
+      return NULL;
+
+   return shm_buffer;
+}
+
+static void
+surface_paint_internal(struct ctx *context, struct wlc_surface *surface, const struct wlc_geometry *geometry, const struct wlc_geometry *visible)
+{
+   assert(context && surface && geometry && visible);
+
+   struct wlc_buffer *buffer;
+   struct wl_shm_buffer *shm_buffer;
+   if (!(shm_buffer = committed_shm_buffer(surface, &buffer)))
+      return;
+
+   const pixman_format_code_t format = paint_format(wl_shm_buffer_get_format(shm_buffer), surface->format == SURFACE_RGB);
+   const struct wlc_size size = { wl_shm_buffer_get_width(shm_buffer), wl_shm_buffer_get_height(shm_buffer) };
+
+   wl_shm_buffer_begin_access(shm_buffer);
+   paint_bits(context, format, wl_shm_buffer_get_data(shm_buffer), &size, wl_shm_buffer_get_stride(shm_buffer), geometry, paint_geometry(surface, geometry, visible));
+   wl_shm_buffer_end_access(shm_buffer);
+}
+
+static void
+surface_paint(struct ctx *context, struct wlc_surface *surface, const struct wlc_geometry *geometry)
+{
+   surface_paint_internal(context, surface, geometry, geometry);
+}
+
+static void
+view_paint(struct ctx *context, struct wlc_view *view)
+{
+   assert(context && view);
+
+   struct wlc_surface *surface;
+   if (!(surface = convert_from_wlc_resource(view->surface, "surface")))
+      return;
+
+   struct wlc_geometry geometry, visible;
+   wlc_view_get_bounds(view, &geometry, &visible);
+   surface_paint_internal(context, surface, &geometry, &visible);
+}
+
+static void
+pointer_paint(struct ctx *context, const struct wlc_point *pos)
+{
+   assert(context);
+   struct wlc_geometry g = { *pos, { 14, 14 } };
+   composite(context, PIXMAN_OP_OVER, context->cursor, &g.size, &g);
+}
+
+static void
+clamp_to_bounds(struct wlc_geometry *g, const struct wlc_size *bounds)
+{
+   assert(g);
+
+   if (g->origin.x < 0) {
+      g->size.w = ((uint32_t)-g->origin.x < g->size.w ? g->size.w + g->origin.x : 0);
+      g->origin.x = 0;
+   } else if ((uint32_t)g->origin.x > bounds->w) {
+      g->origin.x = bounds->w;
+   }
+
+   if (g->origin.y < 0) {
+      g->size.h = ((uint32_t)-g->origin.y < g->size.h ? g->size.h + g->origin.y : 0);
+      g->origin.y = 0;
+   } else if ((uint32_t)g->origin.y > bounds->h) {
+      g->origin.y = bounds->h;
+   }
+
+   if (g->origin.x + g->size.w > bounds->w)
+      g->size.w = bounds->w - g->origin.x;
+
+   if (g->origin.y + g->size.h > bounds->h)
+      g->size.h = bounds->h - g->origin.y;
+}
+
+static void
+read_pixels(struct ctx *context, enum wlc_pixel_format format, const struct wlc_geometry *geometry, struct wlc_geometry *out_geometry, void *out_data)
+{
+   assert(context && geometry && out_geometry && out_data);
+
+   struct wlc_geometry g = *geometry;
+   clamp_to_bounds(&g, &context->mode);
+   *out_geometry = g;
+
+   if (!g.size.w || !g.size.h)
+      return;
+
+   pixman_image_t *dst;
+   if (!(dst = pixman_image_create_bits(pixel_format_to_pixman(format), g.size.w, g.size.h, out_data, g.size.w * 4)))
+      return;
+
+   // Rows are returned bottom to top, same as glReadPixels in GLES2 renderer
+   pixman_transform_t flip = {{
+      { pixman_fixed_1, 0, pixman_int_to_fixed(g.origin.x) },
+      { 0, -pixman_fixed_1, pixman_int_to_fixed(g.origin.y + g.size.h) },
+      { 0, 0, pixman_fixed_1 },
+   }};
+   pixman_image_set_transform(context->target, &flip);
+   pixman_image_composite32(PIXMAN_OP_SRC, context->target, NULL, dst, 0, 0, 0, 0, 0, 0, g.size.w, g.size.h);
+   pixman_image_set_transform(context->target, NULL);
+   pixman_image_unref(dst);
+}
+
+static void
+write_pixels(struct ctx *context, enum wlc_pixel_format format, const struct wlc_geometry *geometry, const void *data)
+{
+   assert(context && geometry && data);
+
+   struct wlc_geometry g = *geometry;
+   clamp_to_bounds(&g, &context->mode);
+
+   if (!g.size.w || !g.size.h)
+      return;
+
+   pixman_image_t *src;
+   if (!(src = pixman_image_create_bits(pixel_format_to_pixman(format), geometry->size.w, geometry->size.h, (uint32_t*)data, geometry->size.w * 4)))
+      return;
+
+   // Composited straight into the framebuffer, blended the same way GLES2 renderer blends its fakefb
+   pixman_image_composite32(PIXMAN_OP_OVER, src, NULL, context->target, g.origin.x - geometry->origin.x, g.origin.y - geometry->origin.y, 0, 0, g.origin.x, g.origin.y, g.size.w, g.size.h);
+   pixman_image_unref(src);
+}
+
+static void
+clear(struct ctx *context)
+{
+   assert(context);
+   const pixman_box32_t box = { 0, 0, pixman_image_get_width(context->target), pixman_image_get_height(context->target) };
+   pixman_image_fill_boxes(PIXMAN_OP_CLEAR, context->target, &(pixman_color_t){ 0, 0, 0, 0 }, 1, &box);
+}
+
+static void
+scissor(struct ctx *context, const struct wlc_geometry *geometry)
+{
+   assert(context);
+
+   pixman_box32_t box;
+   if (!geometry || !box_from_geometry(context, geometry, &box)) {
+      pixman_image_set_clip_region32(context->target, NULL);
+      return;
+   }
+
+   pixman_region32_t clip;
+   pixman_region32_init_rect(&clip, box.x1, box.y1, box.x2 - box.x1, box.y2 - box.y1);
+   pixman_image_set_clip_region32(context->target, &clip);
+   pixman_region32_fini(&clip);
+}
+
+static bool
+item_snapshot(struct ctx *context, struct wlc_surface *surface, const struct wlc_geometry *geometry, const struct wlc_geometry *visible, struct wlc_render_item *out_item)
+{
+   (void)context;
+   assert(surface && geometry && visible && out_item);
+
+   struct wlc_buffer *buffer;
+   struct wl_shm_buffer *shm_buffer;
+   if (!(shm_buffer = committed_shm_buffer(surface, &buffer)))
+      return false;
+
+   out_item->geometry = *geometry;
+   out_item->visible = *paint_geometry(surface, geometry, visible);
+   out_item->size = (struct wlc_size){ wl_shm_buffer_get_width(shm_buffer), wl_shm_buffer_get_height(shm_buffer) };
+   out_item->stride = wl_shm_buffer_get_stride(shm_buffer);
+   out_item->format = wl_shm_buffer_get_format(shm_buffer);
+   out_item->opaque = (surface->format == SURFACE_RGB);
+
+   // Client may truncate its pool at any time, copy while SIGBUS is handled for this thread
+   const size_t bytes = (size_t)out_item->stride * out_item->size.h;
+   if (!(out_item->data = malloc(bytes)))
+      return false;
+
+   wl_shm_buffer_begin_access(shm_buffer);
+   memcpy(out_item->data, wl_shm_buffer_get_data(shm_buffer), bytes);
+   wl_shm_buffer_end_access(shm_buffer);
+   out_item->owned = true;
+   return true;
+}
+
+static void
+item_paint(struct ctx *context, const struct wlc_render_item *item)
+{
+   assert(context && item);
+   scissor(context, &item->scissor);
+   paint_bits(context, paint_format(item->format, item->opaque), item->data, &item->size, item->stride, &item->geometry, &item->visible);
+}
+
+static void
+terminate(struct ctx *context)
+{
+   assert(context);
+
+   if (context->target) {
+      pixman_image_set_clip_region32(context->target, NULL);
+      pixman_image_unref(context->target);
+   }
+
+   if (context->cursor)
+      pixman_image_unref(context->cursor);
+
+   free(context);
+}
+
+static struct ctx*
+create_context(pixman_image_t *target)
+{
+   assert(target);
+
+   struct ctx *context;
+   if (!(context = calloc(1, sizeof(struct ctx))))
+      return NULL;
+
+   context->target = pixman_image_ref(target);
+
+   if (!(context->cursor = pixman_image_create_bits(PIXMAN_a8r8g8b8, 14, 14, NULL, 0)))
+      goto fail;
+
+   // 0 == black, 1 == white, 2 == transparent
+   const uint32_t palette[] = { 0xff000000, 0xffffffff, 0x00000000 };
+   uint32_t *pixels = pixman_image_get_data(context->cursor);
+   const int stride = pixman_image_get_stride(context->cursor) / 4;
+   for (uint32_t y = 0; y < 14; ++y) {
+      for (uint32_t x = 0; x < 14; ++x)
+         pixels[y * stride + x] = palette[cursor_palette[y * 14 + x]];
+   }
+
+   return context;
+
+fail:
+   terminate(context);
+   return NULL;
+}
+
+void*
+wlc_pixman(struct wlc_context *context, struct wlc_render_api *api)
+{
+   assert(context && api);
+
+   pixman_image_t *target;
+   if (!(target = wlc_context_get_framebuffer(context)))
+      return NULL;
+
+   struct ctx *ctx;
+   if (!(ctx = create_context(target)))
+      return NULL;
+
+   api->renderer_type = WLC_RENDERER_PIXMAN;
+   api->terminate = terminate;
+   api->resolution = resolution;
+   api->surface_destroy = surface_destroy;
+   api->surface_attach = surface_attach;
+   api->view_paint = view_paint;
+   api->surface_paint = surface_paint;
+   api->pointer_paint = pointer_paint;
+   api->read_pixels = read_pixels;
+   api->write_pixels = write_pixels;
+   api->clear = clear;
+   api->scissor = scissor;
+   api->item_snapshot = item_snapshot;
+   api->item_paint = item_paint;
+
+   wlc_log(WLC_LOG_INFO, "Pixman renderer initialized");
+   return ctx;
+}
+
+static const uint8_t cursor_palette[] = {
+   0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x02,
+   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02, 0x02,
+   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02, 0x02, 0x02,
+   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02, 0x02, 0x02,
+   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02, 0x02,
+   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02,
+   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02,
+   0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+   0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02,
+   0x01, 0x00, 0x01, 0x02, 0x02, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02,
+   0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x01, 0x00, 0x00, 0x00, 0x01, 0x02, 0x02, 0x02,
+   0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x02, 0x01, 0x00, 0x01, 0x02, 0x02, 0x02, 0x02,
+   0x01, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x01, 0x02, 0x02, 0x02, 0x02, 0x02
+};
@@ -0,0 +1,9 @@
+#ifndef _WLC_PIXMAN_RENDER_H_
+#define _WLC_PIXMAN_RENDER_H_
+
+struct wlc_context;
+struct wlc_render_api;
+
+void* wlc_pixman(struct wlc_context *context, struct wlc_render_api *api);
+
+#endif /* _WLC_PIXMAN_RENDER_H_ */
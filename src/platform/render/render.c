@@ -1,9 +1,17 @@
 #include <stdlib.h>
 #include <assert.h>
+#include <chck/string/string.h>
+#include <chck/overflow/overflow.h>
 #include "internal.h"
 #include "platform/context/context.h"
 #include "render.h"
 #include "gles2.h"
+#include "pixman.h"
+
+static struct {
+   enum wlc_renderer renderer;
+   bool set;
+} preferred;
 
 void
 wlc_render_resolution(struct wlc_render *render, struct wlc_context *bound, const struct wlc_size *mode, const struct wlc_size *resolution, uint32_t scale)
@@ -115,6 +123,159 @@ wlc_render_clear(struct wlc_render *render, struct wlc_context *bound)
    render->api.clear(render->render);
 }
 
+void
+wlc_render_scissor(struct wlc_render *render, struct wlc_context *bound, const struct wlc_geometry *geometry)
+{
+   assert(render);
+
+   if (!render->api.scissor || !wlc_context_bind(bound))
+      return;
+
+   render->api.scissor(render->render, geometry);
+}
+
+void
+wlc_render_invalidate(struct wlc_render *render, struct wlc_context *bound)
+{
+   assert(render);
+
+   if (!render->api.invalidate || !wlc_context_bind(bound))
+      return;
+
+   render->api.invalidate(render->render);
+}
+
+void
+wlc_render_submit(struct wlc_render *render, struct wlc_context *bound)
+{
+   assert(render);
+
+   if (!render->api.submit || !wlc_context_bind(bound))
+      return;
+
+   render->api.submit(render->render);
+}
+
+bool
+wlc_render_readback_begin(struct wlc_render *render, struct wlc_context *bound, enum wlc_pixel_format format, const struct wlc_geometry *geometry, struct wlc_readback *out_readback)
+{
+   assert(render && bound && geometry && out_readback);
+   memset(out_readback, 0, sizeof(struct wlc_readback));
+   out_readback->slot = -1;
+
+   if (!wlc_context_bind(bound))
+      return false;
+
+   if (render->api.readback_begin && (out_readback->slot = render->api.readback_begin(render->render, format, geometry, &out_readback->geometry)) >= 0)
+      return true;
+
+   // No asynchronous readback, read now and hand out the copy later
+   if (!render->api.read_pixels || !(out_readback->data = chck_malloc_mul_of((size_t)geometry->size.w * geometry->size.h, 4)))
+      return false;
+
+   render->api.read_pixels(render->render, format, geometry, &out_readback->geometry, out_readback->data);
+   return true;
+}
+
+const void*
+wlc_render_readback_map(struct wlc_render *render, struct wlc_context *bound, struct wlc_readback *readback, bool wait)
+{
+   assert(render && bound && readback);
+
+   if (readback->slot < 0)
+      return readback->data;
+
+   if (!render->api.readback_map || !wlc_context_bind(bound))
+      return NULL;
+
+   return render->api.readback_map(render->render, readback->slot, wait);
+}
+
+void
+wlc_render_readback_end(struct wlc_render *render, struct wlc_context *bound, struct wlc_readback *readback)
+{
+   assert(render && bound && readback);
+
+   if (readback->slot >= 0 && render->api.readback_end && wlc_context_bind(bound))
+      render->api.readback_end(render->render, readback->slot);
+
+   free(readback->data);
+   memset(readback, 0, sizeof(struct wlc_readback));
+   readback->slot = -1;
+}
+
+bool
+wlc_render_item_snapshot(struct wlc_render *render, struct wlc_surface *surface, const struct wlc_geometry *geometry, const struct wlc_geometry *visible, struct wlc_render_item *out_item)
+{
+   assert(render && surface && geometry && visible && out_item);
+   memset(out_item, 0, sizeof(struct wlc_render_item));
+
+   if (!render->api.item_snapshot)
+      return false;
+
+   return render->api.item_snapshot(render->render, surface, geometry, visible, out_item);
+}
+
+void
+wlc_render_item_paint(struct wlc_render *render, const struct wlc_render_item *item)
+{
+   assert(render && item);
+
+   // No context binding here, items are painted from render threads
+   if (!render->api.item_paint)
+      return;
+
+   render->api.item_paint(render->render, item);
+}
+
+void
+wlc_render_item_release(struct wlc_render_item *item)
+{
+   assert(item);
+
+   if (item->owned)
+      free(item->data);
+
+   memset(item, 0, sizeof(struct wlc_render_item));
+}
+
+bool
+wlc_render_has_items(struct wlc_render *render)
+{
+   assert(render);
+   return (render->api.item_snapshot && render->api.item_paint);
+}
+
+void
+wlc_render_set_preferred(enum wlc_renderer renderer)
+{
+   preferred.renderer = renderer;
+   preferred.set = true;
+}
+
+enum wlc_renderer
+wlc_render_get_preferred(void)
+{
+   if (!preferred.set) {
+      const char *env;
+      preferred.renderer = WLC_NO_RENDERER;
+
+      if ((env = getenv("WLC_RENDERER"))) {
+         if (chck_cstreq(env, "gles2")) {
+            preferred.renderer = WLC_RENDERER_GLES2;
+         } else if (chck_cstreq(env, "pixman")) {
+            preferred.renderer = WLC_RENDERER_PIXMAN;
+         } else {
+            wlc_log(WLC_LOG_WARN, "Unknown WLC_RENDERER '%s'", env);
+         }
+      }
+
+      preferred.set = true;
+   }
+
+   return preferred.renderer;
+}
+
 void
 wlc_render_release(struct wlc_render *render, struct wlc_context *bound)
 {
@@ -139,13 +300,15 @@ wlc_render(struct wlc_render *render, struct wlc_context *context)
    if (!wlc_context_bind(context))
       return NULL;
 
-   void* (*constructor[])(struct wlc_render_api*) = {
+   // Renderers refuse contexts they can't draw to, so the context decides which one we get
+   void* (*constructor[])(struct wlc_context*, struct wlc_render_api*) = {
       wlc_gles2,
+      wlc_pixman,
       NULL
    };
 
    for (uint32_t i = 0; constructor[i]; ++i) {
-      if ((render->render = constructor[i](&render->api)))
+      if ((render->render = constructor[i](context, &render->api)))
          return true;
    }
 
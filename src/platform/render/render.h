@@ -16,6 +16,25 @@ struct wlc_point;
 struct wlc_geometry;
 struct ctx;
 
+// Paint command snapshotted on the main thread, so it can be painted off it.
+// Data is a copy of the client's shm buffer, render threads never touch client memory.
+struct wlc_render_item {
+   struct wlc_geometry geometry, visible, scissor;
+   struct wlc_size size;
+   void *data;
+   int32_t stride;
+   uint32_t format; // wl_shm format
+   bool opaque; // ignore alpha channel
+   bool owned; // data is freed on release, items sharing it with an owner don't free it
+};
+
+// Pixel read in flight, data is only valid between map and end
+struct wlc_readback {
+   struct wlc_geometry geometry; // clamped
+   void *data; // synchronously read data, when the renderer has no asynchronous readback
+   int32_t slot;
+};
+
 struct wlc_render_api {
    enum wlc_renderer renderer_type;
    WLC_NONULL void (*terminate)(struct ctx *render);
@@ -29,6 +48,22 @@ struct wlc_render_api {
    WLC_NONULL void (*write_pixels)(struct ctx *render, enum wlc_pixel_format format, const struct wlc_geometry *geometry, const void *data);
    WLC_NONULL void (*flush_fakefb)(struct ctx *render);
    WLC_NONULL void (*clear)(struct ctx *render);
+   WLC_NONULLV(1) void (*scissor)(struct ctx *render, const struct wlc_geometry *geometry);
+
+   // Optional, forget cached state after user code had the chance to change it
+   WLC_NONULL void (*invalidate)(struct ctx *render);
+
+   // Optional, draw everything queued so far. Called before anything outside the renderer draws.
+   WLC_NONULL void (*submit)(struct ctx *render);
+
+   // Optional, asynchronous pixel reads. begin returns -1 if the read has to be done synchronously instead.
+   WLC_NONULL int32_t (*readback_begin)(struct ctx *render, enum wlc_pixel_format format, const struct wlc_geometry *geometry, struct wlc_geometry *out_geometry);
+   WLC_NONULL const void* (*readback_map)(struct ctx *render, int32_t slot, bool wait);
+   WLC_NONULL void (*readback_end)(struct ctx *render, int32_t slot);
+
+   // Optional, renderers without thread affinity implement these to be used from render threads
+   WLC_NONULL bool (*item_snapshot)(struct ctx *render, struct wlc_surface *surface, const struct wlc_geometry *geometry, const struct wlc_geometry *visible, struct wlc_render_item *out_item);
+   WLC_NONULL void (*item_paint)(struct ctx *render, const struct wlc_render_item *item);
 };
 
 struct wlc_render {
@@ -46,6 +81,18 @@ WLC_NONULL void wlc_render_read_pixels(struct wlc_render *render, struct wlc_con
 WLC_NONULL void wlc_render_write_pixels(struct wlc_render *render, struct wlc_context *bound, enum wlc_pixel_format format, const struct wlc_geometry *geometry, const void *data);
 WLC_NONULL void wlc_render_flush_fakefb(struct wlc_render *render, struct wlc_context *bound); // only relevant to GLES2
 WLC_NONULL void wlc_render_clear(struct wlc_render *render, struct wlc_context *bound);
+WLC_NONULLV(1,2) void wlc_render_scissor(struct wlc_render *render, struct wlc_context *bound, const struct wlc_geometry *geometry);
+WLC_NONULL void wlc_render_invalidate(struct wlc_render *render, struct wlc_context *bound);
+WLC_NONULL void wlc_render_submit(struct wlc_render *render, struct wlc_context *bound);
+WLC_NONULL bool wlc_render_readback_begin(struct wlc_render *render, struct wlc_context *bound, enum wlc_pixel_format format, const struct wlc_geometry *geometry, struct wlc_readback *out_readback);
+WLC_NONULL const void* wlc_render_readback_map(struct wlc_render *render, struct wlc_context *bound, struct wlc_readback *readback, bool wait);
+WLC_NONULL void wlc_render_readback_end(struct wlc_render *render, struct wlc_context *bound, struct wlc_readback *readback);
+WLC_NONULL bool wlc_render_item_snapshot(struct wlc_render *render, struct wlc_surface *surface, const struct wlc_geometry *geometry, const struct wlc_geometry *visible, struct wlc_render_item *out_item);
+WLC_NONULL void wlc_render_item_paint(struct wlc_render *render, const struct wlc_render_item *item); // safe to call from render thread
+WLC_NONULL void wlc_render_item_release(struct wlc_render_item *item);
+WLC_NONULL bool wlc_render_has_items(struct wlc_render *render);
+void wlc_render_set_preferred(enum wlc_renderer renderer);
+enum wlc_renderer wlc_render_get_preferred(void);
 void wlc_render_release(struct wlc_render *render, struct wlc_context *context);
 WLC_NONULL bool wlc_render(struct wlc_render *render, struct wlc_context *context);
 
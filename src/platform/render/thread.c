@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <wayland-server.h>
+#include "internal.h"
+#include "thread.h"
+
+// Only touches the render context and the items, everything else stays on the main thread.
+// Renderers opt in by implementing item_snapshot and item_paint, which only pixman does.
+// GLES2 outputs keep painting on the main loop: their textures are uploaded on the main
+// thread's current EGL context, and per-output contexts would need those uploads moved too.
+
+struct wlc_render_thread {
+   pthread_t thread;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   struct wl_event_source *event_source;
+   struct chck_iter_pool items;
+   struct wlc_render render;
+   void (*done)(void *data);
+   void *data;
+   int fd;
+   bool busy, quit; // protected by mutex
+   bool submitted; // main thread only
+};
+
+static void*
+thread_main(void *data)
+{
+   struct wlc_render_thread *thread = data;
+   pthread_mutex_lock(&thread->mutex);
+
+   for (;;) {
+      while (!thread->busy && !thread->quit)
+         pthread_cond_wait(&thread->cond, &thread->mutex);
+
+      // Frame in flight is painted before quitting
+      if (!thread->busy)
+         break;
+
+      pthread_mutex_unlock(&thread->mutex);
+
+      struct wlc_render_item *i;
+      chck_iter_pool_for_each(&thread->items, i)
+         wlc_render_item_paint(&thread->render, i);
+
+      pthread_mutex_lock(&thread->mutex);
+      thread->busy = false;
+      pthread_cond_signal(&thread->cond);
+
+      // Wake up the main loop, eventfd writes only fail if the counter would overflow
+      const uint64_t one = 1;
+      while (write(thread->fd, &one, sizeof(one)) < 0 && errno == EINTR);
+   }
+
+   pthread_mutex_unlock(&thread->mutex);
+   return NULL;
+}
+
+static bool
+collect(struct wlc_render_thread *thread)
+{
+   assert(thread);
+
+   pthread_mutex_lock(&thread->mutex);
+   const bool painted = (thread->submitted && !thread->busy);
+   pthread_mutex_unlock(&thread->mutex);
+
+   if (!painted)
+      return false;
+
+   chck_iter_pool_for_each_call(&thread->items, wlc_render_item_release);
+   chck_iter_pool_flush(&thread->items);
+   thread->submitted = false;
+   return true;
+}
+
+static int
+cb_painted(int fd, uint32_t mask, void *data)
+{
+   (void)mask;
+   struct wlc_render_thread *thread = data;
+
+   uint64_t count;
+   if (read(fd, &count, sizeof(count)) != sizeof(count))
+      return 0;
+
+   if (collect(thread))
+      thread->done(thread->data);
+
+   return 0;
+}
+
+void
+wlc_render_thread_submit(struct wlc_render_thread *thread, const struct wlc_render *render, struct chck_iter_pool *items)
+{
+   assert(thread && render && items && !thread->submitted);
+
+   struct chck_iter_pool tmp = thread->items;
+   thread->items = *items;
+   *items = tmp;
+
+   pthread_mutex_lock(&thread->mutex);
+   thread->render = *render;
+   thread->busy = thread->submitted = true;
+   pthread_cond_signal(&thread->cond);
+   pthread_mutex_unlock(&thread->mutex);
+}
+
+bool
+wlc_render_thread_release(struct wlc_render_thread *thread)
+{
+   if (!thread)
+      return false;
+
+   pthread_mutex_lock(&thread->mutex);
+   thread->quit = true;
+   pthread_cond_signal(&thread->cond);
+   pthread_mutex_unlock(&thread->mutex);
+   pthread_join(thread->thread, NULL);
+
+   const bool submitted = collect(thread);
+
+   if (thread->event_source)
+      wl_event_source_remove(thread->event_source);
+
+   close(thread->fd);
+   chck_iter_pool_release(&thread->items);
+   pthread_cond_destroy(&thread->cond);
+   pthread_mutex_destroy(&thread->mutex);
+   free(thread);
+   return submitted;
+}
+
+struct wlc_render_thread*
+wlc_render_thread(void (*done)(void *data), void *data)
+{
+   assert(done);
+
+   struct wlc_render_thread *thread;
+   if (!(thread = calloc(1, sizeof(struct wlc_render_thread))))
+      return NULL;
+
+   thread->done = done;
+   thread->data = data;
+
+   if (!chck_iter_pool(&thread->items, 32, 0, sizeof(struct wlc_render_item)))
+      goto pool_fail;
+
+   if ((thread->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+      goto eventfd_fail;
+
+   if (!(thread->event_source = wl_event_loop_add_fd(wlc_event_loop(), thread->fd, WL_EVENT_READABLE, cb_painted, thread)))
+      goto event_source_fail;
+
+   pthread_mutex_init(&thread->mutex, NULL);
+   pthread_cond_init(&thread->cond, NULL);
+
+   if (pthread_create(&thread->thread, NULL, thread_main, thread) != 0)
+      goto thread_fail;
+
+   wlc_log(WLC_LOG_INFO, "Started render thread");
+   return thread;
+
+thread_fail:
+   wlc_log(WLC_LOG_WARN, "Failed to start render thread");
+   pthread_cond_destroy(&thread->cond);
+   pthread_mutex_destroy(&thread->mutex);
+   wl_event_source_remove(thread->event_source);
+event_source_fail:
+   close(thread->fd);
+eventfd_fail:
+   chck_iter_pool_release(&thread->items);
+pool_fail:
+   free(thread);
+   return NULL;
+}
@@ -0,0 +1,20 @@
+#ifndef _WLC_RENDER_THREAD_H_
+#define _WLC_RENDER_THREAD_H_
+
+#include <stdbool.h>
+#include <chck/pool/pool.h>
+#include "render.h"
+
+struct wlc_render_thread;
+
+// Paints snapshotted render items off the main thread.
+// done is called from the main loop once the submitted items are painted and released.
+struct wlc_render_thread* wlc_render_thread(void (*done)(void *data), void *data);
+
+// Takes over the items, leaving the pool empty. Only one frame can be in flight.
+WLC_NONULL void wlc_render_thread_submit(struct wlc_render_thread *thread, const struct wlc_render *render, struct chck_iter_pool *items);
+
+// Waits for the frame in flight without calling done, returns whether there was one.
+bool wlc_render_thread_release(struct wlc_render_thread *thread);
+
+#endif /* _WLC_RENDER_THREAD_H_ */
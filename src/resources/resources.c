@@ -1,5 +1,7 @@
+#include <stdlib.h>
 #include <wayland-util.h>
 #include <chck/math/math.h>
+#include <chck/overflow/overflow.h>
 #include <chck/string/string.h>
 #include "visibility.h"
 #include "internal.h"
@@ -11,10 +13,21 @@
 #undef convert_from_wlc_resource
 #undef convert_from_wlc_handle
 
+// Public handles carry slot index + 1 in the low bits and the slot's generation in the high bits.
+// Generation is bumped when the slot is released, so stale handles to reused slots won't resolve.
+#define HANDLE_INDEX_BITS (sizeof(wlc_handle) > 4 ? 32 : 24)
+#define HANDLE_INDEX_MASK (((wlc_handle)1 << HANDLE_INDEX_BITS) - 1)
+
+// Type names are interned to small integer tags.
+// Lookup names are nearly always string literals, so they are mapped to their tag through a cache keyed by pointer.
+#define TYPES_MAX 64
+#define TYPE_CACHE_SIZE 256
+
 struct handle {
    wlc_resource public; // points to either to this struct handle or struct resource
    wlc_resource private; // the actual type under types/ folder
    struct wlc_source *source; // source this handle exists in
+   struct wl_list link; // in source's handles or resources list
 };
 
 /**
@@ -32,6 +45,19 @@ struct resource {
    } wl;
 
    struct handle handle;
+
+   // resources of the same client in the same source
+   struct client_resources *client;
+   struct wl_list client_link;
+};
+
+/** Index entry for resources of single client in single source. */
+struct client_resources {
+   struct wlc_source *source;
+   struct wl_client *client;
+   struct wl_list resources;
+   struct client_resources *next; // in hash chain
+   size_t index; // in clients.entries
 };
 
 struct handle_info {
@@ -39,90 +65,230 @@ struct handle_info {
    wlc_resource public, private;
 };
 
-struct chck_pool resources;
-struct chck_pool handles;
+struct generations {
+   uint32_t *slots;
+   size_t count;
+};
 
-static void
-relocate_handle(struct handle *handle, void *dest, const void *start, const void *end)
+struct wlc_slab resources;
+struct wlc_slab handles;
+
+static struct generations resource_generations, handle_generations;
+
+// (source, client) -> resources, entries live in slab so their list heads never move
+static struct {
+   struct wlc_slab entries;
+   struct client_resources **buckets;
+   size_t bucket_count;
+} clients;
+
+static struct {
+   const char *names[TYPES_MAX];
+   uint32_t count;
+
+   struct {
+      const char *name;
+      uint32_t type;
+   } cache[TYPE_CACHE_SIZE];
+} types;
+
+static uint32_t
+type_intern(const char *name)
 {
-   assert(handle && dest && start && end);
+   assert(name);
 
-   if ((char*)handle->source < (char*)start || (char*)handle->source > (char*)end)
-      return;
+   for (uint32_t i = 0; i < types.count; ++i) {
+      if (chck_cstreq(types.names[i], name))
+         return i + 1;
+   }
+
+   if (types.count >= TYPES_MAX) {
+      wlc_log(WLC_LOG_ERROR, "Too many handle types, can't intern (%s)", name);
+      return 0;
+   }
 
-   handle->source = (void*)((char*)dest + ((char*)handle->source - (char*)start));
+   types.names[types.count++] = name;
+   return types.count;
+}
+
+static uint32_t
+type_for_name(const char *name)
+{
+   assert(name);
+
+   const size_t slot = (((uintptr_t)name >> 3) ^ ((uintptr_t)name >> 11)) % TYPE_CACHE_SIZE;
+   if (types.cache[slot].name != name) {
+      types.cache[slot].type = type_intern(name);
+      types.cache[slot].name = name;
+   }
+
+   return types.cache[slot].type;
+}
+
+static inline struct generations*
+generations_for_pool(struct wlc_slab *pool)
+{
+   return (pool == &handles ? &handle_generations : &resource_generations);
+}
+
+static bool
+generations_reserve(struct generations *generations, size_t index)
+{
+   assert(generations);
+
+   if (index < generations->count)
+      return true;
+
+   const size_t count = (index + 1 > generations->count * 2 ? index + 1 : generations->count * 2);
+
+   uint32_t *slots;
+   if (!(slots = chck_realloc_mul_of(generations->slots, count, sizeof(uint32_t))))
+      return false;
+
+   memset(slots + generations->count, 0, (count - generations->count) * sizeof(uint32_t));
+   generations->slots = slots;
+   generations->count = count;
+   return true;
 }
 
 static void
-relocate_handles(struct chck_pool *pool, void *dest, const void *start, const void *end)
+generations_release(struct generations *generations)
 {
-   // worst case scenario
-   // when source pool address changes on resize, we need to make sure all inner sources
-   // are relocated to avoid access to garbage location.
+   assert(generations);
+   free(generations->slots);
+   memset(generations, 0, sizeof(struct generations));
+}
 
-   assert(dest && end);
+static inline wlc_handle
+handle_encode(size_t index, uint32_t generation)
+{
+   return (wlc_handle)(index + 1) | ((wlc_handle)generation << HANDLE_INDEX_BITS);
+}
 
-   if (!start)
-      return;
+static inline size_t
+handle_index(wlc_handle handle)
+{
+   return (size_t)(handle & HANDLE_INDEX_MASK) - 1;
+}
 
-   wlc_dlog(WLC_DBG_HANDLE, "Relocating %s at range %p-%p to %p", (pool == &handles ? "handles" : "resources"), start, end, dest);
+static size_t
+client_hash(struct wlc_source *source, struct wl_client *client)
+{
+   const uintptr_t hash = ((uintptr_t)source >> 3) * 2654435761u ^ ((uintptr_t)client >> 3);
+   return hash & (clients.bucket_count - 1);
+}
 
-   if (pool == &resources) {
-      struct resource *r;
-      chck_pool_for_each(pool, r)
-         relocate_handle(&r->handle, dest, start, end);
-   } else {
-      chck_pool_for_each_call(pool, relocate_handle, dest, start, end);
+static struct client_resources*
+client_resources_get(struct wlc_source *source, struct wl_client *client)
+{
+   if (!clients.bucket_count)
+      return NULL;
+
+   for (struct client_resources *c = clients.buckets[client_hash(source, client)]; c; c = c->next) {
+      if (c->source == source && c->client == client)
+         return c;
    }
+
+   return NULL;
 }
 
-static void
-relocate_resources(struct chck_pool *pool)
+static bool
+client_resources_grow(void)
 {
-   // worst case scenario
-   // when resrouce container pool address changes, we need to reset all destructors again
+   if (clients.entries.items.count < clients.bucket_count)
+      return true;
 
-   wlc_dlog(WLC_DBG_HANDLE, "Relocating resources");
+   const size_t count = (clients.bucket_count ? clients.bucket_count * 2 : 32);
 
-   struct resource *r;
-   chck_pool_for_each(pool, r) {
-      if (!r->wl.r)
+   struct client_resources **buckets;
+   if (!(buckets = calloc(count, sizeof(struct client_resources*))))
+      return false;
+
+   free(clients.buckets);
+   clients.buckets = buckets;
+   clients.bucket_count = count;
+
+   struct client_resources *c;
+   wlc_slab_for_each(&clients.entries, c) {
+      const size_t b = client_hash(c->source, c->client);
+      c->next = buckets[b];
+      buckets[b] = c;
+   }
+
+   return true;
+}
+
+static struct client_resources*
+client_resources_add(struct wlc_source *source, struct wl_client *client)
+{
+   assert(source && client);
+
+   struct client_resources *c;
+   if ((c = client_resources_get(source, client)))
+      return c;
+
+   size_t index;
+   if (!client_resources_grow() || !(c = wlc_slab_add(&clients.entries, &index)))
+      return NULL;
+
+   c->source = source;
+   c->client = client;
+   c->index = index;
+   wl_list_init(&c->resources);
+
+   const size_t b = client_hash(source, client);
+   c->next = clients.buckets[b];
+   clients.buckets[b] = c;
+   return c;
+}
+
+static void
+client_resources_remove(struct client_resources *c)
+{
+   assert(c && wl_list_empty(&c->resources));
+
+   for (struct client_resources **p = &clients.buckets[client_hash(c->source, c->client)]; *p; p = &(*p)->next) {
+      if (*p != c)
          continue;
 
-      wl_list_remove(&r->wl.destructor.link);
-      wl_resource_add_destroy_listener(r->wl.r, &r->wl.destructor);
+      *p = c->next;
+      break;
    }
+
+   wlc_slab_remove(&clients.entries, c->index);
+}
+
+static void
+clients_release(void)
+{
+   free(clients.buckets);
+   wlc_slab_release(&clients.entries);
+   memset(&clients, 0, sizeof(clients));
 }
 
 static bool
-handle_create(struct chck_pool *pool, struct wlc_source *source, struct handle_info *out_info)
+handle_create(struct wlc_slab *pool, struct wlc_source *source, struct handle_info *out_info)
 {
    assert(pool && source && out_info);
 
+   // slabs never move their items, so containers and sources nested inside other handles stay valid
    size_t i;
    void *c;
-   uint8_t *original = pool->items.buffer;
-   if (!(c = chck_pool_add(pool, NULL, &i)))
+   if (!(c = wlc_slab_add(pool, &i)))
       return false;
 
-   if (pool == &resources && original != pool->items.buffer)
-      relocate_resources(pool);
-
    size_t h;
    uint8_t *v;
-   original = source->pool.items.buffer;
-   if (!(v = chck_pool_add(&source->pool, NULL, &h)))
+   if (!(v = wlc_slab_add(&source->pool, &h)))
       goto error0;
 
-   if (original != source->pool.items.buffer)
-      relocate_handles(pool, source->pool.items.buffer, original, original + source->pool.items.allocated);
-
-   if (i >= (wlc_resource)~0 || h >= (wlc_resource)~0)
+   struct generations *generations = generations_for_pool(pool);
+   if (i >= HANDLE_INDEX_MASK - 1 || h >= (wlc_resource)~0 || !generations_reserve(generations, i))
       goto error1;
 
    out_info->container = c;
    out_info->data = v;
-   out_info->public = i + 1;
+   out_info->public = handle_encode(i, generations->slots[i]);
    out_info->private = h + 1;
    memcpy(v + source->pool.items.member - sizeof(wlc_handle), &out_info->public, sizeof(wlc_handle));
 
@@ -135,18 +301,18 @@ handle_create(struct chck_pool *pool, struct wlc_source *source, struct handle_i
          goto error1;
    }
 
-   wlc_dlog(WLC_DBG_HANDLE, "New %s (%s) %" PRIuWLC, (pool == &handles ? "handle" : "resource"), source->name, i + 1);
+   wlc_dlog(WLC_DBG_HANDLE, "New %s (%s) %" PRIuWLC, (pool == &handles ? "handle" : "resource"), source->name, out_info->public);
    return true;
 
 error1:
-   chck_pool_remove(&source->pool, h);
+   wlc_slab_remove(&source->pool, h);
 error0:
-   chck_pool_remove(pool, i);
+   wlc_slab_remove(pool, i);
    return false;
 }
 
 static void
-handle_release(struct chck_pool *pool, struct handle *handle, void (*preremove)())
+handle_release(struct wlc_slab *pool, struct handle *handle, void (*preremove)())
 {
    assert(pool);
 
@@ -155,49 +321,58 @@ handle_release(struct chck_pool *pool, struct handle *handle, void (*preremove)(
 
    if (handle->private) {
       void *v;
-      if (handle->source->destructor && (v = chck_pool_get(&handle->source->pool, handle->private - 1))) {
+      if (handle->source->destructor && (v = wlc_slab_get(&handle->source->pool, handle->private - 1))) {
+         // destructor may trigger destruction of other handles, our handle stays in place regardless
          wlc_dlog(WLC_DBG_HANDLE, "=> Calling destructor for (%s) %" PRIuWLC, handle->source->name, handle->public);
-
-         // destructor may trigger destruction of other handles
-         // that may then cause relocation of the containing pool
-         // keep track of the address and relocate our handle after.
-         uint8_t *original = pool->items.buffer;
          handle->source->destructor(v);
-
-         if (pool->items.buffer != original) {
-            wlc_dlog(WLC_DBG_HANDLE, "Pool got relocated after calling destructor. Relocating handle...");
-            handle = (struct handle*)(pool->items.buffer + ((uint8_t*)handle - original));
-         }
-
          wlc_dlog(WLC_DBG_HANDLE, "<= Called destructor for (%s) %" PRIuWLC, handle->source->name, handle->public);
       }
 
-      uint8_t *original = handle->source->pool.items.buffer;
-      chck_pool_remove(&handle->source->pool, handle->private - 1);
-
-      if (original != handle->source->pool.items.buffer)
-         relocate_handles(pool, handle->source->pool.items.buffer, original, original + handle->source->pool.items.allocated);
+      wlc_slab_remove(&handle->source->pool, handle->private - 1);
    }
 
    // called right after removal of the container
    // used by resource handles to do final destruction of wayland resource
+   const size_t index = handle_index(handle->public);
    if (preremove)
-      preremove(chck_pool_get(pool, handle->public - 1));
+      preremove(wlc_slab_get(pool, index));
 
    wlc_dlog(WLC_DBG_HANDLE, "Released %s (%s) %" PRIuWLC, (pool == &handles ? "handle" : "resource"), handle->source->name, handle->public);
+   wl_list_remove(&handle->link);
 
-   void *original = pool->items.buffer;
-   chck_pool_remove(pool, handle->public - 1);
+   // reserved on creation
+   struct generations *generations = generations_for_pool(pool);
+   assert(index < generations->count);
+   generations->slots[index]++;
 
-   if (pool == &resources && original != pool->items.buffer)
-      relocate_resources(pool);
+   wlc_slab_remove(pool, index);
 }
 
 WLC_PURE static bool
-handle_is(struct handle *handle, const char *name)
+handle_is(struct handle *handle, uint32_t type)
 {
-   assert(name);
-   return (handle ? chck_cstreq(handle->source->name, name) : false);
+   return (handle && type && handle->source->type == type);
+}
+
+static struct handle_public*
+handle_for(wlc_handle handle)
+{
+   // the stored public handle carries the generation, comparing it rejects stale and released handles
+   struct handle_public *h;
+   if (!handle || !(h = wlc_slab_get(&handles, handle_index(handle))) || h->handle.public != handle)
+      return NULL;
+
+   return h;
+}
+
+static struct resource*
+resource_for(wlc_resource resource)
+{
+   struct resource *r;
+   if (!resource || !(r = wlc_slab_get(&resources, handle_index(resource))) || r->handle.public != resource)
+      return NULL;
+
+   return r;
 }
 
 static void*
@@ -208,12 +383,12 @@ handle_get(struct handle *handle, const char *name, size_t line, const char *fil
    if (!handle || !handle->private)
       return NULL;
 
-   if (!handle_is(handle, name)) {
+   if (!handle_is(handle, type_for_name(name))) {
       wlc_log(WLC_LOG_WARN, "%s: %zu @ %s(): Tried to retrieve handle of wrong type (%s != %s)", file, line, function, handle->source->name, name);
       return NULL;
    }
 
-   return chck_pool_get(&handle->source->pool, handle->private - 1);
+   return wlc_slab_get(&handle->source->pool, handle->private - 1);
 }
 
 WLC_PURE wlc_handle
@@ -246,6 +421,15 @@ resource_prerelase(struct resource *resource)
    // the r may be NULL here, if container called wlc_resource_invalidate
    // wlc_buffer's do this since they need to destroy the resource differently.
 
+   if (resource->client) {
+      wl_list_remove(&resource->client_link);
+
+      if (wl_list_empty(&resource->client->resources))
+         client_resources_remove(resource->client);
+
+      resource->client = NULL;
+   }
+
    struct wl_resource *r = resource->wl.r;
    resource_invalidate(resource);
 
@@ -265,16 +449,21 @@ resource_release(struct resource *resource)
 bool
 wlc_resources_init(void)
 {
-   return (chck_pool(&resources, 32, 0, sizeof(struct resource)) && chck_pool(&handles, 32, 0, sizeof(struct handle_public)));
+   return (wlc_slab(&resources, 32, sizeof(struct resource)) &&
+           wlc_slab(&handles, 32, sizeof(struct handle_public)) &&
+           wlc_slab(&clients.entries, 32, sizeof(struct client_resources)));
 }
 
 void
 wlc_resources_terminate(void)
 {
-   chck_pool_for_each_call(&resources, wlc_resource_release_ptr);
-   chck_pool_for_each_call(&handles, wlc_handle_release_ptr);
-   chck_pool_release(&resources);
-   chck_pool_release(&handles);
+   wlc_slab_for_each_call(&resources, wlc_resource_release_ptr);
+   wlc_slab_for_each_call(&handles, wlc_handle_release_ptr);
+   wlc_slab_release(&resources);
+   wlc_slab_release(&handles);
+   clients_release();
+   generations_release(&resource_generations);
+   generations_release(&handle_generations);
 }
 
 bool
@@ -284,34 +473,33 @@ wlc_source(struct wlc_source *source, const char *name, bool (*constructor)(), v
    memset(source, 0, sizeof(struct wlc_source));
 
    source->name = name;
+   source->type = type_intern(name);
    source->constructor = constructor;
    source->destructor = destructor;
-   return chck_pool(&source->pool, grow, 0, member + sizeof(wlc_handle));
+   wl_list_init(&source->handles);
+   wl_list_init(&source->resources);
+   return wlc_slab(&source->pool, grow, member + sizeof(wlc_handle));
 }
 
 void
 wlc_source_release(struct wlc_source *source)
 {
-   if (!source)
+   // name is set when source is initialized
+   if (!source || !source->name)
       return;
 
-   struct handle *h;
-   chck_pool_for_each(&handles, h) {
-      if (h->source != source)
-         continue;
-
+   // releasing may release other members of the same source, so always take the first one
+   while (!wl_list_empty(&source->handles)) {
+      struct handle *h = wl_container_of(source->handles.next, h, link);
       handle_release(&handles, h, NULL);
    }
 
-   struct resource *r;
-   chck_pool_for_each(&resources, r) {
-      if (r->handle.source != source)
-         continue;
-
+   while (!wl_list_empty(&source->resources)) {
+      struct resource *r = wl_container_of(source->resources.next, r, handle.link);
       resource_release(r);
    }
 
-   chck_pool_release(&source->pool);
+   wlc_slab_release(&source->pool);
 }
 
 void*
@@ -327,6 +515,7 @@ wlc_handle_create(struct wlc_source *source)
    h->source = source;
    h->public = info.public;
    h->private = info.private;
+   wl_list_insert(source->handles.prev, &h->link);
    return info.data;
 }
 
@@ -335,19 +524,18 @@ convert_from_wlc_handle(wlc_handle handle, const char *name, size_t line, const
 {
    assert(name && file && function);
 
-   if (!handle)
-      return NULL;
-
-   return handle_get(chck_pool_get(&handles, handle - 1), name, line, file, function);
+   struct handle_public *h = handle_for(handle);
+   return (h ? handle_get(&h->handle, name, line, file, function) : NULL);
 }
 
 void
 wlc_handle_release(wlc_handle handle)
 {
-   if (!handle)
+   struct handle_public *h;
+   if (!(h = handle_for(handle)))
       return;
 
-   handle_release(&handles, chck_pool_get(&handles, handle - 1), NULL);
+   handle_release(&handles, &h->handle, NULL);
 }
 
 struct wl_resource*
@@ -423,14 +611,24 @@ wlc_resource_create_from(struct wlc_source *source, struct wl_resource *resource
    if (!resource)
       return 0;
 
+   struct client_resources *c;
+   if (!(c = client_resources_add(source, wl_resource_get_client(resource))))
+      return 0;
+
    struct handle_info info;
-   if (!handle_create(&resources, source, &info))
+   if (!handle_create(&resources, source, &info)) {
+      if (wl_list_empty(&c->resources))
+         client_resources_remove(c);
       return 0;
+   }
 
    struct resource *r = info.container;
    r->handle.source = source;
    r->handle.public = info.public;
    r->handle.private = info.private;
+   wl_list_insert(source->resources.prev, &r->handle.link);
+   r->client = c;
+   wl_list_insert(c->resources.prev, &r->client_link);
    r->wl.r = resource;
    r->wl.destructor.notify = wl_destructor;
    wl_resource_add_destroy_listener(resource, &r->wl.destructor);
@@ -442,10 +640,7 @@ convert_from_wlc_resource(wlc_resource resource, const char *name, size_t line,
 {
    assert(name && file && function);
 
-   if (!resource)
-      return NULL;
-
-   struct resource *r = chck_pool_get(&resources, resource - 1);
+   struct resource *r = resource_for(resource);
    return (r ? handle_get(&r->handle, name, line, file, function) : NULL);
 }
 
@@ -478,10 +673,10 @@ wl_resource_from_wlc_resource(wlc_resource resource, const char *name, size_t li
    assert(name && file && function);
 
    struct resource *r;
-   if (!resource || !(r = chck_pool_get(&resources, resource - 1)))
+   if (!(r = resource_for(resource)))
       return NULL;
 
-   if (!handle_is(&r->handle, name)) {
+   if (!handle_is(&r->handle, type_for_name(name))) {
       wlc_log(WLC_LOG_WARN, "%s: %zu @ %s(): Tried to retrieve resource of wrong type (%s != %s)", file, line, function, r->handle.source->name, name);
       return NULL;
    }
@@ -495,39 +690,64 @@ wl_resource_for_client(struct wlc_source *source, struct wl_client *client)
    assert(source && client);
 
    struct resource *r;
-   chck_pool_for_each(&resources, r) {
-      if (r->handle.source != source || wl_resource_get_client(r->wl.r) != client)
-         continue;
+   if (!(r = resource_for(wlc_resource_first_for_client(source, client))))
+      return NULL;
 
-      return r->wl.r;
+   return r->wl.r;
+}
+
+wlc_resource
+wlc_resource_first_for_client(struct wlc_source *source, struct wl_client *client)
+{
+   assert(source && client);
+
+   struct client_resources *c;
+   if (!(c = client_resources_get(source, client)))
+      return 0;
+
+   struct resource *r;
+   wl_list_for_each(r, &c->resources, client_link) {
+      if (r->wl.r)
+         return r->handle.public;
    }
 
-   return NULL;
+   return 0;
+}
+
+wlc_resource
+wlc_resource_next_for_client(wlc_resource resource)
+{
+   struct resource *r;
+   if (!(r = resource_for(resource)) || !r->client)
+      return 0;
+
+   // invalidated resources have no wayland resource to send to, skip them
+   for (struct wl_list *l = r->client_link.next; l != &r->client->resources; l = l->next) {
+      struct resource *n = wl_container_of(l, n, client_link);
+      if (n->wl.r)
+         return n->handle.public;
+   }
+
+   return 0;
 }
 
 void
 wlc_resource_invalidate(wlc_resource resource)
 {
-   if (!resource)
-      return;
-
-   resource_invalidate(chck_pool_get(&resources, resource - 1));
+   resource_invalidate(resource_for(resource));
 }
 
 void
 wlc_resource_release(wlc_resource resource)
 {
-   if (!resource)
-      return;
-
-   resource_release(chck_pool_get(&resources, resource - 1));
+   resource_release(resource_for(resource));
 }
 
 void
 wlc_resource_implement(wlc_resource resource, const void *implementation, void *userdata)
 {
    struct resource *r;
-   if (!resource || !(r = chck_pool_get(&resources, resource - 1)))
+   if (!(r = resource_for(resource)))
       return;
 
    wl_resource_set_implementation(r->wl.r, implementation, userdata, NULL);
@@ -537,7 +757,7 @@ WLC_API void
 wlc_handle_set_user_data(wlc_handle handle, const void *userdata)
 {
    struct handle_public *h;
-   if (!handle || !(h = chck_pool_get(&handles, handle - 1)))
+   if (!(h = handle_for(handle)))
       return;
 
    h->userdata = (void*)userdata;
@@ -547,7 +767,7 @@ WLC_API WLC_PURE void*
 wlc_handle_get_user_data(wlc_handle handle)
 {
    const struct handle_public *h;
-   if (!handle || !(h = chck_pool_get(&handles, handle - 1)))
+   if (!(h = handle_for(handle)))
       return NULL;
 
    return h->userdata;
@@ -4,7 +4,7 @@
 #include <wlc/wlc.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <chck/pool/pool.h>
+#include "slab.h"
 #include <wayland-server.h>
 
 typedef uintptr_t wlc_resource;
@@ -12,7 +12,9 @@ typedef uintptr_t wlc_resource;
 /** Storage for handles / resources. */
 struct wlc_source {
    const char *name;
-   struct chck_pool pool;
+   uint32_t type; // interned name
+   struct wlc_slab pool;
+   struct wl_list handles, resources; // members in creation order
    bool (*constructor)();
    void (*destructor)();
 };
@@ -39,8 +41,8 @@ void wlc_resources_terminate(void);
 
 /**
  * Initialize source.
- * name should be type name of the handle/resource source will be carrying.
- * grow defines the reallocation step for source.
+ * name should be type name of the handle/resource source will be carrying, it's interned and must outlive the source.
+ * grow defines the item count of each chunk in source, items never move once created.
  * member defines the size of item the source will be carrying.
  */
 WLC_NONULLV(1,2) bool wlc_source(struct wlc_source *source, const char *name, bool (*constructor)(), void (*destructor)(), size_t grow, size_t member);
@@ -104,6 +106,16 @@ struct wl_resource* wl_resource_from_wlc_resource(wlc_resource resource, const c
 /** Get wayland resource for client from source. */
 WLC_NONULL struct wl_resource* wl_resource_for_client(struct wlc_source *source, struct wl_client *client);
 
+/** Get first wlc_resource of client in source, 0 if none. */
+WLC_NONULL wlc_resource wlc_resource_first_for_client(struct wlc_source *source, struct wl_client *client);
+
+/** Get next wlc_resource of the same client in the same source, 0 if none. */
+wlc_resource wlc_resource_next_for_client(wlc_resource resource);
+
+/** Iterate wlc_resources of client in source, current resource must not be released while iterating. */
+#define wlc_resource_for_each_for_client(source, client, pos) \
+   for (pos = wlc_resource_first_for_client(source, client); pos; pos = wlc_resource_next_for_client(pos))
+
 /** Convert to pointer from wlc_resource. */
 void* convert_from_wlc_resource(wlc_resource resource, const char *name, size_t line, const char *file, const char *function);
 #define convert_from_wlc_resource(x, y) convert_from_wlc_resource(x, y, __LINE__, WLC_FILE, __func__)
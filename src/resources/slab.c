@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <chck/overflow/overflow.h>
+#include "slab.h"
+
+static uint8_t*
+chunk_slot(const struct wlc_slab *slab, size_t index)
+{
+   return slab->chunks[index >> slab->shift] + (index & (slab->items.step - 1)) * slab->items.stride;
+}
+
+static uint8_t*
+chunk_live(const struct wlc_slab *slab, size_t index)
+{
+   return slab->chunks[index >> slab->shift] + slab->items.step * slab->items.stride + (index & (slab->items.step - 1));
+}
+
+static bool
+add_chunk(struct wlc_slab *slab)
+{
+   assert(slab);
+
+   if (slab->chunk_count >= slab->chunk_allocated) {
+      // only the array of chunk pointers moves, items stay where they are
+      const size_t allocated = (slab->chunk_allocated ? slab->chunk_allocated * 2 : 4);
+
+      void *chunks;
+      if (!(chunks = chck_realloc_mul_of(slab->chunks, allocated, sizeof(uint8_t*))))
+         return false;
+
+      slab->chunks = chunks;
+      slab->chunk_allocated = allocated;
+   }
+
+   // the liveness flags at the end of chunk must start zeroed
+   uint8_t *chunk;
+   if (!(chunk = calloc(1, slab->items.step * slab->items.stride + slab->items.step)))
+      return false;
+
+   slab->chunks[slab->chunk_count++] = chunk;
+   return true;
+}
+
+bool
+wlc_slab(struct wlc_slab *slab, size_t step, size_t member)
+{
+   assert(slab && step > 0 && member > 0);
+   memset(slab, 0, sizeof(struct wlc_slab));
+
+   // removed slots store the next removed index in place
+   // keep the items pointer aligned as well
+   size_t stride = (member < sizeof(size_t) ? sizeof(size_t) : member);
+   stride = (stride + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+   while (((size_t)1 << slab->shift) < step)
+      ++slab->shift;
+
+   if (slab->shift >= sizeof(size_t) * 8 - 1 || stride + 1 > SIZE_MAX / ((size_t)1 << slab->shift))
+      return false;
+
+   slab->items.member = member;
+   slab->items.stride = stride;
+   slab->items.step = (size_t)1 << slab->shift;
+   return true;
+}
+
+void
+wlc_slab_release(struct wlc_slab *slab)
+{
+   if (!slab)
+      return;
+
+   for (size_t i = 0; i < slab->chunk_count; ++i)
+      free(slab->chunks[i]);
+
+   free(slab->chunks);
+   memset(slab, 0, sizeof(struct wlc_slab));
+}
+
+void*
+wlc_slab_add(struct wlc_slab *slab, size_t *out_index)
+{
+   assert(slab && slab->items.stride);
+
+   size_t index;
+   if (slab->removed) {
+      index = slab->removed - 1;
+      memcpy(&slab->removed, chunk_slot(slab, index), sizeof(size_t));
+   } else {
+      if (slab->items.used >= slab->chunk_count * slab->items.step && !add_chunk(slab))
+         return NULL;
+
+      index = slab->items.used++;
+   }
+
+   uint8_t *item = chunk_slot(slab, index);
+   memset(item, 0, slab->items.stride);
+   *chunk_live(slab, index) = true;
+   slab->items.count++;
+
+   if (out_index)
+      *out_index = index;
+
+   return item;
+}
+
+void
+wlc_slab_remove(struct wlc_slab *slab, size_t index)
+{
+   assert(slab);
+
+   if (!wlc_slab_get(slab, index))
+      return;
+
+   *chunk_live(slab, index) = false;
+   memcpy(chunk_slot(slab, index), &slab->removed, sizeof(size_t));
+   slab->removed = index + 1;
+   slab->items.count--;
+}
@@ -0,0 +1,67 @@
+#ifndef _WLC_SLAB_H_
+#define _WLC_SLAB_H_
+
+#include <wlc/defines.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Pool of fixed size items stored in fixed size chunks.
+ * Chunks are never reallocated, so item addresses stay stable for the item's whole lifetime.
+ * Removed slots are kept in free list and reused by later additions.
+ */
+struct wlc_slab {
+   uint8_t **chunks;
+   size_t chunk_count, chunk_allocated;
+
+   struct {
+      size_t count; // live items
+      size_t used; // slots handed out, live or removed
+      size_t member, stride, step; // stride is member rounded up for alignment
+   } items;
+
+   // log2 of step
+   uint32_t shift;
+
+   // index + 1 of the first removed slot, next removed slot is stored inside the slot
+   size_t removed;
+};
+
+/** Iterate live items, item may be removed while iterating. */
+#define wlc_slab_for_each(slab, pos) \
+   for (size_t _I = 0; _I < (slab)->items.used; ++_I) \
+      if (!((pos) = wlc_slab_get(slab, _I))) {} else
+
+#define wlc_slab_for_each_call(slab, function, ...) \
+{ void *_P; wlc_slab_for_each(slab, _P) function(_P, ##__VA_ARGS__); }
+
+/**
+ * Initialize slab.
+ * step is the item count of single chunk and is rounded up to power of two.
+ */
+WLC_NONULL bool wlc_slab(struct wlc_slab *slab, size_t step, size_t member);
+
+/** Release slab and all its chunks. */
+void wlc_slab_release(struct wlc_slab *slab);
+
+/** Add zero initialized item to slab, returns NULL on allocation failure. */
+WLC_NONULLV(1) void* wlc_slab_add(struct wlc_slab *slab, size_t *out_index);
+
+/** Remove item from slab, the slot may be reused by next addition. */
+WLC_NONULL void wlc_slab_remove(struct wlc_slab *slab, size_t index);
+
+/** Get live item at index, NULL if the slot is removed or out of range. */
+static inline void*
+wlc_slab_get(const struct wlc_slab *slab, size_t index)
+{
+   if (index >= slab->items.used)
+      return NULL;
+
+   // chunk contains step items followed by step bytes of liveness flags
+   uint8_t *chunk = slab->chunks[index >> slab->shift];
+   const size_t slot = index & (slab->items.step - 1);
+   return (chunk[slab->items.step * slab->items.stride + slot] ? chunk + slot * slab->items.stride : NULL);
+}
+
+#endif /* _WLC_SLAB_H_ */
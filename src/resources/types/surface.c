@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <math.h>
 #include <wayland-server.h>
 #include "internal.h"
 #include "surface.h"
@@ -10,6 +11,7 @@
 #include "macros.h"
 #include "compositor/output.h"
 #include "compositor/view.h"
+#include "compositor/presentation.h"
 #include <chck/math/math.h>
 
 static void
@@ -44,7 +46,7 @@ state_set_buffer(struct wlc_surface_state *state, struct wlc_buffer *buffer)
    state->buffer = wlc_buffer_use(buffer);
 }
 
-static void
+static bool
 commit_state(struct wlc_surface *surface, struct wlc_surface_state *pending, struct wlc_surface_state *out)
 {
    out->scale = chck_max32(pending->scale, 1);
@@ -55,6 +57,24 @@ commit_state(struct wlc_surface *surface, struct wlc_surface_state *pending, str
       chck_iter_pool_push_back(&out->frame_cbs, r);
    chck_iter_pool_flush(&pending->frame_cbs);
 
+   // Content of the previous commit never made it to screen
+   chck_iter_pool_for_each_call(&out->feedbacks, wlc_presentation_feedback_discarded_ptr);
+   chck_iter_pool_flush(&out->feedbacks);
+
+   chck_iter_pool_for_each(&pending->feedbacks, r)
+      chck_iter_pool_push_back(&out->feedbacks, r);
+   chck_iter_pool_flush(&pending->feedbacks);
+
+   // Buffer damage in surface coordinates, rounded outwards
+   int nrects;
+   const pixman_box32_t *b = pixman_region32_rectangles(&pending->buffer_damage, &nrects);
+   for (int i = 0; i < nrects; ++i) {
+      const int32_t x1 = floor((float)b[i].x1 / out->scale), y1 = floor((float)b[i].y1 / out->scale);
+      const int32_t x2 = ceil((float)b[i].x2 / out->scale), y2 = ceil((float)b[i].y2 / out->scale);
+      pixman_region32_union_rect(&pending->damage, &pending->damage, x1, y1, x2 - x1, y2 - y1);
+   }
+   pixman_region32_clear(&pending->buffer_damage);
+
    pixman_region32_union(&out->damage, &out->damage, &pending->damage);
    pixman_region32_intersect_rect(&out->damage, &out->damage, 0, 0, surface->size.w, surface->size.h);
    pixman_region32_clear(&surface->pending.damage);
@@ -63,7 +83,8 @@ commit_state(struct wlc_surface *surface, struct wlc_surface_state *pending, str
    pixman_region32_init(&opaque);
    pixman_region32_intersect_rect(&opaque, &pending->opaque, 0, 0, surface->size.w, surface->size.h);
 
-   if (!pixman_region32_equal(&opaque, &out->opaque))
+   const bool opaque_changed = !pixman_region32_equal(&opaque, &out->opaque);
+   if (opaque_changed)
       pixman_region32_copy(&out->opaque, &opaque);
 
    pixman_region32_fini(&opaque);
@@ -77,6 +98,7 @@ commit_state(struct wlc_surface *surface, struct wlc_surface_state *pending, str
 
    state_set_buffer(out, convert_from_wlc_resource(pending->buffer, "buffer"));
    state_set_buffer(pending, NULL);
+   return opaque_changed;
 }
 
 static void
@@ -85,6 +107,7 @@ init_state(struct wlc_surface_state *state)
    assert(state);
    pixman_region32_init_rect(&state->opaque, 0, 0, 0, 0);
    pixman_region32_init_rect(&state->damage, 0, 0, 0, 0);
+   pixman_region32_init_rect(&state->buffer_damage, 0, 0, 0, 0);
    pixman_region32_init_rect(&state->input, INT32_MIN, INT32_MIN, UINT32_MAX, UINT32_MAX);
    state->scale = 1;
    state->subsurface_position = (struct wlc_point){0, 0};
@@ -98,11 +121,14 @@ release_state(struct wlc_surface_state *state)
 
    pixman_region32_fini(&state->opaque);
    pixman_region32_fini(&state->damage);
+   pixman_region32_fini(&state->buffer_damage);
    pixman_region32_fini(&state->input);
 
    state_set_buffer(state, 0);
    chck_iter_pool_for_each_call(&state->frame_cbs, wlc_resource_release_ptr);
    chck_iter_pool_release(&state->frame_cbs);
+   chck_iter_pool_for_each_call(&state->feedbacks, wlc_presentation_feedback_discarded_ptr);
+   chck_iter_pool_release(&state->feedbacks);
 }
 
 static void
@@ -145,6 +171,19 @@ wl_cb_surface_damage(struct wl_client *client, struct wl_resource *resource, int
    wlc_dlog(WLC_DBG_RENDER, "-> Damage request");
 }
 
+static void
+wl_cb_surface_damage_buffer(struct wl_client *client, struct wl_resource *resource, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+   (void)client;
+
+   struct wlc_surface *surface;
+   if (!(surface = convert_from_wl_resource(resource, "surface")))
+      return;
+
+   pixman_region32_union_rect(&surface->pending.buffer_damage, &surface->pending.buffer_damage, x, y, width, height);
+   wlc_dlog(WLC_DBG_RENDER, "-> Buffer damage request");
+}
+
 static void
 wl_cb_surface_frame(struct wl_client *client, struct wl_resource *resource, uint32_t callback_id)
 {
@@ -196,15 +235,48 @@ wl_cb_surface_set_input_region(struct wl_client *client, struct wl_resource *res
    }
 }
 
+static bool
+subsurfaces_moved(struct wlc_surface *surface)
+{
+   assert(surface);
+
+   wlc_resource *r;
+   chck_iter_pool_for_each(&surface->subsurface_list, r) {
+      struct wlc_surface *sub;
+      if ((sub = convert_from_wlc_resource(*r, "surface")) && !wlc_point_equals(&sub->commit.subsurface_position, &sub->pending.subsurface_position))
+         return true;
+   }
+
+   return false;
+}
+
 static void
 commit_subsurface_state(struct wlc_surface *surface)
 {
    if (!surface)
       return;
 
-   commit_state(surface, &surface->pending, &surface->commit);
-   wlc_output_schedule_repaint(convert_from_wlc_handle(surface->output, "output"));
-   wlc_dlog(WLC_DBG_RENDER, "-> Commit request");
+   const struct wlc_size old_size = surface->size;
+   const bool attached = surface->commit.attached;
+   const bool moved = subsurfaces_moved(surface);
+   const bool opaque_changed = commit_state(surface, &surface->pending, &surface->commit);
+
+   // Anything but new content changes what the output's scene covers
+   struct wlc_output *output = convert_from_wlc_handle(surface->output, "output");
+   const bool scene_changed = (opaque_changed || moved || attached != surface->commit.attached || !wlc_size_equals(&old_size, &surface->size));
+   if (scene_changed)
+      wlc_output_invalidate_scene(output);
+
+   struct wlc_view *view = convert_from_wlc_handle(surface->parent_view, "view");
+   if (view && view->state.hidden && (!scene_changed || !output)) {
+      // Nothing of this surface ends up on screen, only keep the client's frame callbacks going
+      wlc_output_schedule_hidden_frame(wlc_view_get_output_ptr(view));
+      wlc_dlog(WLC_DBG_RENDER, "-> Commit request (hidden)");
+   } else if (output) {
+      // Changed scene may uncover a hidden view, so it gets a repaint too
+      wlc_output_surface_commit(output, surface);
+      wlc_dlog(WLC_DBG_RENDER, "-> Commit request");
+   }
 
    wlc_resource *r;
    chck_iter_pool_for_each(&surface->subsurface_list, r) {
@@ -311,6 +383,29 @@ wlc_surface_get_opaque(struct wlc_surface *surface, const struct wlc_point *offs
    return opaque;
 }
 
+void
+wlc_surface_get_opaque_region(struct wlc_surface *surface, const struct wlc_point *offset, pixman_region32_t *out_opaque)
+{
+   pixman_region32_clear(out_opaque);
+
+   if (!surface)
+      return;
+
+   assert(offset && out_opaque);
+
+   int nrects;
+   const float sw = surface->coordinate_transform.w, sh = surface->coordinate_transform.h;
+   const pixman_box32_t *r = pixman_region32_rectangles(&surface->commit.opaque, &nrects);
+   for (int i = 0; i < nrects; ++i) {
+      // Round inwards, partially covered pixels are not opaque
+      const int32_t x1 = ceil(chck_clamp32(r[i].x1, 0, surface->size.w) * sw), y1 = ceil(chck_clamp32(r[i].y1, 0, surface->size.h) * sh);
+      const int32_t x2 = floor(chck_clamp32(r[i].x2, 0, surface->size.w) * sw), y2 = floor(chck_clamp32(r[i].y2, 0, surface->size.h) * sh);
+
+      if (x2 > x1 && y2 > y1)
+         pixman_region32_union_rect(out_opaque, out_opaque, offset->x + x1, offset->y + y1, x2 - x1, y2 - y1);
+   }
+}
+
 void
 wlc_surface_get_input(struct wlc_surface *surface, const struct wlc_point *offset, struct wlc_geometry *out_input)
 {
@@ -419,6 +514,11 @@ wlc_surface_set_parent(struct wlc_surface *surface, struct wlc_surface *parent)
    } else {
       surface->parent = 0;
    }
+
+   // Repaint even when the view is hidden, the surface may now be out of occlusion
+   struct wlc_output *output = convert_from_wlc_handle(surface->output, "output");
+   wlc_output_invalidate_scene(output);
+   wlc_output_schedule_repaint(output);
 }
 
 void
@@ -459,6 +559,7 @@ wlc_surface_commit(struct wlc_surface *surface)
 {
    assert(surface);
    commit_state(surface, &surface->pending, &surface->commit);
+   wlc_output_invalidate_scene(convert_from_wlc_handle(surface->output, "output"));
 }
 
 bool
@@ -472,6 +573,8 @@ wlc_surface(struct wlc_surface *surface)
 
    if (!chck_iter_pool(&surface->commit.frame_cbs, 4, 0, sizeof(wlc_resource)) ||
        !chck_iter_pool(&surface->pending.frame_cbs, 4, 0, sizeof(wlc_resource)) ||
+       !chck_iter_pool(&surface->commit.feedbacks, 4, 0, sizeof(wlc_resource)) ||
+       !chck_iter_pool(&surface->pending.feedbacks, 4, 0, sizeof(wlc_resource)) ||
        !chck_iter_pool(&surface->subsurface_list, 4, 0, sizeof(wlc_resource)))
       goto fail;
 
@@ -498,7 +601,8 @@ wlc_surface_implementation(void)
       .set_input_region = wl_cb_surface_set_input_region,
       .commit = wl_cb_surface_commit,
       .set_buffer_transform = wl_cb_surface_set_buffer_transform,
-      .set_buffer_scale = wl_cb_surface_set_buffer_scale
+      .set_buffer_scale = wl_cb_surface_set_buffer_scale,
+      .damage_buffer = wl_cb_surface_damage_buffer
    };
 
    return &wl_surface_implementation;
@@ -14,10 +14,11 @@ struct wlc_output;
 struct wlc_view;
 
 struct wlc_surface_state {
-   struct chck_iter_pool frame_cbs;
+   struct chck_iter_pool frame_cbs, feedbacks;
    pixman_region32_t opaque;
    pixman_region32_t input;
    pixman_region32_t damage;
+   pixman_region32_t buffer_damage;
    struct wlc_point offset;
    struct wlc_point subsurface_position;
    wlc_resource buffer;
@@ -49,8 +50,18 @@ struct wlc_surface {
    /* The view this surface belongs to, e.g also subsurfaces */
    wlc_handle parent_view;
 
-   /* Current output the surface is attached to */
+   /* Current output the surface is attached to, and index in its surfaces pool */
    wlc_handle output;
+   size_t output_index;
+
+   /* Index in the output's retained scene, and serials of the scene build and committed queue it was last in */
+   struct {
+      size_t index;
+      uint32_t serial, queued;
+   } scene;
+
+   /* Output space geometry the surface was last painted to, used for damage tracking */
+   struct wlc_geometry painted;
 
    /**
     * "Texture" as we use OpenGL terminology, but can be id to anything.
@@ -58,18 +69,41 @@ struct wlc_surface {
     */
    uint32_t textures[3];
 
+   /**
+    * Sampling filter last set on each texture, 0 if unknown.
+    * Managed by the renderer.
+    */
+   uint32_t filters[3];
+
    /**
     * Images, contains hw surfaces that can be anything (For example EGL KHR Images in EGL/gles2 renderer).
     * Managed by the renderer.
     */
    void *images[3];
 
+   /**
+    * Size, pitch and format of the shm buffer last uploaded to textures[0].
+    * Managed by the renderer, while these match only the damaged area needs to be uploaded.
+    */
+   struct {
+      struct wlc_size size;
+      int32_t pitch;
+      uint32_t format;
+   } shm;
+
+   /**
+    * Slot of the renderer's atlas texture holding the surface, empty if the surface has textures of its own.
+    * Managed by the renderer.
+    */
+   struct wlc_geometry atlas;
+
    enum wlc_surface_format format;
 
    bool synchronized, parent_synchronized;
 };
 
 WLC_NONULLV(2,3) bool wlc_surface_get_opaque(struct wlc_surface *surface, const struct wlc_point *offset, struct wlc_geometry *out_opaque);
+WLC_NONULLV(2,3) void wlc_surface_get_opaque_region(struct wlc_surface *surface, const struct wlc_point *offset, pixman_region32_t *out_opaque);
 WLC_NONULLV(2,3) void wlc_surface_get_input(struct wlc_surface *surface, const struct wlc_point *offset, struct wlc_geometry *out_input);
 struct wlc_buffer* wlc_surface_get_buffer(struct wlc_surface *surface);
 void wlc_surface_attach_to_view(struct wlc_surface *surface, struct wlc_view *view);
@@ -2,9 +2,11 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <chck/string/string.h>
+#include <chck/math/math.h>
 #include "internal.h"
 #include "visibility.h"
 #include "compositor/compositor.h"
+#include "platform/backend/headless.h"
 #include "session/tty.h"
 #include "session/fd.h"
 #include "session/udev.h"
@@ -16,6 +18,7 @@ static struct wlc {
    struct wlc_compositor compositor;
    struct wlc_interface interface;
    struct wlc_system_signals signals;
+   struct wlc_options options;
    struct wl_display *display;
    void (*log_fun)(enum wlc_log_type type, const char *str);
    bool active;
@@ -125,6 +128,12 @@ wlc_system_signals(void)
    return &wlc.signals;
 }
 
+struct wlc_options*
+wlc_options(void)
+{
+   return &wlc.options;
+}
+
 struct wl_event_loop*
 wlc_event_loop(void)
 {
@@ -278,6 +287,26 @@ wlc_terminate(void)
    wl_signal_emit(&wlc.signals.terminate, NULL);
 }
 
+static void
+options_from_env(struct wlc_options *options)
+{
+   assert(options);
+
+   *options = (struct wlc_options){
+      .hidden_frame_rate = 1,
+      .damage_tracking = true,
+      .render_threads = false,
+      .retained_scene = true,
+   };
+
+   chck_cstr_to_bool(getenv("WLC_DAMAGE_TRACKING"), &options->damage_tracking);
+   chck_cstr_to_bool(getenv("WLC_RENDER_THREADS"), &options->render_threads);
+   chck_cstr_to_bool(getenv("WLC_RETAINED_SCENE"), &options->retained_scene);
+
+   if (chck_cstr_to_u32(getenv("WLC_HIDDEN_FRAME_RATE"), &options->hidden_frame_rate))
+      options->hidden_frame_rate = chck_clampu32(options->hidden_frame_rate, 1, 1000);
+}
+
 WLC_API bool
 wlc_init(void)
 {
@@ -294,16 +323,18 @@ wlc_init(void)
    }
 
    wl_log_set_handler_server(wl_cb_log);
+   options_from_env(&wlc.options);
 
    unsetenv("TERM");
    const char *x11display = getenv("DISPLAY");
+   const bool headless = wlc_headless_requested();
    bool privileged = false;
    const bool has_logind = wlc_logind_available();
 
    if (getuid() != geteuid() || getgid() != getegid()) {
       wlc_log(WLC_LOG_INFO, "Doing work on SUID/SGID side and dropping permissions");
       privileged = true;
-   } else if (!x11display && !has_logind && access("/dev/input/event0", R_OK | W_OK) != 0) {
+   } else if (!x11display && !headless && !has_logind && access("/dev/input/event0", R_OK | W_OK) != 0) {
       die("Not running from X11 and no access to /dev/input/event0 or logind unavailable");
    }
 
@@ -312,7 +343,7 @@ wlc_init(void)
 #ifdef HAS_LOGIND
    // Init logind if we are not running as SUID.
    // We need event loop for logind to work, and thus we won't allow it on SUID process.
-   if (!privileged && !x11display && has_logind) {
+   if (!privileged && !x11display && !headless && has_logind) {
       if (!(wlc.display = wl_display_create()))
          die("Failed to create wayland display");
 
@@ -324,7 +355,7 @@ wlc_init(void)
    (void)privileged;
 #endif
 
-   if (!x11display)
+   if (!x11display && !headless)
       wlc_tty_init(vt);
 
    // -- we open tty before dropping permissions
@@ -367,13 +398,16 @@ wlc_init(void)
    if (wl_display_init_shm(wlc.display) != 0)
       die("Failed to init shm");
 
-   if (!wlc_udev_init())
-      die("Failed to init udev");
+   // Headless has no input devices or drm hotplug to listen
+   if (!headless) {
+      if (!wlc_udev_init())
+         die("Failed to init udev");
 
-   const char *libinput = getenv("WLC_LIBINPUT");
-   if (!x11display || (libinput && !chck_cstreq(libinput, "0"))) {
-      if (!wlc_input_init())
-         die("Failed to init input");
+      const char *libinput = getenv("WLC_LIBINPUT");
+      if (!x11display || (libinput && !chck_cstreq(libinput, "0"))) {
+         if (!wlc_input_init())
+            die("Failed to init input");
+      }
    }
 
    if (!wlc_compositor(&wlc.compositor))
@@ -394,6 +394,7 @@ compositor_test_create(struct compositor_test *test, const char *name)
    test->name = name;
    wlc_log_set_handler(cb_log);
    setup_signals(compositor_sigterm);
+   setenv("WLC_BACKEND", "headless", false);
    assert(wlc_init());
 }
 
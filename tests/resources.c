@@ -83,6 +83,33 @@ main(void)
       wlc_resources_terminate();
    }
 
+   // TEST: Stale handle does not resolve to reused slot
+   {
+      assert(wlc_resources_init());
+
+      struct wlc_source source;
+      assert(wlc_source(&source, "test", NULL, NULL, 1, sizeof(struct wlc_resource)));
+
+      struct wlc_resource *ptr;
+      wlc_handle handle, handle2;
+      assert((ptr = wlc_handle_create(&source)));
+      assert((handle = convert_to_wlc_handle(ptr)));
+      wlc_handle_release(handle);
+
+      assert((ptr = wlc_handle_create(&source)));
+      assert((handle2 = convert_to_wlc_handle(ptr)));
+      assert(handle != handle2);
+      assert(!convert_from_wlc_handle(handle, "test"));
+      assert(convert_from_wlc_handle(handle2, "test") == ptr);
+
+      // stale release must not release the new handle
+      wlc_handle_release(handle);
+      assert(convert_from_wlc_handle(handle2, "test") == ptr);
+
+      wlc_source_release(&source);
+      wlc_resources_terminate();
+   }
+
    // TEST: Handle invalidation on source release
    {
       assert(wlc_resources_init());
@@ -129,7 +156,7 @@ main(void)
       wlc_source_release(&source);
    }
 
-   // TEST: Relocation of source inside container of handle, when the handle's source changes location
+   // TEST: Source inside container of handle keeps its address, when the handle's source grows
    {
       assert(wlc_resources_init());
 
@@ -151,20 +178,18 @@ main(void)
       assert((handle2 = convert_to_wlc_handle(ptr2)));
       assert(convert_from_wlc_handle(handle2, "test2") == ptr2);
 
-      // Play with heap until realloc does not return linear memory anymore
-      {
-         void *original = source.pool.items.buffer;
-         do {
-            void *garbage;
-            assert((garbage = malloc(1024)));
-            assert(wlc_handle_create(&source));
-            free(garbage);
-         } while (original == source.pool.items.buffer);
+      // Grow the source over many chunks while playing with heap
+      for (uint32_t i = 0; i < 1024; ++i) {
+         void *garbage;
+         assert((garbage = malloc(1024)));
+         assert(wlc_handle_create(&source));
+         free(garbage);
       }
 
-      // So this should be true
-      assert(ptr = convert_from_wlc_handle(handle, "test"));
-      assert(original_source != &ptr->source);
+      // Neither the container nor the handle inside its source moved
+      assert(convert_from_wlc_handle(handle, "test") == ptr);
+      assert(original_source == &ptr->source);
+      assert(convert_from_wlc_handle(handle2, "test2") == ptr2);
 
       wlc_resources_terminate();
 
@@ -0,0 +1,185 @@
+#include "client.h"
+
+static struct compositor_test compositor;
+static wlc_handle occluded_view;
+static bool subsurface_moved = false;
+static bool repainted_after_move = false;
+
+static void
+subcompositor_global(void *data, struct wl_registry *registry, uint32_t name, const char *interface, uint32_t version)
+{
+   (void)version;
+
+   if (chck_cstreq(interface, "wl_subcompositor"))
+      assert((*(struct wl_subcompositor**)data = wl_registry_bind(registry, name, &wl_subcompositor_interface, 1)));
+}
+
+static const struct wl_registry_listener subcompositor_listener = {
+   .global = subcompositor_global,
+   .global_remove = handle_global_remove,
+};
+
+static void
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+   (void)time;
+   wl_callback_destroy(callback);
+   *(bool*)data = true;
+}
+
+static const struct wl_callback_listener frame_listener = {
+   .done = frame_done
+};
+
+static struct wl_buffer*
+create_small_buffer(struct client_test *test, uint32_t size)
+{
+   int fd;
+   void *data;
+   const size_t bytes = size * size * 4;
+   assert((fd = os_create_anonymous_file(bytes)) >= 0);
+   assert((data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED);
+   memset(data, 128, bytes);
+
+   struct wl_shm_pool *pool;
+   struct wl_buffer *buffer;
+   assert((pool = wl_shm_create_pool(test->shm, fd, bytes)));
+   assert((buffer = wl_shm_pool_create_buffer(pool, 0, size, size, size * 4, WL_SHM_FORMAT_ARGB8888)));
+   wl_shm_pool_destroy(pool);
+   close(fd);
+   return buffer;
+}
+
+static int
+client_main(void)
+{
+   struct client_test client;
+   client_test_create(&client, "subsurface", 320, 320);
+
+   struct wl_registry *registry;
+   struct wl_subcompositor *subcompositor = NULL;
+   assert((registry = wl_display_get_registry(client.display)));
+   wl_registry_add_listener(registry, &subcompositor_listener, &subcompositor);
+   wl_display_roundtrip(client.display);
+   assert(subcompositor);
+
+   // View with a subsurface in the middle of it, mapped first so it ends up at the bottom
+   surface_create(&client);
+   shell_surface_create(&client);
+
+   struct wl_surface *sub;
+   struct wl_subsurface *subsurface;
+   assert((sub = wl_compositor_create_surface(client.compositor)));
+   assert((subsurface = wl_subcompositor_get_subsurface(subcompositor, sub, client.view.surface)));
+   wl_subsurface_set_desync(subsurface);
+   wl_subsurface_set_position(subsurface, 32, 32);
+   wl_surface_attach(sub, create_small_buffer(&client, 32), 0, 0);
+   wl_surface_damage(sub, 0, 0, 32, 32);
+   wl_surface_commit(sub);
+   wl_surface_commit(client.view.surface);
+
+   // Opaque view of the same size on top, occluding the one below with its subsurface
+   struct wl_surface *top;
+   struct wl_shell_surface *top_ssurface;
+   assert((top = wl_compositor_create_surface(client.compositor)));
+   assert((top_ssurface = wl_shell_get_shell_surface(client.shell, top)));
+   wl_shell_surface_add_listener(top_ssurface, &shell_surface_listener, &client);
+   wl_shell_surface_set_toplevel(top_ssurface);
+
+   struct wl_region *opaque;
+   assert((opaque = wl_compositor_create_region(client.compositor)));
+   wl_region_add(opaque, 0, 0, client.view.width, client.view.height);
+   wl_surface_set_opaque_region(top, opaque);
+   wl_region_destroy(opaque);
+
+   bool top_painted = false;
+   struct wl_callback *frame;
+   assert((frame = wl_surface_frame(top)));
+   wl_callback_add_listener(frame, &frame_listener, &top_painted);
+   wl_surface_attach(top, client.buffer.wbuf, 0, 0);
+   wl_surface_damage(top, 0, 0, client.view.width, client.view.height);
+   wl_surface_commit(top);
+
+   while (!top_painted && wl_display_dispatch(client.display) != -1);
+
+   // Move the subsurface out from under the occluding view, title tells the compositor the move is coming
+   wl_subsurface_set_position(subsurface, client.view.width + 32, 32);
+   wl_shell_surface_set_title(client.view.ssurface, "moved");
+   wl_surface_commit(client.view.surface);
+
+   while (wl_display_dispatch(client.display) != -1);
+   return client_test_end(&client);
+}
+
+static bool
+view_created(wlc_handle view)
+{
+   wlc_view_set_mask(view, wlc_output_get_mask(wlc_view_get_output(view)));
+
+   if (!occluded_view) {
+      occluded_view = view;
+      wlc_view_send_to_back(view);
+   } else {
+      wlc_view_bring_to_front(view);
+   }
+
+   return true;
+}
+
+static void
+view_properties_updated(wlc_handle view, uint32_t mask)
+{
+   if (view == occluded_view && (mask & WLC_BIT_PROPERTY_TITLE))
+      subsurface_moved = true;
+}
+
+static void
+view_render_pre(wlc_handle view)
+{
+   if (view != occluded_view || !subsurface_moved || repainted_after_move)
+      return;
+
+   repainted_after_move = true;
+   signal_client(&compositor);
+}
+
+static int
+cb_timeout(void *data)
+{
+   (void)data;
+   wlc_terminate();
+   return 1;
+}
+
+static void
+compositor_ready(void)
+{
+   compositor_test_fork_client(&compositor, client_main);
+}
+
+static int
+compositor_main(void)
+{
+   wlc_set_view_created_cb(view_created);
+   wlc_set_view_properties_updated_cb(view_properties_updated);
+   wlc_set_view_render_pre_cb(view_render_pre);
+   wlc_set_compositor_ready_cb(compositor_ready);
+
+   compositor_test_create(&compositor, "subsurface");
+
+   // Without a repaint the client waits forever
+   struct wlc_event_source *timeout;
+   assert((timeout = wlc_event_loop_add_timer(cb_timeout, NULL)));
+   wlc_event_source_timer_update(timeout, 5000);
+
+   wlc_run();
+
+   assert(repainted_after_move);
+   return compositor_test_end(&compositor);
+}
+
+int
+main(void)
+{
+   return compositor_main();
+}